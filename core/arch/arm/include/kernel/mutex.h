@@ -18,12 +18,27 @@
 #define MUTEX_OWNER_ID_CONDVAR_SLEEP	-2
 #define MUTEX_OWNER_ID_MUTEX_UNLOCK	-3
 
+/*
+ * struct mutex_stats - contention counters
+ * @contended:		lock calls which found the mutex held
+ * @spin_acquired:	times the mutex was taken right after spinning on it
+ * @sleeps:		waits in normal world for the mutex
+ */
+struct mutex_stats {
+	uint32_t contended;
+	uint32_t spin_acquired;
+	uint32_t sleeps;
+};
+
 struct mutex {
 	unsigned spin_lock;	/* used when operating on this struct */
 	struct wait_queue wq;
 	short state;		/* -1: write, 0: unlocked, > 0: readers */
 	short owner_id;		/* Only valid for state == -1 (write lock) */
 	TAILQ_ENTRY(mutex) link;
+#ifdef CFG_WITH_STATS
+	struct mutex_stats stats;
+#endif
 };
 #define MUTEX_INITIALIZER \
 	{ .owner_id = MUTEX_OWNER_ID_NONE, .wq = WAIT_QUEUE_INITIALIZER, }
@@ -33,6 +48,13 @@ TAILQ_HEAD(mutex_head, mutex);
 void mutex_init(struct mutex *m);
 void mutex_destroy(struct mutex *m);
 
+#ifdef CFG_WITH_STATS
+/* Returns the contention counters of @m */
+void mutex_get_stats(struct mutex *m, struct mutex_stats *stats);
+/* Returns the contention counters summed over all mutexes */
+void mutex_get_total_stats(struct mutex_stats *stats);
+#endif
+
 #ifdef CFG_MUTEX_DEBUG
 void mutex_unlock_debug(struct mutex *m, const char *fname, int lineno);
 #define mutex_unlock(m) mutex_unlock_debug((m), __FILE__, __LINE__)
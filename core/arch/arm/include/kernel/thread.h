@@ -68,10 +68,7 @@ struct thread_specific_data {
 	TAILQ_HEAD(, tee_ta_session) sess_stack;
 	struct tee_ta_ctx *ctx;
 	struct pgt_cache pgt_cache;
-	void *rpc_fs_payload;
-	struct mobj *rpc_fs_payload_mobj;
-	uint64_t rpc_fs_payload_cookie;
-	size_t rpc_fs_payload_size;
+	struct tee_fs_rpc_payload *rpc_fs_payload;
 };
 
 struct thread_user_vfp_state {
@@ -564,6 +561,31 @@ void thread_add_mutex(struct mutex *m);
  */
 void thread_rem_mutex(struct mutex *m);
 
+/*
+ * Returns true if thread @thread_id is executing on a core, as opposed to
+ * being free or suspended. Read without locking, so the answer is only a
+ * hint which may be outdated once returned.
+ */
+bool thread_is_running(int thread_id);
+
+/*
+ * struct thread_stats - usage of the thread pool
+ * @busy:		threads currently running or suspended
+ * @busy_max:		high-water mark of @busy
+ * @dyn_stacks:		threads currently using a stack from the heap
+ * @limit_hits:		calls refused with OPTEE_SMC_RETURN_ETHREAD_LIMIT
+ */
+struct thread_stats {
+	uint32_t busy;
+	uint32_t busy_max;
+	uint32_t dyn_stacks;
+	uint32_t limit_hits;
+};
+
+#ifdef CFG_WITH_STATS
+void thread_get_stats(struct thread_stats *stats);
+#endif
+
 /*
  * Disables and empties the prealloc RPC cache one reference at a time. If
  * all threads are idle this function returns true and a cookie of one shm
@@ -580,6 +602,12 @@ bool thread_disable_prealloc_rpc_cache(uint64_t *cookie);
  */
 bool thread_enable_prealloc_rpc_cache(void);
 
+/*
+ * Returns true if the prealloc RPC cache is enabled, that is if normal
+ * world allows shared memory to be kept by secure world between calls.
+ */
+bool thread_prealloc_rpc_cache_is_enabled(void);
+
 /**
  * Allocates data for struct optee_msg_arg.
  *
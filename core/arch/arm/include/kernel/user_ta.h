@@ -6,6 +6,7 @@
 #define KERNEL_USER_TA_H
 
 #include <assert.h>
+#include <kernel/handle.h>
 #include <kernel/tee_ta_manager.h>
 #include <kernel/thread.h>
 #include <mm/tee_mm.h>
@@ -27,7 +28,9 @@ TAILQ_HEAD(user_ta_elf_head, user_ta_elf);
  * @is_32bit:		True if 32-bit TA, false if 64-bit TA
  * @open_sessions:	List of sessions opened by this TA
  * @cryp_states:	List of cryp states created by this TA
+ * @cryp_state_handles:	Handles of the cryp states, ids seen by the TA
  * @objects:		List of storage objects opened by this TA
+ * @object_handles:	Handles of the objects, ids seen by the TA
  * @storage_enums:	List of storage enumerators opened by this TA
  * @mobj_code:		Secure world memory for code and data
  * @mobj_stack:		Secure world memory for stack
@@ -48,7 +51,9 @@ struct user_ta_ctx {
 	bool is_32bit;
 	struct tee_ta_session_head open_sessions;
 	struct tee_cryp_state_head cryp_states;
+	struct handle_db cryp_state_handles;
 	struct tee_obj_head objects;
+	struct handle_db object_handles;
 	struct tee_storage_enum_head storage_enums;
 	struct user_ta_elf_head elfs;
 	struct mobj *mobj_stack;
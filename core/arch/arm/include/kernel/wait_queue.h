@@ -63,6 +63,14 @@ bool wq_have_condvar(struct wait_queue *wq, struct condvar *cv);
 
 void __wq_rpc(uint32_t func, int id, const void *sync_obj, int owner,
 	      const char *fname, int lineno);
+void __wq_rpc_wakeup_list(const short *ids, size_t num_ids,
+			  const void *sync_obj, const char *fname, int lineno);
+
+/*
+ * Tells if normal world can wake up several keys with one RPC, as
+ * reported with OPTEE_SMC_NSEC_CAP_WQ_WAKEUP_LIST
+ */
+void wq_set_wakeup_list_supported(bool supported);
 
 #endif /*KERNEL_WAIT_QUEUE_H*/
 
@@ -265,6 +265,8 @@
  */
 /* Normal world works as a uniprocessor system */
 #define OPTEE_SMC_NSEC_CAP_UNIPROCESSOR		(1 << 0)
+/* Normal world handles OPTEE_MSG_RPC_WAIT_QUEUE_WAKEUP_LIST */
+#define OPTEE_SMC_NSEC_CAP_WQ_WAKEUP_LIST	(1 << 1)
 /* Secure world has reserved shared memory for normal world to use */
 #define OPTEE_SMC_SEC_CAP_HAVE_RESERVED_SHM	(1 << 0)
 /* Secure world can communicate via previously unregistered shared memory */
@@ -276,6 +278,12 @@
  */
 #define OPTEE_SMC_SEC_CAP_DYNAMIC_SHM		(1 << 2)
 
+/* Secure world supports OPTEE_MSG_CMD_REGISTER_CMD_RING */
+#define OPTEE_SMC_SEC_CAP_CMD_RING		(1 << 3)
+
+/* Secure world supports OPTEE_MSG_CMD_REGISTER_CALL_QUEUE */
+#define OPTEE_SMC_SEC_CAP_CALL_QUEUE		(1 << 4)
+
 #define OPTEE_SMC_FUNCID_EXCHANGE_CAPABILITIES	9
 #define OPTEE_SMC_EXCHANGE_CAPABILITIES \
 	OPTEE_SMC_FAST_CALL_VAL(OPTEE_SMC_FUNCID_EXCHANGE_CAPABILITIES)
@@ -422,6 +430,72 @@
 #define OPTEE_SMC_VM_DESTROYED \
 	OPTEE_SMC_FAST_CALL_VAL(OPTEE_SMC_FUNCID_VM_DESTROYED)
 
+/*
+ * Process the command ring of a session, see struct optee_msg_cmd_ring
+ *
+ * Doorbell for a ring registered with OPTEE_MSG_CMD_REGISTER_CMD_RING,
+ * saves normal world from passing a struct optee_msg_arg for each invoke
+ * command. Secure world processes entries until the ring is empty.
+ *
+ * Call register usage:
+ * a0	SMC Function ID, OPTEE_SMC_CALL_WITH_CMD_RING
+ * a1	Session id
+ * a2-6	Not used
+ * a7	Hypervisor Client ID register
+ *
+ * Normal return register usage:
+ * a0	OPTEE_SMC_RETURN_OK
+ * a1	Number of processed entries
+ * a2-7	Preserved
+ *
+ * Possible return values:
+ * OPTEE_SMC_RETURN_UNKNOWN_FUNCTION	Trusted OS does not recognize this
+ *					function.
+ * OPTEE_SMC_RETURN_OK			Ring processed, results updated in
+ *					the entries.
+ * OPTEE_SMC_RETURN_ETHREAD_LIMIT	Number of Trusted OS threads exceeded,
+ *					try again later.
+ * OPTEE_SMC_RETURN_EBADCMD		No ring registered for the session or
+ *					the ring is corrupt.
+ * OPTEE_SMC_RETURN_IS_RPC()		Call suspended by RPC call to normal
+ *					world.
+ */
+#define OPTEE_SMC_FUNCID_CALL_WITH_CMD_RING	15
+#define OPTEE_SMC_CALL_WITH_CMD_RING \
+	OPTEE_SMC_STD_CALL_VAL(OPTEE_SMC_FUNCID_CALL_WITH_CMD_RING)
+
+/*
+ * Process the requests of a call queue, see struct optee_msg_call_queue
+ *
+ * Doorbell for a queue registered with OPTEE_MSG_CMD_REGISTER_CALL_QUEUE.
+ * Secure world processes submitted requests until the submission queue
+ * is empty or the completion queue is full.
+ *
+ * Call register usage:
+ * a0	SMC Function ID, OPTEE_SMC_CALL_WITH_QUEUE
+ * a1	Id of the queue
+ * a2-6	Not used
+ * a7	Hypervisor Client ID register
+ *
+ * Normal return register usage:
+ * a0	OPTEE_SMC_RETURN_OK
+ * a1	Number of completed requests
+ * a2-7	Preserved
+ *
+ * Possible return values:
+ * OPTEE_SMC_RETURN_UNKNOWN_FUNCTION	Trusted OS does not recognize this
+ *					function.
+ * OPTEE_SMC_RETURN_OK			Queue processed, completions posted.
+ * OPTEE_SMC_RETURN_ETHREAD_LIMIT	Number of Trusted OS threads exceeded,
+ *					try again later.
+ * OPTEE_SMC_RETURN_EBADCMD		No such queue or the queue is corrupt.
+ * OPTEE_SMC_RETURN_IS_RPC()		Call suspended by RPC call to normal
+ *					world.
+ */
+#define OPTEE_SMC_FUNCID_CALL_WITH_QUEUE	16
+#define OPTEE_SMC_CALL_WITH_QUEUE \
+	OPTEE_SMC_STD_CALL_VAL(OPTEE_SMC_FUNCID_CALL_WITH_QUEUE)
+
 /*
  * Resume from RPC (for example after processing a foreign interrupt)
  *
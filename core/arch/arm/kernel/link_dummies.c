@@ -37,3 +37,10 @@ __wq_rpc(uint32_t func __unused, int id __unused,
 	 const char *fname __unused, int lineno  __unused)
 {
 }
+
+void __section(".text.dummy.__wq_rpc_wakeup_list")
+__wq_rpc_wakeup_list(const short *ids __unused, size_t num_ids __unused,
+		     const void *sync_obj __unused,
+		     const char *fname __unused, int lineno __unused)
+{
+}
@@ -3,19 +3,64 @@
  * Copyright (c) 2015-2017, Linaro Limited
  */
 
+#include <atomic.h>
 #include <kernel/mutex.h>
 #include <kernel/panic.h>
 #include <kernel/spinlock.h>
 #include <kernel/thread.h>
 #include <trace.h>
 
+#ifdef CFG_WITH_STATS
+static struct mutex_stats total_stats;
+
+#define MUTEX_STATS_INC(m, counter) \
+	do { \
+		(m)->stats.counter++; \
+		atomic_inc32(&total_stats.counter); \
+	} while (0)
+#else
+#define MUTEX_STATS_INC(m, counter)	do { } while (0)
+#endif
+
 void mutex_init(struct mutex *m)
 {
 	*m = (struct mutex)MUTEX_INITIALIZER;
 }
 
+/*
+ * Returns true if a contended lock call should spin before waiting in
+ * normal world, that is if the write lock owner is running on another
+ * core. Called with m->spin_lock held.
+ */
+static bool can_spin(struct mutex *m)
+{
+	return CFG_MUTEX_SPIN_COUNT && m->state == -1 && m->owner_id >= 0 &&
+	       thread_is_running(m->owner_id);
+}
+
+/*
+ * Spins while @m stays write locked by @owner and @owner keeps running.
+ * Most critical sections are short, so the mutex is often released
+ * before a wait in normal world would have completed. Such a wait costs
+ * one RPC to sleep and another one to be woken up.
+ */
+static void spin_on_owner(struct mutex *m, int owner)
+{
+	volatile short *state = &m->state;
+	volatile short *owner_id = &m->owner_id;
+	unsigned int n;
+
+	for (n = CFG_MUTEX_SPIN_COUNT; n; n--)
+		if (*state != -1 || *owner_id != owner ||
+		    !thread_is_running(owner))
+			return;
+}
+
 static void __mutex_lock(struct mutex *m, const char *fname, int lineno)
 {
+	bool contended = false;
+	bool spun = false;
+
 	assert_have_no_spinlock();
 	assert(thread_get_id_may_fail() != -1);
 	assert(thread_is_in_normal_mode());
@@ -23,6 +68,7 @@ static void __mutex_lock(struct mutex *m, const char *fname, int lineno)
 	while (true) {
 		uint32_t old_itr_status;
 		bool can_lock;
+		bool spin = false;
 		struct wait_queue_elem wqe;
 		int owner = MUTEX_OWNER_ID_NONE;
 
@@ -39,24 +85,45 @@ static void __mutex_lock(struct mutex *m, const char *fname, int lineno)
 
 		can_lock = !m->state;
 		if (!can_lock) {
-			wq_wait_init(&m->wq, &wqe, false /* wait_read */);
+			if (!contended)
+				MUTEX_STATS_INC(m, contended);
+			contended = true;
 			owner = m->owner_id;
 			assert(owner != thread_get_id_may_fail());
+			spin = !spun && can_spin(m);
+			if (!spin) {
+				wq_wait_init(&m->wq, &wqe,
+					     false /* wait_read */);
+				MUTEX_STATS_INC(m, sleeps);
+			}
 		} else {
 			m->state = -1; /* write locked */
 			thread_add_mutex(m);
+			if (spun)
+				MUTEX_STATS_INC(m, spin_acquired);
 		}
 
 		cpu_spin_unlock_xrestore(&m->spin_lock, old_itr_status);
 
-		if (!can_lock) {
+		if (can_lock)
+			return;
+
+		if (spin) {
+			/*
+			 * The owner is running on another core and is
+			 * likely to release the lock soon, spin for a
+			 * while before trying again.
+			 */
+			spin_on_owner(m, owner);
+			spun = true;
+		} else {
 			/*
 			 * Someone else is holding the lock, wait in normal
 			 * world for the lock to become available.
 			 */
 			wq_wait_final(&m->wq, &wqe, m, owner, fname, lineno);
-		} else
-			return;
+			spun = false;
+		}
 	}
 }
 
@@ -126,6 +193,9 @@ static void __mutex_read_unlock(struct mutex *m, const char *fname, int lineno)
 
 static void __mutex_read_lock(struct mutex *m, const char *fname, int lineno)
 {
+	bool contended = false;
+	bool spun = false;
+
 	assert_have_no_spinlock();
 	assert(thread_get_id_may_fail() != -1);
 	assert(thread_is_in_normal_mode());
@@ -133,6 +203,7 @@ static void __mutex_read_lock(struct mutex *m, const char *fname, int lineno)
 	while (true) {
 		uint32_t old_itr_status;
 		bool can_lock;
+		bool spin = false;
 		struct wait_queue_elem wqe;
 		int owner = MUTEX_OWNER_ID_NONE;
 
@@ -149,23 +220,44 @@ static void __mutex_read_lock(struct mutex *m, const char *fname, int lineno)
 
 		can_lock = m->state != -1;
 		if (!can_lock) {
-			wq_wait_init(&m->wq, &wqe, true /* wait_read */);
+			if (!contended)
+				MUTEX_STATS_INC(m, contended);
+			contended = true;
 			owner = m->owner_id;
 			assert(owner != thread_get_id_may_fail());
+			spin = !spun && can_spin(m);
+			if (!spin) {
+				wq_wait_init(&m->wq, &wqe,
+					     true /* wait_read */);
+				MUTEX_STATS_INC(m, sleeps);
+			}
 		} else {
 			m->state++; /* read_locked */
+			if (spun)
+				MUTEX_STATS_INC(m, spin_acquired);
 		}
 
 		cpu_spin_unlock_xrestore(&m->spin_lock, old_itr_status);
 
-		if (!can_lock) {
+		if (can_lock)
+			return;
+
+		if (spin) {
+			/*
+			 * The owner is running on another core and is
+			 * likely to release the lock soon, spin for a
+			 * while before trying again.
+			 */
+			spin_on_owner(m, owner);
+			spun = true;
+		} else {
 			/*
 			 * Someone else is holding the lock, wait in normal
 			 * world for the lock to become available.
 			 */
 			wq_wait_final(&m->wq, &wqe, m, owner, fname, lineno);
-		} else
-			return;
+			spun = false;
+		}
 	}
 }
 
@@ -252,6 +344,24 @@ bool mutex_read_trylock(struct mutex *m)
 }
 #endif
 
+#ifdef CFG_WITH_STATS
+void mutex_get_stats(struct mutex *m, struct mutex_stats *stats)
+{
+	uint32_t old_itr_status;
+
+	old_itr_status = cpu_spin_lock_xsave(&m->spin_lock);
+	*stats = m->stats;
+	cpu_spin_unlock_xrestore(&m->spin_lock, old_itr_status);
+}
+
+void mutex_get_total_stats(struct mutex_stats *stats)
+{
+	stats->contended = total_stats.contended;
+	stats->spin_acquired = total_stats.spin_acquired;
+	stats->sleeps = total_stats.sleeps;
+}
+#endif
+
 void mutex_destroy(struct mutex *m)
 {
 	/*
@@ -8,6 +8,7 @@
 
 #include <arm.h>
 #include <assert.h>
+#include <atomic.h>
 #include <keep.h>
 #include <kernel/asan.h>
 #include <kernel/misc.h>
@@ -17,6 +18,7 @@
 #include <kernel/tee_ta_manager.h>
 #include <kernel/thread_defs.h>
 #include <kernel/thread.h>
+#include <malloc.h>
 #include <mm/core_memprot.h>
 #include <mm/mobj.h>
 #include <mm/tee_mm.h>
@@ -67,6 +69,21 @@
 #endif
 #endif /*ARM64*/
 
+/*
+ * Without pager only the first THREAD_NUM_STATIC_STACKS threads have a
+ * statically allocated stack, the other threads get a stack from the heap
+ * while they're in use. With pager all stacks are paged in on demand.
+ */
+#ifdef CFG_WITH_PAGER
+#define THREAD_NUM_STATIC_STACKS	CFG_NUM_THREADS
+#else
+#define THREAD_NUM_STATIC_STACKS	CFG_NUM_THREADS_STATIC
+#endif
+
+#if THREAD_NUM_STATIC_STACKS < 1 || THREAD_NUM_STATIC_STACKS > CFG_NUM_THREADS
+#error "Invalid CFG_NUM_THREADS_STATIC"
+#endif
+
 struct thread_ctx threads[CFG_NUM_THREADS];
 
 struct thread_core_local thread_core_local[CFG_TEE_CORE_NB_CORE];
@@ -102,7 +119,8 @@ linkage uint32_t name[num_stacks] \
 DECLARE_STACK(stack_tmp, CFG_TEE_CORE_NB_CORE, STACK_TMP_SIZE, static);
 DECLARE_STACK(stack_abt, CFG_TEE_CORE_NB_CORE, STACK_ABT_SIZE, static);
 #ifndef CFG_WITH_PAGER
-DECLARE_STACK(stack_thread, CFG_NUM_THREADS, STACK_THREAD_SIZE, static);
+DECLARE_STACK(stack_thread, CFG_NUM_THREADS_STATIC, STACK_THREAD_SIZE,
+	      static);
 #endif
 
 const void *stack_tmp_export = (uint8_t *)stack_tmp + sizeof(stack_tmp[0]) -
@@ -140,9 +158,17 @@ static uint8_t thread_user_kdata_page[
 	__aligned(SMALL_PAGE_SIZE) __section(".nozi.kdata_page");
 #endif
 
-static unsigned int thread_global_lock = SPINLOCK_UNLOCK;
+/* Per core index of the thread to try first when allocating a thread */
+static size_t thread_alloc_hint[CFG_TEE_CORE_NB_CORE];
 static bool thread_prealloc_rpc_cache;
 
+#ifdef CFG_WITH_STATS
+static uint32_t thread_busy;
+static uint32_t thread_busy_max;
+static uint32_t thread_dyn_stacks;
+static uint32_t thread_limit_hits;
+#endif
+
 static unsigned int thread_rpc_pnum;
 
 static void init_canaries(void)
@@ -205,14 +231,67 @@ void thread_check_canaries(void)
 #endif/*CFG_WITH_STACK_CANARIES*/
 }
 
-static void lock_global(void)
+/*
+ * Thread states are changed with compare-and-swap instead of under a
+ * global lock, so that standard calls entering on different cores don't
+ * serialize. A thread is owned by the core which moved it out of
+ * THREAD_STATE_FREE or THREAD_STATE_SUSPENDED. @release is used when
+ * handing the thread over, to publish earlier updates of the thread
+ * context along with the new state.
+ */
+static bool thread_state_cas(size_t n, enum thread_state old_state,
+			     enum thread_state new_state, bool release)
+{
+	uint32_t *state = (uint32_t *)&threads[n].state;
+	uint32_t old;
+
+	COMPILE_TIME_ASSERT(sizeof(threads[n].state) == sizeof(uint32_t));
+
+	/* The swap may fail spuriously, retry until it's a real mismatch */
+	do {
+		old = old_state;
+		if (release) {
+			if (atomic_cas_u32_release(state, &old, new_state))
+				return true;
+		} else {
+			if (atomic_cas_u32(state, &old, new_state))
+				return true;
+		}
+	} while (old == old_state);
+
+	return false;
+}
+
+/*
+ * Claims all free threads. Returns true if all threads were free, else
+ * the claimed threads are released again and false is returned. While
+ * all threads are claimed no new standard call can start.
+ */
+static bool claim_all_threads(void)
 {
-	cpu_spin_lock(&thread_global_lock);
+	size_t n;
+
+	for (n = 0; n < CFG_NUM_THREADS; n++) {
+		if (!thread_state_cas(n, THREAD_STATE_FREE,
+				      THREAD_STATE_ACTIVE, false))
+			break;
+	}
+	if (n == CFG_NUM_THREADS)
+		return true;
+
+	while (n)
+		thread_state_cas(--n, THREAD_STATE_ACTIVE, THREAD_STATE_FREE,
+				 true);
+	return false;
 }
 
-static void unlock_global(void)
+static void release_all_threads(void)
 {
-	cpu_spin_unlock(&thread_global_lock);
+	size_t n;
+
+	for (n = 0; n < CFG_NUM_THREADS; n++)
+		thread_state_cas(n, THREAD_STATE_ACTIVE, THREAD_STATE_FREE,
+				 true);
 }
 
 #ifdef ARM32
@@ -402,8 +481,12 @@ void thread_init_boot_thread(void)
 		SLIST_INIT(&threads[n].tsd.pgt_cache);
 	}
 
-	for (n = 0; n < CFG_TEE_CORE_NB_CORE; n++)
+	for (n = 0; n < CFG_TEE_CORE_NB_CORE; n++) {
 		thread_core_local[n].curr_thread = -1;
+		/* Spread the cores so they start probing different threads */
+		thread_alloc_hint[n] = (n * THREAD_NUM_STATIC_STACKS) /
+				       CFG_TEE_CORE_NB_CORE;
+	}
 
 	l->curr_thread = 0;
 	threads[0].state = THREAD_STATE_ACTIVE;
@@ -420,31 +503,150 @@ void thread_clr_boot_thread(void)
 	l->curr_thread = -1;
 }
 
-static void thread_alloc_and_run(struct thread_smc_args *args)
+static bool thread_try_claim(size_t n)
+{
+	return threads[n].state == THREAD_STATE_FREE &&
+	       thread_state_cas(n, THREAD_STATE_FREE, THREAD_STATE_ACTIVE,
+				false);
+}
+
+#if THREAD_NUM_STATIC_STACKS < CFG_NUM_THREADS
+/* Gives a thread beyond the statically allocated stacks a stack */
+static bool thread_alloc_dyn_stack(size_t n)
+{
+	void *stack = memalign(STACK_ALIGNMENT, STACK_THREAD_SIZE);
+
+	if (!stack)
+		return false;
+
+	threads[n].stack_va_end = (vaddr_t)stack + STACK_THREAD_SIZE;
+#ifdef CFG_WITH_STATS
+	atomic_inc32(&thread_dyn_stacks);
+#endif
+	return true;
+}
+
+/* Called on the temporary stack once the thread has returned */
+static void thread_free_dyn_stack(size_t n)
+{
+	if (n < THREAD_NUM_STATIC_STACKS)
+		return;
+
+	free((void *)(threads[n].stack_va_end - STACK_THREAD_SIZE));
+	threads[n].stack_va_end = 0;
+#ifdef CFG_WITH_STATS
+	atomic_dec32(&thread_dyn_stacks);
+#endif
+}
+
+/*
+ * Claims a thread beyond the statically allocated stacks, done only when
+ * all those threads are busy so the pool grows with the load.
+ */
+static bool thread_claim_dyn(size_t *thread_id)
 {
 	size_t n;
+
+	for (n = THREAD_NUM_STATIC_STACKS; n < CFG_NUM_THREADS; n++) {
+		if (!thread_try_claim(n))
+			continue;
+		if (thread_alloc_dyn_stack(n)) {
+			*thread_id = n;
+			return true;
+		}
+		thread_state_cas(n, THREAD_STATE_ACTIVE, THREAD_STATE_FREE,
+				 true);
+		break;
+	}
+
+	return false;
+}
+#else
+static void thread_free_dyn_stack(size_t n __unused)
+{
+}
+
+static bool thread_claim_dyn(size_t *thread_id __unused)
+{
+	return false;
+}
+#endif
+
+#ifdef CFG_WITH_STATS
+static void thread_stats_inc_busy(void)
+{
+	uint32_t busy = atomic_inc32(&thread_busy);
+	uint32_t old = atomic_load_u32(&thread_busy_max);
+
+	while (busy > old && !atomic_cas_u32(&thread_busy_max, &old, busy))
+		;
+}
+
+static void thread_stats_dec_busy(void)
+{
+	atomic_dec32(&thread_busy);
+}
+
+static void thread_stats_limit_hit(void)
+{
+	atomic_inc32(&thread_limit_hits);
+}
+
+void thread_get_stats(struct thread_stats *stats)
+{
+	stats->busy = atomic_load_u32(&thread_busy);
+	stats->busy_max = atomic_load_u32(&thread_busy_max);
+	stats->dyn_stacks = atomic_load_u32(&thread_dyn_stacks);
+	stats->limit_hits = atomic_load_u32(&thread_limit_hits);
+}
+#else
+static void thread_stats_inc_busy(void)
+{
+}
+
+static void thread_stats_dec_busy(void)
+{
+}
+
+static void thread_stats_limit_hit(void)
+{
+}
+#endif
+
+static void thread_alloc_and_run(struct thread_smc_args *args)
+{
+	size_t n = thread_alloc_hint[get_core_pos()];
 	struct thread_core_local *l = thread_get_core_local();
 	bool found_thread = false;
+	size_t i;
 
 	assert(l->curr_thread == -1);
 
-	lock_global();
-
-	for (n = 0; n < CFG_NUM_THREADS; n++) {
-		if (threads[n].state == THREAD_STATE_FREE) {
-			threads[n].state = THREAD_STATE_ACTIVE;
+	/*
+	 * Start with the thread this core used last, its stack and context
+	 * are likely still in this core's cache.
+	 */
+	for (i = 0; i < THREAD_NUM_STATIC_STACKS; i++) {
+		if (thread_try_claim(n)) {
 			found_thread = true;
 			break;
 		}
+		n++;
+		if (n == THREAD_NUM_STATIC_STACKS)
+			n = 0;
 	}
 
-	unlock_global();
+	if (!found_thread)
+		found_thread = thread_claim_dyn(&n);
 
 	if (!found_thread) {
+		thread_stats_limit_hit();
 		args->a0 = OPTEE_SMC_RETURN_ETHREAD_LIMIT;
 		return;
 	}
 
+	thread_stats_inc_busy();
+
 	l->curr_thread = n;
 
 	threads[n].flags = 0;
@@ -523,16 +725,18 @@ static void thread_resume_from_rpc(struct thread_smc_args *args)
 
 	assert(l->curr_thread == -1);
 
-	lock_global();
-
 	if (n < CFG_NUM_THREADS &&
-	    threads[n].state == THREAD_STATE_SUSPENDED &&
-	    args->a7 == threads[n].hyp_clnt_id)
-		threads[n].state = THREAD_STATE_ACTIVE;
-	else
+	    thread_state_cas(n, THREAD_STATE_SUSPENDED, THREAD_STATE_ACTIVE,
+			     false)) {
+		if (args->a7 != threads[n].hyp_clnt_id) {
+			/* Not ours to resume, hand it back untouched */
+			thread_state_cas(n, THREAD_STATE_ACTIVE,
+					 THREAD_STATE_SUSPENDED, true);
+			rv = OPTEE_SMC_RETURN_ERESUME;
+		}
+	} else {
 		rv = OPTEE_SMC_RETURN_ERESUME;
-
-	unlock_global();
+	}
 
 	if (rv) {
 		args->a0 = rv;
@@ -679,14 +883,16 @@ void thread_state_free(void)
 		(void *)(threads[ct].stack_va_end - STACK_THREAD_SIZE),
 		STACK_THREAD_SIZE);
 
-	lock_global();
-
-	assert(threads[ct].state == THREAD_STATE_ACTIVE);
-	threads[ct].state = THREAD_STATE_FREE;
 	threads[ct].flags = 0;
+	if (ct < THREAD_NUM_STATIC_STACKS)
+		thread_alloc_hint[get_core_pos()] = ct;
+	thread_free_dyn_stack(ct);
+	thread_stats_dec_busy();
 	l->curr_thread = -1;
 
-	unlock_global();
+	if (!thread_state_cas(ct, THREAD_STATE_ACTIVE, THREAD_STATE_FREE,
+			      true))
+		panic();
 }
 
 #ifdef CFG_WITH_PAGER
@@ -734,9 +940,6 @@ int thread_state_suspend(uint32_t flags, uint32_t cpsr, vaddr_t pc)
 	}
 	thread_lazy_restore_ns_vfp();
 
-	lock_global();
-
-	assert(threads[ct].state == THREAD_STATE_ACTIVE);
 	threads[ct].flags |= flags;
 	threads[ct].regs.cpsr = cpsr;
 	threads[ct].regs.pc = pc;
@@ -750,7 +953,9 @@ int thread_state_suspend(uint32_t flags, uint32_t cpsr, vaddr_t pc)
 
 	l->curr_thread = -1;
 
-	unlock_global();
+	if (!thread_state_cas(ct, THREAD_STATE_ACTIVE, THREAD_STATE_SUSPENDED,
+			      true))
+		panic();
 
 	return ct;
 }
@@ -869,8 +1074,11 @@ static void init_thread_stacks(void)
 {
 	size_t n;
 
-	/* Assign the thread stacks */
-	for (n = 0; n < CFG_NUM_THREADS; n++) {
+	/*
+	 * Assign the static thread stacks, the other threads get their
+	 * stack when started.
+	 */
+	for (n = 0; n < CFG_NUM_THREADS_STATIC; n++) {
 		if (!thread_init_stack(n, GET_STACK(stack_thread[n])))
 			panic("thread_init_stack failed");
 	}
@@ -1296,19 +1504,25 @@ void thread_rem_mutex(struct mutex *m)
 	TAILQ_REMOVE(&threads[ct].mutexes, m, link);
 }
 
+bool thread_is_running(int thread_id)
+{
+	volatile enum thread_state *state;
+
+	assert(thread_id >= 0 && thread_id < CFG_NUM_THREADS);
+	state = &threads[thread_id].state;
+
+	return *state == THREAD_STATE_ACTIVE;
+}
+
 bool thread_disable_prealloc_rpc_cache(uint64_t *cookie)
 {
 	bool rv;
 	size_t n;
 	uint32_t exceptions = thread_mask_exceptions(THREAD_EXCP_FOREIGN_INTR);
 
-	lock_global();
-
-	for (n = 0; n < CFG_NUM_THREADS; n++) {
-		if (threads[n].state != THREAD_STATE_FREE) {
-			rv = false;
-			goto out;
-		}
+	if (!claim_all_threads()) {
+		rv = false;
+		goto out;
 	}
 
 	rv = true;
@@ -1318,37 +1532,38 @@ bool thread_disable_prealloc_rpc_cache(uint64_t *cookie)
 			*cookie = threads[n].rpc_carg;
 			threads[n].rpc_carg = 0;
 			threads[n].rpc_arg = NULL;
-			goto out;
+			goto release;
 		}
 	}
 
+	if (tee_fs_rpc_cache_drain(cookie))
+		goto release;
+
 	*cookie = 0;
 	thread_prealloc_rpc_cache = false;
+release:
+	release_all_threads();
 out:
-	unlock_global();
 	thread_unmask_exceptions(exceptions);
 	return rv;
 }
 
+bool thread_prealloc_rpc_cache_is_enabled(void)
+{
+	return thread_prealloc_rpc_cache;
+}
+
 bool thread_enable_prealloc_rpc_cache(void)
 {
 	bool rv;
-	size_t n;
 	uint32_t exceptions = thread_mask_exceptions(THREAD_EXCP_FOREIGN_INTR);
 
-	lock_global();
-
-	for (n = 0; n < CFG_NUM_THREADS; n++) {
-		if (threads[n].state != THREAD_STATE_FREE) {
-			rv = false;
-			goto out;
-		}
+	rv = claim_all_threads();
+	if (rv) {
+		thread_prealloc_rpc_cache = true;
+		release_all_threads();
 	}
 
-	rv = true;
-	thread_prealloc_rpc_cache = true;
-out:
-	unlock_global();
 	thread_unmask_exceptions(exceptions);
 	return rv;
 }
@@ -474,6 +474,8 @@ static void free_utc(struct user_ta_ctx *utc)
 	tee_svc_cryp_free_states(utc);
 	/* Close cryp objects opened by this TA */
 	tee_obj_close_all(utc);
+	handle_db_destroy(&utc->cryp_state_handles);
+	handle_db_destroy(&utc->object_handles);
 	/* Free emums created by this TA */
 	tee_svc_storage_close_all_enum(utc);
 	free(utc);
@@ -1058,8 +1060,6 @@ TEE_Result tee_ta_init_user_ta_session(const TEE_UUID *uuid,
 	utc->ctx.uuid = ta_head->uuid;
 	utc->entry_func = ta_head->entry.ptr64;
 	utc->ctx.ref_count = 1;
-	condvar_init(&utc->ctx.busy_cv);
-	TAILQ_INSERT_TAIL(&tee_ctxes, &utc->ctx, link);
 	s->ctx = &utc->ctx;
 
 	free_elf_states(utc);
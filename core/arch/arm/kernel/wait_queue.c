@@ -11,9 +11,10 @@
 #include <kernel/wait_queue.h>
 #include <kernel/thread.h>
 #include <trace.h>
+#include <util.h>
 
 static unsigned wq_spin_lock;
-
+static bool wakeup_list_supported;
 
 void wq_init(struct wait_queue *wq)
 {
@@ -49,6 +50,63 @@ void __weak __wq_rpc(uint32_t func, int id, const void *sync_obj __maybe_unused,
 		DMSG("%s thread %u ret 0x%x", cmd_str, id, ret);
 }
 
+/*
+ * Wakes up @num_ids keys with one RPC per
+ * OPTEE_MSG_RPC_WAIT_QUEUE_WAKEUP_LIST_MAX keys.
+ *
+ * Note: this function is weak for the same reason as __wq_rpc().
+ */
+void __weak __wq_rpc_wakeup_list(const short *ids, size_t num_ids,
+				 const void *sync_obj __maybe_unused,
+				 const char *fname, int lineno __maybe_unused)
+{
+	struct optee_msg_param params[THREAD_RPC_MAX_NUM_PARAMS];
+	struct optee_msg_param_value *v;
+	uint32_t ret;
+	size_t num;
+	size_t n;
+
+	while (num_ids) {
+		num = MIN(num_ids,
+			  (size_t)OPTEE_MSG_RPC_WAIT_QUEUE_WAKEUP_LIST_MAX);
+
+		if (fname)
+			DMSG("wake %zu threads from %d %p %s:%d", num, ids[0],
+			     sync_obj, fname, lineno);
+		else
+			DMSG("wake %zu threads from %d %p", num, ids[0],
+			     sync_obj);
+
+		memset(params, 0, sizeof(params));
+		params[0].attr = OPTEE_MSG_ATTR_TYPE_VALUE_INPUT;
+		params[0].u.value.a = OPTEE_MSG_RPC_WAIT_QUEUE_WAKEUP_LIST;
+		params[0].u.value.b = num;
+		for (n = 0; n < num; n++) {
+			params[1 + n / 3].attr = OPTEE_MSG_ATTR_TYPE_VALUE_INPUT;
+			v = &params[1 + n / 3].u.value;
+			if (n % 3 == 0)
+				v->a = ids[n];
+			else if (n % 3 == 1)
+				v->b = ids[n];
+			else
+				v->c = ids[n];
+		}
+
+		ret = thread_rpc_cmd(OPTEE_MSG_RPC_CMD_WAIT_QUEUE,
+				     1 + (num + 2) / 3, params);
+		if (ret != TEE_SUCCESS)
+			DMSG("wake list ret 0x%x", ret);
+
+		ids += num;
+		num_ids -= num;
+	}
+}
+
+void wq_set_wakeup_list_supported(bool supported)
+{
+	wakeup_list_supported = supported;
+}
+
 static void slist_add_tail(struct wait_queue *wq, struct wait_queue_elem *wqe)
 {
 	struct wait_queue_elem *wqe_iter;
@@ -106,50 +164,56 @@ void wq_wake_next(struct wait_queue *wq, const void *sync_obj,
 {
 	uint32_t old_itr_status;
 	struct wait_queue_elem *wqe;
-	int handle = -1;
-	bool do_wakeup = false;
+	short handles[CFG_NUM_THREADS];
+	size_t num_handles = 0;
 	bool wake_type_assigned = false;
 	bool wake_read = false; /* avoid gcc warning */
+	size_t n;
 
 	/*
 	 * If next type is wait_read wakeup all wqe with wait_read true.
 	 * If next type isn't wait_read wakeup only the first wqe which isn't
 	 * done.
+	 *
+	 * The wqe to wake up are all collected in one pass, so that
+	 * normal world can wake them up with a single RPC when it
+	 * supports it. There's at most one wqe per thread.
 	 */
 
-	while (true) {
-		old_itr_status = cpu_spin_lock_xsave(&wq_spin_lock);
+	old_itr_status = cpu_spin_lock_xsave(&wq_spin_lock);
 
-		SLIST_FOREACH(wqe, wq, link) {
-			if (wqe->cv)
-				continue;
-			if (wqe->done)
-				continue;
-			if (!wake_type_assigned) {
-				wake_read = wqe->wait_read;
-				wake_type_assigned = true;
-			}
-
-			if (wqe->wait_read != wake_read)
-				continue;
-
-			wqe->done = true;
-			handle = wqe->handle;
-			do_wakeup = true;
-			break;
+	SLIST_FOREACH(wqe, wq, link) {
+		if (wqe->cv)
+			continue;
+		if (wqe->done)
+			continue;
+		if (!wake_type_assigned) {
+			wake_read = wqe->wait_read;
+			wake_type_assigned = true;
 		}
 
-		cpu_spin_unlock_xrestore(&wq_spin_lock, old_itr_status);
-
-		if (do_wakeup)
-			__wq_rpc(OPTEE_MSG_RPC_WAIT_QUEUE_WAKEUP, handle,
-				 sync_obj, MUTEX_OWNER_ID_MUTEX_UNLOCK,
-				 fname, lineno);
+		if (wqe->wait_read != wake_read)
+			continue;
 
-		if (!do_wakeup || !wake_read)
+		wqe->done = true;
+		handles[num_handles] = wqe->handle;
+		num_handles++;
+		if (!wake_read || num_handles == ARRAY_SIZE(handles))
 			break;
-		do_wakeup = false;
 	}
+
+	cpu_spin_unlock_xrestore(&wq_spin_lock, old_itr_status);
+
+	if (num_handles > 1 && wakeup_list_supported) {
+		__wq_rpc_wakeup_list(handles, num_handles, sync_obj, fname,
+				     lineno);
+		return;
+	}
+
+	for (n = 0; n < num_handles; n++)
+		__wq_rpc(OPTEE_MSG_RPC_WAIT_QUEUE_WAKEUP, handles[n],
+			 sync_obj, MUTEX_OWNER_ID_MUTEX_UNLOCK,
+			 fname, lineno);
 }
 
 void wq_promote_condvar(struct wait_queue *wq, struct condvar *cv,
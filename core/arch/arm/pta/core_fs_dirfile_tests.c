@@ -0,0 +1,209 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+ * Copyright (c) 2018, Linaro Limited
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tee/fs_dirfile.h>
+#include <trace.h>
+#include <types_ext.h>
+#include <util.h>
+
+#include "core_self_tests.h"
+
+/*
+ * The dirfile is kept in memory, so the numbers reflect the lookup
+ * algorithm rather than the RPC round trips to tee-supplicant. The number
+ * of reads is reported too as each read of dirf.db may result in an RPC
+ * with the REE FS.
+ */
+struct bench_file {
+	uint8_t *data;
+	size_t data_len;
+	size_t num_reads;
+};
+
+static struct bench_file bench_file;
+
+static TEE_Result bench_open(bool create, uint8_t *hash __unused,
+			     const TEE_UUID *uuid __unused,
+			     struct tee_fs_dirfile_fileh *dfh __unused,
+			     struct tee_file_handle **fh)
+{
+	if (create)
+		bench_file.data_len = 0;
+	*fh = (void *)&bench_file;
+	return TEE_SUCCESS;
+}
+
+static void bench_close(struct tee_file_handle *fh __unused)
+{
+}
+
+static TEE_Result bench_read(struct tee_file_handle *fh, size_t pos,
+			     void *buf, size_t *len)
+{
+	struct bench_file *f = (struct bench_file *)fh;
+
+	f->num_reads++;
+	if (pos >= f->data_len) {
+		*len = 0;
+		return TEE_SUCCESS;
+	}
+
+	*len = MIN(*len, f->data_len - pos);
+	memcpy(buf, f->data + pos, *len);
+	return TEE_SUCCESS;
+}
+
+static TEE_Result bench_write(struct tee_file_handle *fh, size_t pos,
+			      const void *buf, size_t len)
+{
+	struct bench_file *f = (struct bench_file *)fh;
+	void *p;
+
+	if (pos + len > f->data_len) {
+		p = realloc(f->data, pos + len);
+		if (!p)
+			return TEE_ERROR_OUT_OF_MEMORY;
+		f->data = p;
+		memset(f->data + f->data_len, 0, pos + len - f->data_len);
+		f->data_len = pos + len;
+	}
+
+	memcpy(f->data + pos, buf, len);
+	return TEE_SUCCESS;
+}
+
+static TEE_Result bench_commit_writes(struct tee_file_handle *fh __unused,
+				      uint8_t *hash __unused)
+{
+	return TEE_SUCCESS;
+}
+
+static const struct tee_fs_dirfile_operations bench_dirf_ops = {
+	.open = bench_open,
+	.close = bench_close,
+	.read = bench_read,
+	.write = bench_write,
+	.commit_writes = bench_commit_writes,
+};
+
+static size_t bench_oid(size_t n, char *oid)
+{
+	return snprintf(oid, TEE_OBJECT_ID_MAX_LEN, "bench-object-%zu", n);
+}
+
+static TEE_Result populate(struct tee_fs_dirfile_dirh *dirh,
+			   const TEE_UUID *uuid, size_t num_objs)
+{
+	struct tee_fs_dirfile_fileh dfh;
+	char oid[TEE_OBJECT_ID_MAX_LEN];
+	TEE_Result res;
+	size_t n;
+
+	for (n = 0; n < num_objs; n++) {
+		res = tee_fs_dirfile_get_tmp(dirh, &dfh);
+		if (res)
+			return res;
+		dfh.idx = -1;
+		res = tee_fs_dirfile_rename(dirh, uuid, &dfh, oid,
+					    bench_oid(n, oid));
+		if (res)
+			return res;
+	}
+
+	return tee_fs_dirfile_commit_writes(dirh, NULL);
+}
+
+/*
+ * Measures the time to open the dirfile and to look up each of
+ * @num_objs objects in it, the lookup being what's done when a persistent
+ * object is opened. The open is timed together with the lookups since it
+ * reads every entry to build the index.
+ */
+static TEE_Result bench_dirfile(size_t num_objs, uint64_t *total_ns,
+				size_t *reads)
+{
+	const TEE_UUID uuid = { .timeLow = 0x12345678 };
+	struct tee_fs_dirfile_dirh *dirh = NULL;
+	struct tee_fs_dirfile_fileh dfh;
+	char oid[TEE_OBJECT_ID_MAX_LEN];
+	TEE_Result res;
+	uint64_t t;
+	size_t n;
+
+	res = tee_fs_dirfile_open(true, NULL, &bench_dirf_ops, &dirh);
+	if (res)
+		goto out;
+	res = populate(dirh, &uuid, num_objs);
+	tee_fs_dirfile_close(dirh);
+	dirh = NULL;
+	if (res)
+		goto out;
+
+	bench_file.num_reads = 0;
+	t = bench_start();
+	res = tee_fs_dirfile_open(false, NULL, &bench_dirf_ops, &dirh);
+	if (res)
+		goto out;
+	for (n = 0; n < num_objs; n++) {
+		res = tee_fs_dirfile_find(dirh, &uuid, oid, bench_oid(n, oid),
+					  &dfh);
+		if (res)
+			goto out;
+	}
+	*total_ns = bench_ns(t, 1);
+	*reads = bench_file.num_reads;
+out:
+	tee_fs_dirfile_close(dirh);
+	free(bench_file.data);
+	memset(&bench_file, 0, sizeof(bench_file));
+	return res;
+}
+
+/* See PTA_INVOKE_TESTS_CMD_FS_DIRFILE_BENCH for parameters */
+TEE_Result core_fs_dirfile_bench(uint32_t nParamTypes,
+				 TEE_Param pParams[TEE_NUM_PARAMS])
+{
+	static const size_t counts[] = { 16, 64, 256, 1024, 4096 };
+	uint32_t exp_pt = TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+					  TEE_PARAM_TYPE_VALUE_OUTPUT,
+					  TEE_PARAM_TYPE_VALUE_OUTPUT,
+					  TEE_PARAM_TYPE_NONE);
+	uint64_t total_ns = 0;
+	size_t reads = 0;
+	TEE_Result res;
+	size_t num;
+	size_t n;
+
+	if (nParamTypes != exp_pt)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	num = pParams[0].value.a;
+	if (!num) {
+		for (n = 0; n < ARRAY_SIZE(counts); n++) {
+			res = bench_dirfile(counts[n], &total_ns, &reads);
+			if (res)
+				return res;
+			IMSG("dirfile %zu objects: open and find all %" PRIu64
+			     " us, %" PRIu64 " ns/find, %zu.%02zu reads/find",
+			     counts[n], total_ns / 1000, total_ns / counts[n],
+			     reads / counts[n], reads * 100 / counts[n] % 100);
+		}
+		return TEE_SUCCESS;
+	}
+
+	res = bench_dirfile(num, &total_ns, &reads);
+	if (res)
+		return res;
+
+	pParams[1].value.a = total_ns / 1000;
+	pParams[1].value.b = total_ns / num;
+	pParams[2].value.a = reads / num;
+	pParams[2].value.b = 0;
+
+	return TEE_SUCCESS;
+}
@@ -24,6 +24,9 @@ struct test_aux {
 	size_t data_len;
 	size_t data_alloced;
 	uint8_t *block;
+	size_t vec_num;
+	size_t vec_offs[TEE_FS_HTREE_RPC_MAX_ELEMS];
+	size_t vec_size[TEE_FS_HTREE_RPC_MAX_ELEMS];
 };
 
 static TEE_Result test_get_offs_size(enum tee_fs_htree_type type, size_t idx,
@@ -158,12 +161,96 @@ static TEE_Result test_write_final(struct tee_fs_rpc_operation *op)
 
 }
 
+static TEE_Result test_readv_init(void *aux, struct tee_fs_rpc_operation *op,
+				  enum tee_fs_htree_type type,
+				  const struct tee_fs_htree_rpc_elem *elem,
+				  size_t num_elem, void **data)
+{
+	TEE_Result res;
+	struct test_aux *a = aux;
+	size_t n;
+
+	if (num_elem > ARRAY_SIZE(a->vec_offs))
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	for (n = 0; n < num_elem; n++) {
+		res = test_get_offs_size(type, elem[n].idx, elem[n].vers,
+					 a->vec_offs + n, a->vec_size + n);
+		if (res != TEE_SUCCESS)
+			return res;
+	}
+
+	memset(op, 0, sizeof(*op));
+	op->params[0].u.value.a = (vaddr_t)aux;
+	a->vec_num = num_elem;
+	*data = a->block;
+
+	return TEE_SUCCESS;
+}
+
+static TEE_Result test_readv_final(struct tee_fs_rpc_operation *op,
+				   size_t *bytes)
+{
+	struct test_aux *a = uint_to_ptr(op->params[0].u.value.a);
+	size_t offs;
+	size_t sz;
+	size_t n;
+
+	*bytes = 0;
+	for (n = 0; n < a->vec_num; n++) {
+		offs = a->vec_offs[n];
+		sz = a->vec_size[n];
+		if (offs + sz > a->data_len)
+			sz = 0;
+
+		memcpy(a->block + *bytes, a->data + offs, sz);
+		*bytes += sz;
+	}
+
+	return TEE_SUCCESS;
+}
+
+static TEE_Result test_writev_init(void *aux, struct tee_fs_rpc_operation *op,
+				   enum tee_fs_htree_type type,
+				   const struct tee_fs_htree_rpc_elem *elem,
+				   size_t num_elem, void **data)
+{
+	return test_readv_init(aux, op, type, elem, num_elem, data);
+}
+
+static TEE_Result test_writev_final(struct tee_fs_rpc_operation *op)
+{
+	struct test_aux *a = uint_to_ptr(op->params[0].u.value.a);
+	uint8_t *p = a->block;
+	size_t end;
+	size_t n;
+
+	for (n = 0; n < a->vec_num; n++) {
+		end = a->vec_offs[n] + a->vec_size[n];
+		if (end > a->data_alloced) {
+			EMSG("out of bounds");
+			return TEE_ERROR_GENERIC;
+		}
+
+		memcpy(a->data + a->vec_offs[n], p, a->vec_size[n]);
+		p += a->vec_size[n];
+		if (end > a->data_len)
+			a->data_len = end;
+	}
+
+	return TEE_SUCCESS;
+}
+
 static const struct tee_fs_htree_storage test_htree_ops = {
 	.block_size = TEST_BLOCK_SIZE,
 	.rpc_read_init = test_read_init,
 	.rpc_read_final = test_read_final,
 	.rpc_write_init = test_write_init,
 	.rpc_write_final = test_write_final,
+	.rpc_readv_init = test_readv_init,
+	.rpc_readv_final = test_readv_final,
+	.rpc_writev_init = test_writev_init,
+	.rpc_writev_final = test_writev_final,
 };
 
 #define CHECK_RES(res, cleanup)						\
@@ -216,6 +303,61 @@ static TEE_Result read_block(struct tee_fs_htree **ht, size_t bn, uint8_t salt)
 	return TEE_SUCCESS;
 }
 
+/*
+ * Writes and reads back the range of blocks with the vectored
+ * tee_fs_htree_write_blocks() and tee_fs_htree_read_blocks()
+ */
+static TEE_Result do_range_vec(struct tee_fs_htree **ht, size_t begin,
+			       size_t num_blocks, uint8_t salt)
+{
+	TEE_Result res = TEE_SUCCESS;
+	uint32_t *b = NULL;
+	void **blocks = NULL;
+	const size_t bwords = TEST_BLOCK_SIZE / sizeof(uint32_t);
+	size_t n;
+	size_t m;
+
+	if (!num_blocks)
+		return TEE_SUCCESS;
+
+	b = malloc(num_blocks * TEST_BLOCK_SIZE);
+	blocks = malloc(num_blocks * sizeof(void *));
+	if (!b || !blocks) {
+		res = TEE_ERROR_OUT_OF_MEMORY;
+		goto out;
+	}
+
+	for (n = 0; n < num_blocks; n++) {
+		blocks[n] = b + n * bwords;
+		for (m = 0; m < bwords; m++)
+			b[n * bwords + m] = val_from_bn_n_salt(begin + n, m,
+							       salt);
+	}
+
+	res = tee_fs_htree_write_blocks(ht, begin, num_blocks,
+					(const void * const *)blocks);
+	CHECK_RES(res, goto out);
+
+	memset(b, 0, num_blocks * TEST_BLOCK_SIZE);
+	res = tee_fs_htree_read_blocks(ht, begin, num_blocks, blocks);
+	CHECK_RES(res, goto out);
+
+	for (n = 0; n < num_blocks; n++) {
+		for (m = 0; m < bwords; m++) {
+			if (b[n * bwords + m] !=
+			    val_from_bn_n_salt(begin + n, m, salt)) {
+				res = TEE_ERROR_TIME_NOT_SET;
+				goto out;
+			}
+		}
+	}
+
+out:
+	free(blocks);
+	free(b);
+	return res;
+}
+
 static TEE_Result do_range(TEE_Result (*fn)(struct tee_fs_htree **ht,
 					    size_t bn, uint8_t salt),
 			   struct tee_fs_htree **ht, size_t begin,
@@ -283,6 +425,17 @@ static TEE_Result htree_test_rewrite(struct test_aux *aux, size_t num_blocks,
 	res = do_range(read_block, &ht, 0, num_blocks, salt);
 	CHECK_RES(res, goto out);
 
+	/*
+	 * Write all blocks with a new salt using vectored operations and
+	 * verify that they read back as expected one by one too.
+	 */
+	salt++;
+	res = do_range_vec(&ht, 0, num_blocks, salt);
+	CHECK_RES(res, goto out);
+
+	res = do_range(read_block, &ht, 0, num_blocks, salt);
+	CHECK_RES(res, goto out);
+
 	/*
 	 * Write all blocks again, but starting from the end using a new
 	 * salt, then verify that that read back as expected.
@@ -423,7 +576,7 @@ static struct test_aux *aux_alloc(size_t num_blocks)
 	if (!aux->data)
 		goto err;
 
-	aux->block = malloc(TEST_BLOCK_SIZE);
+	aux->block = malloc(TEST_BLOCK_SIZE * TEE_FS_HTREE_RPC_MAX_ELEMS);
 	if (!aux->block)
 		goto err;
 
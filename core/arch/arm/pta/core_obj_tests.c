@@ -0,0 +1,267 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+ * Copyright (c) 2018, Linaro Limited
+ */
+
+#include <kernel/thread.h>
+#include <kernel/user_ta.h>
+#include <pta_invoke_tests.h>
+#include <stdlib.h>
+#include <tee/tee_obj.h>
+#include <tee/tee_pobj.h>
+#include <tee/tee_svc_cryp.h>
+#include <trace.h>
+#include <types_ext.h>
+#include <util.h>
+
+#include "core_self_tests.h"
+
+#define BENCH_DEFAULT_ROUNDS	64
+#define STRESS_DEFAULT_OBJS	16
+#define STRESS_DEFAULT_ROUNDS	1024
+
+/*
+ * Adds @num_objs transient objects to a context of its own, that is, the
+ * objects a TA would have allocated, and looks each of them up @rounds
+ * times the way the object syscalls do.
+ */
+static TEE_Result bench_obj_get(size_t num_objs, size_t rounds,
+				uint64_t *ns)
+{
+	struct user_ta_ctx *utc;
+	struct tee_obj *o;
+	TEE_Result res = TEE_SUCCESS;
+	uint32_t *ids;
+	uint64_t t;
+	size_t n;
+	size_t r;
+
+	utc = calloc(1, sizeof(*utc));
+	ids = calloc(num_objs, sizeof(*ids));
+	if (!utc || !ids) {
+		res = TEE_ERROR_OUT_OF_MEMORY;
+		goto out;
+	}
+	TAILQ_INIT(&utc->objects);
+
+	for (n = 0; n < num_objs; n++) {
+		o = tee_obj_alloc();
+		if (!o) {
+			res = TEE_ERROR_OUT_OF_MEMORY;
+			goto out;
+		}
+		res = tee_obj_add(utc, o);
+		if (res) {
+			tee_obj_free(o);
+			goto out;
+		}
+		ids[n] = o->id;
+	}
+
+	t = bench_start();
+	for (r = 0; r < rounds; r++) {
+		for (n = 0; n < num_objs; n++) {
+			res = tee_obj_get(utc, ids[n], &o);
+			if (res)
+				goto out;
+		}
+	}
+	*ns = bench_ns(t, (uint64_t)num_objs * rounds);
+
+	/* A closed object must not be found */
+	if (num_objs) {
+		tee_obj_get(utc, ids[0], &o);
+		tee_obj_close(utc, o);
+		if (tee_obj_get(utc, ids[0], &o) != TEE_ERROR_BAD_PARAMETERS)
+			res = TEE_ERROR_GENERIC;
+	}
+out:
+	if (utc) {
+		tee_obj_close_all(utc);
+		handle_db_destroy(&utc->object_handles);
+	}
+	free(utc);
+	free(ids);
+	return res;
+}
+
+/*
+ * Adds @num_states crypto states to a context of its own and looks each
+ * of them up @rounds times the way the crypto syscalls do. A lookup never
+ * dereferences the state, so the states are only stand-ins.
+ */
+static TEE_Result bench_cryp_state_get(size_t num_states, size_t rounds,
+				       uint64_t *ns)
+{
+	struct user_ta_ctx *utc;
+	struct tee_cryp_state *cs;
+	TEE_Result res = TEE_SUCCESS;
+	uint32_t *ids;
+	uint64_t t;
+	size_t n;
+	size_t r;
+	int h;
+
+	utc = calloc(1, sizeof(*utc));
+	ids = calloc(num_states, sizeof(*ids));
+	if (!utc || !ids) {
+		res = TEE_ERROR_OUT_OF_MEMORY;
+		goto out;
+	}
+
+	for (n = 0; n < num_states; n++) {
+		h = handle_get(&utc->cryp_state_handles, ids + n);
+		if (h < 0) {
+			res = TEE_ERROR_OUT_OF_MEMORY;
+			goto out;
+		}
+		ids[n] = h + 1;
+	}
+
+	t = bench_start();
+	for (r = 0; r < rounds; r++) {
+		for (n = 0; n < num_states; n++) {
+			res = tee_cryp_state_get(utc, ids[n], &cs);
+			if (res)
+				goto out;
+		}
+	}
+	*ns = bench_ns(t, (uint64_t)num_states * rounds);
+out:
+	if (utc)
+		handle_db_destroy(&utc->cryp_state_handles);
+	free(utc);
+	free(ids);
+	return res;
+}
+
+static TEE_Result bench_lookups(size_t num, size_t rounds, uint64_t *obj_ns,
+				uint64_t *state_ns)
+{
+	TEE_Result res = bench_obj_get(num, rounds, obj_ns);
+
+	if (res)
+		return res;
+	return bench_cryp_state_get(num, rounds, state_ns);
+}
+
+/* See PTA_INVOKE_TESTS_CMD_OBJ_LOOKUP_BENCH for parameters */
+TEE_Result core_obj_lookup_bench(uint32_t nParamTypes,
+				 TEE_Param pParams[TEE_NUM_PARAMS])
+{
+	static const size_t counts[] = { 1, 100, 1000 };
+	uint32_t exp_pt = TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+					  TEE_PARAM_TYPE_VALUE_OUTPUT,
+					  TEE_PARAM_TYPE_VALUE_OUTPUT,
+					  TEE_PARAM_TYPE_NONE);
+	uint64_t state_ns = 0;
+	uint64_t obj_ns = 0;
+	TEE_Result res;
+	size_t rounds;
+	size_t num;
+	size_t n;
+
+	if (nParamTypes != exp_pt)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	rounds = bench_param(pParams[0].value.b, BENCH_DEFAULT_ROUNDS);
+
+	num = pParams[0].value.a;
+	if (!num) {
+		for (n = 0; n < ARRAY_SIZE(counts); n++) {
+			/*
+			 * 1000 objects don't fit in the core heap of the
+			 * default configuration, use as many as do.
+			 */
+			num = counts[n];
+			res = bench_lookups(num, rounds, &obj_ns, &state_ns);
+			while (res == TEE_ERROR_OUT_OF_MEMORY && num > 1) {
+				num /= 2;
+				res = bench_lookups(num, rounds, &obj_ns,
+						    &state_ns);
+			}
+			if (res)
+				return res;
+			if (num != counts[n])
+				IMSG("Handle lookup: %zu handles don't fit in the core heap, using %zu",
+				     counts[n], num);
+			IMSG("Handle lookup: %zu live handles: object %" PRIu64
+			     " ns, crypto state %" PRIu64 " ns per lookup",
+			     num, obj_ns, state_ns);
+		}
+		return TEE_SUCCESS;
+	}
+
+	res = bench_lookups(num, rounds, &obj_ns, &state_ns);
+	if (res)
+		return res;
+
+	pParams[1].value.a = obj_ns;
+	pParams[1].value.b = num;
+	pParams[2].value.a = state_ns;
+	pParams[2].value.b = num;
+
+	return TEE_SUCCESS;
+}
+
+/*
+ * Gets and releases @num_objs persistent objects @rounds times. The
+ * objects are never opened in any file system, only the bookkeeping of
+ * open objects is exercised.
+ */
+static TEE_Result get_release_pobjs(TEE_UUID *uuid, size_t num_objs,
+				    size_t rounds)
+{
+	const uint32_t flags = TEE_DATA_FLAG_ACCESS_READ |
+			       TEE_DATA_FLAG_SHARE_READ;
+	struct tee_pobj *po;
+	TEE_Result res;
+	uint32_t id;
+	size_t n;
+	size_t r;
+
+	for (r = 0; r < rounds; r++) {
+		for (n = 0; n < num_objs; n++) {
+			id = n;
+			res = tee_pobj_get(uuid, &id, sizeof(id), flags,
+					   false, NULL, &po);
+			if (res)
+				return res;
+			tee_pobj_release(po);
+		}
+	}
+
+	return TEE_SUCCESS;
+}
+
+/* See PTA_INVOKE_TESTS_CMD_POBJ_STRESS for parameters */
+TEE_Result core_pobj_stress(uint32_t nParamTypes,
+			    TEE_Param pParams[TEE_NUM_PARAMS])
+{
+	TEE_UUID uuid = PTA_INVOKE_TESTS_UUID;
+	size_t num_objs;
+	size_t rounds;
+	TEE_Result res;
+	uint64_t t;
+
+	if (nParamTypes != BENCH_PARAM_TYPES)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	num_objs = bench_param(pParams[0].value.a, STRESS_DEFAULT_OBJS);
+	rounds = bench_param(pParams[0].value.b, STRESS_DEFAULT_ROUNDS);
+
+	/* Each concurrent invocation acts as a TA of its own */
+	uuid.timeLow ^= thread_get_id();
+
+	t = bench_start();
+	res = get_release_pobjs(&uuid, num_objs, rounds);
+	if (res)
+		return res;
+
+	pParams[1].value.a = bench_rate(t, (uint64_t)num_objs * rounds);
+	pParams[1].value.b = num_objs;
+	IMSG("Persistent object stress: %zu objects: %" PRIu32
+	     " get/release per second", num_objs, pParams[1].value.a);
+
+	return TEE_SUCCESS;
+}
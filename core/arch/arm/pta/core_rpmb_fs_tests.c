@@ -0,0 +1,91 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+ * Copyright (c) 2018, Linaro Limited
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <tee/tee_fs.h>
+#include <trace.h>
+#include <types_ext.h>
+#include <util.h>
+
+#include "core_self_tests.h"
+
+#define BENCH_FNAME		"rpmb_bench"
+#define BENCH_DEFAULT_CHUNK	4096
+#define BENCH_DEFAULT_TOTAL	(64 * 1024)
+
+/*
+ * Writes @total bytes in chunks of @chunk bytes to the same place of a
+ * file of @chunk bytes, that is, the writes are done in place when the
+ * device supports a reliable write of @chunk bytes.
+ */
+static TEE_Result bench_write(size_t chunk, size_t total, uint64_t *bps)
+{
+	struct tee_file_handle *fh = NULL;
+	TEE_Result rm_res;
+	TEE_Result res;
+	uint8_t *buf;
+	uint64_t t;
+	size_t n;
+
+	buf = calloc(1, chunk);
+	if (!buf)
+		return TEE_ERROR_OUT_OF_MEMORY;
+
+	res = tee_rpmb_fs_raw_open(BENCH_FNAME, true, &fh);
+	if (res)
+		goto out;
+
+	res = rpmb_fs_ops.truncate(fh, chunk);
+	if (res)
+		goto out;
+
+	t = bench_start();
+	for (n = 0; n < total; n += chunk) {
+		res = rpmb_fs_ops.write(fh, 0, buf, chunk);
+		if (res)
+			goto out;
+	}
+	*bps = bench_rate(t, total);
+out:
+	if (fh) {
+		rpmb_fs_ops.close(&fh);
+		/* Give back the space and the FAT entry of the file */
+		rm_res = tee_rpmb_fs_raw_remove(BENCH_FNAME);
+		if (!res)
+			res = rm_res;
+	}
+	free(buf);
+	return res;
+}
+
+/* See PTA_INVOKE_TESTS_CMD_RPMB_WRITE_BENCH for parameters */
+TEE_Result core_rpmb_fs_write_bench(uint32_t nParamTypes,
+				    TEE_Param pParams[TEE_NUM_PARAMS])
+{
+	uint64_t bps = 0;
+	TEE_Result res;
+	size_t chunk;
+	size_t total;
+
+	if (nParamTypes != BENCH_PARAM_TYPES)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	chunk = bench_param(pParams[0].value.a, BENCH_DEFAULT_CHUNK);
+	total = bench_param(pParams[0].value.b, BENCH_DEFAULT_TOTAL);
+	total = ROUNDUP(total, chunk);
+
+	res = bench_write(chunk, total, &bps);
+	if (res)
+		return res;
+
+	IMSG("RPMB write: %zu bytes in chunks of %zu bytes: %" PRIu64
+	     " bytes/s", total, chunk, bps);
+
+	pParams[1].value.a = bps;
+	pParams[1].value.b = total;
+
+	return TEE_SUCCESS;
+}
@@ -2,6 +2,7 @@
 /*
  * Copyright (c) 2014, STMicroelectronics International N.V.
  */
+#include <arm.h>
 #include <assert.h>
 #include <malloc.h>
 #include <stdbool.h>
@@ -434,3 +435,27 @@ TEE_Result core_self_tests(uint32_t nParamTypes __unused,
 	}
 	return TEE_SUCCESS;
 }
+
+size_t bench_param(uint32_t val, size_t def)
+{
+	return val ? val : def;
+}
+
+uint64_t bench_start(void)
+{
+	return read_cntpct();
+}
+
+uint64_t bench_ns(uint64_t start, uint64_t count)
+{
+	uint64_t ticks = read_cntpct() - start;
+
+	return ticks * 1000000000ULL / read_cntfrq() / MAX(count, (uint64_t)1);
+}
+
+uint64_t bench_rate(uint64_t start, uint64_t count)
+{
+	uint64_t ticks = read_cntpct() - start;
+
+	return count * read_cntfrq() / MAX(ticks, (uint64_t)1);
+}
@@ -5,9 +5,28 @@
 #ifndef CORE_SELF_TESTS_H
 #define CORE_SELF_TESTS_H
 
+#include <stddef.h>
+#include <stdint.h>
 #include <tee_api_types.h>
 #include <tee_api_defines.h>
 
+/*
+ * Helpers for the benchmarks below. The common parameters are a value
+ * input where 0 selects a default, see bench_param(), and a value output.
+ * bench_ns() returns the nanoseconds elapsed since @start, a time stamp
+ * from bench_start(), per each of @count operations and bench_rate() the
+ * number of operations per second.
+ */
+#define BENCH_PARAM_TYPES	TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT, \
+						TEE_PARAM_TYPE_VALUE_OUTPUT, \
+						TEE_PARAM_TYPE_NONE, \
+						TEE_PARAM_TYPE_NONE)
+
+size_t bench_param(uint32_t val, size_t def);
+uint64_t bench_start(void);
+uint64_t bench_ns(uint64_t start, uint64_t count);
+uint64_t bench_rate(uint64_t start, uint64_t count);
+
 /* basic run-time tests */
 TEE_Result core_self_tests(uint32_t nParamTypes,
 			   TEE_Param pParams[TEE_NUM_PARAMS]);
@@ -15,7 +34,25 @@ TEE_Result core_self_tests(uint32_t nParamTypes,
 TEE_Result core_fs_htree_tests(uint32_t nParamTypes,
 			       TEE_Param pParams[TEE_NUM_PARAMS]);
 
+TEE_Result core_fs_dirfile_bench(uint32_t nParamTypes,
+				 TEE_Param pParams[TEE_NUM_PARAMS]);
+
+TEE_Result core_rpmb_fs_write_bench(uint32_t nParamTypes,
+				    TEE_Param pParams[TEE_NUM_PARAMS]);
+
 TEE_Result core_mutex_tests(uint32_t nParamTypes,
 			    TEE_Param pParams[TEE_NUM_PARAMS]);
 
+TEE_Result core_ta_session_lookup_bench(uint32_t nParamTypes,
+					TEE_Param pParams[TEE_NUM_PARAMS]);
+
+TEE_Result core_ta_open_stress(uint32_t nParamTypes,
+			       TEE_Param pParams[TEE_NUM_PARAMS]);
+
+TEE_Result core_obj_lookup_bench(uint32_t nParamTypes,
+				 TEE_Param pParams[TEE_NUM_PARAMS]);
+
+TEE_Result core_pobj_stress(uint32_t nParamTypes,
+			    TEE_Param pParams[TEE_NUM_PARAMS]);
+
 #endif /*CORE_SELF_TESTS_H*/
@@ -0,0 +1,194 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+ * Copyright (c) 2018, Linaro Limited
+ */
+
+#include <kernel/tee_ta_manager.h>
+#include <pta_invoke_tests.h>
+#include <stdlib.h>
+#include <string.h>
+#include <trace.h>
+#include <types_ext.h>
+#include <util.h>
+
+#include "core_self_tests.h"
+
+#define BENCH_DEFAULT_SESSIONS	128
+#define BENCH_DEFAULT_ROUNDS	16
+#define STRESS_DEFAULT_ROUNDS	256
+
+/*
+ * The sessions are opened to this pseudo TA itself, on a private list of
+ * open sessions like the ones a user TA has for the sessions it opens.
+ */
+static TEE_Result open_sessions(struct tee_ta_session_head *head,
+				struct tee_ta_session **sess, size_t num_sess)
+{
+	const TEE_UUID uuid = PTA_INVOKE_TESTS_UUID;
+	TEE_Identity clnt_id = { .login = TEE_LOGIN_TRUSTED_APP };
+	struct tee_ta_param param = { 0 };
+	TEE_ErrorOrigin err;
+	TEE_Result res;
+	size_t n;
+
+	for (n = 0; n < num_sess; n++) {
+		res = tee_ta_open_session(&err, sess + n, head, &uuid,
+					  &clnt_id, TEE_TIMEOUT_INFINITE,
+					  &param);
+		if (res)
+			return res;
+	}
+
+	return TEE_SUCCESS;
+}
+
+static TEE_Result lookup_sessions(struct tee_ta_session_head *head,
+				  struct tee_ta_session **sess,
+				  size_t num_sess, size_t rounds, uint64_t *ns)
+{
+	struct tee_ta_session *s;
+	uint64_t t;
+	size_t n;
+	size_t r;
+
+	t = bench_start();
+	for (r = 0; r < rounds; r++) {
+		for (n = 0; n < num_sess; n++) {
+			s = tee_ta_get_session((vaddr_t)sess[n], false, head);
+			if (s != sess[n])
+				return TEE_ERROR_GENERIC;
+			tee_ta_put_session(s);
+		}
+	}
+	*ns = bench_ns(t, (uint64_t)num_sess * rounds);
+
+	/* A session on another list must not be found */
+	if (num_sess && tee_ta_get_session((vaddr_t)sess[0], false, NULL))
+		return TEE_ERROR_GENERIC;
+
+	return TEE_SUCCESS;
+}
+
+/* See PTA_INVOKE_TESTS_CMD_SESSION_LOOKUP_BENCH for parameters */
+TEE_Result core_ta_session_lookup_bench(uint32_t nParamTypes,
+					TEE_Param pParams[TEE_NUM_PARAMS])
+{
+	struct tee_ta_session_head head = TAILQ_HEAD_INITIALIZER(head);
+	struct tee_ta_session **sess;
+	uint64_t ns = 0;
+	size_t num_sess;
+	size_t rounds;
+	TEE_Result res;
+
+	if (nParamTypes != BENCH_PARAM_TYPES)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	num_sess = bench_param(pParams[0].value.a, BENCH_DEFAULT_SESSIONS);
+	rounds = bench_param(pParams[0].value.b, BENCH_DEFAULT_ROUNDS);
+
+	sess = calloc(num_sess, sizeof(*sess));
+	if (!sess)
+		return TEE_ERROR_OUT_OF_MEMORY;
+
+	res = open_sessions(&head, sess, num_sess);
+	if (!res)
+		res = lookup_sessions(&head, sess, num_sess, rounds, &ns);
+
+	while (!TAILQ_EMPTY(&head))
+		tee_ta_close_session(TAILQ_FIRST(&head), &head,
+				     KERN_IDENTITY);
+	free(sess);
+	if (res)
+		return res;
+
+	IMSG("Session lookup: %zu open sessions: %" PRIu64 " ns per lookup",
+	     num_sess, ns);
+
+	pParams[1].value.a = ns;
+	pParams[1].value.b = num_sess;
+
+	return TEE_SUCCESS;
+}
+
+/*
+ * Opens one session to each TA in @uuids, then closes them again, @rounds
+ * times. Failures are counted rather than aborting the run, with several
+ * instances running concurrently a TA which isn't multi session is
+ * expected to be busy at times.
+ */
+static void open_close_sessions(const TEE_UUID *uuids, size_t num_uuids,
+				size_t rounds, uint32_t *opened,
+				uint32_t *failed)
+{
+	TEE_Identity clnt_id = { .login = TEE_LOGIN_TRUSTED_APP };
+	struct tee_ta_session_head head = TAILQ_HEAD_INITIALIZER(head);
+	struct tee_ta_param param = { 0 };
+	struct tee_ta_session *s;
+	TEE_ErrorOrigin err;
+	size_t n;
+	size_t r;
+
+	for (r = 0; r < rounds; r++) {
+		for (n = 0; n < num_uuids; n++) {
+			memset(&param, 0, sizeof(param));
+			if (tee_ta_open_session(&err, &s, &head, uuids + n,
+						&clnt_id, TEE_TIMEOUT_INFINITE,
+						&param))
+				(*failed)++;
+			else
+				(*opened)++;
+		}
+
+		while (!TAILQ_EMPTY(&head))
+			tee_ta_close_session(TAILQ_FIRST(&head), &head,
+					     KERN_IDENTITY);
+	}
+}
+
+/* See PTA_INVOKE_TESTS_CMD_TA_OPEN_STRESS for parameters */
+TEE_Result core_ta_open_stress(uint32_t nParamTypes,
+			       TEE_Param pParams[TEE_NUM_PARAMS])
+{
+	uint32_t exp_pt = TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+					  TEE_PARAM_TYPE_MEMREF_INPUT,
+					  TEE_PARAM_TYPE_VALUE_OUTPUT,
+					  TEE_PARAM_TYPE_NONE);
+	uint32_t exp_pt_no_uuids = TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+						   TEE_PARAM_TYPE_NONE,
+						   TEE_PARAM_TYPE_VALUE_OUTPUT,
+						   TEE_PARAM_TYPE_NONE);
+	const TEE_UUID default_uuid = PTA_INVOKE_TESTS_UUID;
+	size_t num_uuids = 1;
+	size_t rounds;
+	TEE_UUID *uuids = NULL;
+	uint32_t opened = 0;
+	uint32_t failed = 0;
+	uint64_t t;
+
+	if (nParamTypes == exp_pt) {
+		num_uuids = pParams[1].memref.size / sizeof(TEE_UUID);
+		if (!num_uuids)
+			return TEE_ERROR_BAD_PARAMETERS;
+		/* Copy to secure memory, normal world could change them */
+		uuids = malloc(num_uuids * sizeof(TEE_UUID));
+		if (!uuids)
+			return TEE_ERROR_OUT_OF_MEMORY;
+		memcpy(uuids, pParams[1].memref.buffer,
+		       num_uuids * sizeof(TEE_UUID));
+	} else if (nParamTypes != exp_pt_no_uuids) {
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	rounds = bench_param(pParams[0].value.a, STRESS_DEFAULT_ROUNDS);
+
+	t = bench_start();
+	open_close_sessions(uuids ? uuids : &default_uuid, num_uuids, rounds,
+			    &opened, &failed);
+	pParams[2].value.a = bench_rate(t, opened);
+	pParams[2].value.b = failed;
+	free(uuids);
+	IMSG("TA open stress: %zu TAs: %" PRIu32 " sessions/s, %" PRIu32
+	     " failed", num_uuids, pParams[2].value.a, failed);
+
+	return TEE_SUCCESS;
+}
@@ -0,0 +1,233 @@
+// SPDX-License-Identifier: BSD-2-Clause
+/*
+ * Copyright (c) 2018, Linaro Limited
+ */
+
+#include <kernel/mutex.h>
+#include <kernel/pseudo_ta.h>
+#include <kernel/tee_ta_manager.h>
+#include <kernel/tee_time.h>
+#include <pta_fs_scrub.h>
+#include <string.h>
+#include <tee/tee_fs.h>
+#include <tee/uuid.h>
+#include <trace.h>
+#include <util.h>
+
+#define PTA_NAME "fs_scrub.pta"
+
+/*
+ * Data blocks verified each time the REE FS is locked, bounds how long
+ * the scrubber can hold up other users of the REE FS.
+ */
+#define SCRUB_CHUNK_BLOCKS	8
+
+struct scrub_stats {
+	uint64_t objects;
+	uint64_t corrupt;
+	uint64_t bytes;
+	uint64_t removed;
+	uint64_t passes;
+	uint64_t time_ms;
+};
+
+static struct mutex scrub_mutex = MUTEX_INITIALIZER;
+static struct scrub_stats scrub_stats;
+/* Position in the REE FS, kept between slices */
+static struct tee_ree_fs_scrub scrub_pos = TEE_REE_FS_SCRUB_INITIALIZER;
+/*
+ * Token bucket limiting the data rate to CFG_FS_SCRUB_RATE_KIB: bytes
+ * which may be verified now, negative when the last slice used more
+ * than was available.
+ */
+static int64_t scrub_tokens;
+static uint64_t scrub_last_ms;
+
+static uint64_t get_time_ms(void)
+{
+	TEE_Time t = { 0 };
+
+	if (tee_time_get_sys_time(&t))
+		return 0;
+
+	return (uint64_t)t.seconds * 1000 + t.millis;
+}
+
+static int64_t rate_bytes(uint64_t ms)
+{
+	return ms * CFG_FS_SCRUB_RATE_KIB * 1024 / 1000;
+}
+
+static void refill_tokens(uint64_t now, uint32_t slice_ms)
+{
+	int64_t max_tokens = rate_bytes(slice_ms);
+
+	if (now > scrub_last_ms)
+		scrub_tokens += rate_bytes(now - scrub_last_ms);
+	scrub_last_ms = now;
+	if (scrub_tokens > max_tokens)
+		scrub_tokens = max_tokens;
+}
+
+static uint32_t get_wait_ms(void)
+{
+	if (scrub_tokens > 0)
+		return 0;
+
+	return -scrub_tokens * 1000 / (CFG_FS_SCRUB_RATE_KIB * 1024) + 1;
+}
+
+static TEE_Result scrub_run(uint32_t type, TEE_Param p[TEE_NUM_PARAMS])
+{
+	TEE_Result res = TEE_SUCCESS;
+	struct pta_fs_scrub_corrupt *report = NULL;
+	size_t max_report = 0;
+	size_t num_report = 0;
+	uint32_t flags;
+	uint32_t slice_ms;
+	uint64_t start;
+	uint64_t now;
+	bool done = false;
+
+	if (type != TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+				    TEE_PARAM_TYPE_VALUE_OUTPUT,
+				    TEE_PARAM_TYPE_MEMREF_OUTPUT,
+				    TEE_PARAM_TYPE_NONE) &&
+	    type != TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_INPUT,
+				    TEE_PARAM_TYPE_VALUE_OUTPUT,
+				    TEE_PARAM_TYPE_NONE,
+				    TEE_PARAM_TYPE_NONE))
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	flags = p[0].value.a;
+	slice_ms = p[0].value.b;
+	if (!slice_ms)
+		slice_ms = CFG_FS_SCRUB_SLICE_MS;
+
+	if (TEE_PARAM_TYPE_GET(type, 2) == TEE_PARAM_TYPE_MEMREF_OUTPUT) {
+		report = p[2].memref.buffer;
+		max_report = p[2].memref.size / sizeof(*report);
+	}
+
+	mutex_lock(&scrub_mutex);
+
+	if (flags & PTA_FS_SCRUB_FLAG_RESTART)
+		scrub_pos = (struct tee_ree_fs_scrub)TEE_REE_FS_SCRUB_INITIALIZER;
+
+	start = get_time_ms();
+	refill_tokens(start, slice_ms);
+	now = start;
+
+	while (scrub_tokens > 0 && now - start < slice_ms) {
+		struct tee_ree_fs_scrub *s = &scrub_pos;
+		size_t bytes = 0;
+
+		if (max_report && num_report == max_report)
+			break;
+
+		res = tee_ree_fs_verify_next(s, SCRUB_CHUNK_BLOCKS,
+					     flags & PTA_FS_SCRUB_FLAG_REMOVE,
+					     &bytes);
+		scrub_tokens -= bytes;
+		scrub_stats.bytes += bytes;
+		now = get_time_ms();
+
+		if (res == TEE_ERROR_ITEM_NOT_FOUND) {
+			*s = (struct tee_ree_fs_scrub)
+				TEE_REE_FS_SCRUB_INITIALIZER;
+			scrub_stats.passes++;
+			done = true;
+			res = TEE_SUCCESS;
+			break;
+		}
+		if (res != TEE_SUCCESS && res != TEE_ERROR_CORRUPT_OBJECT) {
+			/* Retry from the same position in the next slice */
+			break;
+		}
+
+		/* More blocks of this object to verify */
+		if (res == TEE_SUCCESS && s->block)
+			continue;
+
+		scrub_stats.objects++;
+		if (res == TEE_SUCCESS)
+			continue;
+
+		scrub_stats.corrupt++;
+		if (s->removed)
+			scrub_stats.removed++;
+		IMSG("Object of TA %pUl failed verification%s",
+		     (void *)&s->uuid, s->removed ? ", removed" : "");
+
+		if (report) {
+			tee_uuid_to_octets(report[num_report].uuid, &s->uuid);
+			report[num_report].oid_len = s->oidlen;
+			memcpy(report[num_report].oid, s->oid, s->oidlen);
+			report[num_report].removed = s->removed;
+			num_report++;
+		}
+		res = TEE_SUCCESS;
+	}
+
+	scrub_stats.time_ms += now - start;
+	p[1].value.a = done;
+	p[1].value.b = get_wait_ms();
+
+	mutex_unlock(&scrub_mutex);
+
+	if (report)
+		p[2].memref.size = num_report * sizeof(*report);
+
+	return res;
+}
+
+static TEE_Result scrub_get_stats(uint32_t type, TEE_Param p[TEE_NUM_PARAMS])
+{
+	if (type != TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_OUTPUT,
+				    TEE_PARAM_TYPE_VALUE_OUTPUT,
+				    TEE_PARAM_TYPE_VALUE_OUTPUT,
+				    TEE_PARAM_TYPE_NONE))
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	mutex_lock(&scrub_mutex);
+	p[0].value.a = scrub_stats.objects;
+	p[0].value.b = scrub_stats.corrupt;
+	p[1].value.a = scrub_stats.bytes / 1024;
+	p[1].value.b = scrub_stats.removed;
+	p[2].value.a = scrub_stats.passes;
+	p[2].value.b = scrub_stats.time_ms;
+	mutex_unlock(&scrub_mutex);
+
+	return TEE_SUCCESS;
+}
+
+static TEE_Result open_session(uint32_t param_types __unused,
+			       TEE_Param params[TEE_NUM_PARAMS] __unused,
+			       void **sess_ctx __unused)
+{
+	/* The objects of all TAs are accessed, only for the normal world */
+	if (tee_ta_get_calling_session())
+		return TEE_ERROR_ACCESS_DENIED;
+
+	return TEE_SUCCESS;
+}
+
+static TEE_Result invoke_command(void *sess_ctx __unused, uint32_t cmd_id,
+				 uint32_t param_types,
+				 TEE_Param params[TEE_NUM_PARAMS])
+{
+	switch (cmd_id) {
+	case PTA_FS_SCRUB_CMD_RUN:
+		return scrub_run(param_types, params);
+	case PTA_FS_SCRUB_CMD_GET_STATS:
+		return scrub_get_stats(param_types, params);
+	default:
+		break;
+	}
+	return TEE_ERROR_NOT_IMPLEMENTED;
+}
+
+pseudo_ta_register(.uuid = PTA_FS_SCRUB_UUID, .name = PTA_NAME,
+		   .flags = PTA_DEFAULT_FLAGS,
+		   .open_session_entry_point = open_session,
+		   .invoke_command_entry_point = invoke_command);
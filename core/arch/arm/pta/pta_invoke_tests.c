@@ -405,9 +405,25 @@ static TEE_Result invoke_command(void *pSessionContext __unused,
 #if defined(CFG_WITH_USER_TA)
 	case PTA_INVOKE_TESTS_CMD_FS_HTREE:
 		return core_fs_htree_tests(nParamTypes, pParams);
+	case PTA_INVOKE_TESTS_CMD_OBJ_LOOKUP_BENCH:
+		return core_obj_lookup_bench(nParamTypes, pParams);
+	case PTA_INVOKE_TESTS_CMD_POBJ_STRESS:
+		return core_pobj_stress(nParamTypes, pParams);
+#endif
+#if defined(CFG_WITH_USER_TA) && defined(CFG_REE_FS)
+	case PTA_INVOKE_TESTS_CMD_FS_DIRFILE_BENCH:
+		return core_fs_dirfile_bench(nParamTypes, pParams);
+#endif
+#if defined(CFG_WITH_USER_TA) && defined(CFG_RPMB_FS)
+	case PTA_INVOKE_TESTS_CMD_RPMB_WRITE_BENCH:
+		return core_rpmb_fs_write_bench(nParamTypes, pParams);
 #endif
 	case PTA_INVOKE_TESTS_CMD_MUTEX:
 		return core_mutex_tests(nParamTypes, pParams);
+	case PTA_INVOKE_TESTS_CMD_SESSION_LOOKUP_BENCH:
+		return core_ta_session_lookup_bench(nParamTypes, pParams);
+	case PTA_INVOKE_TESTS_CMD_TA_OPEN_STRESS:
+		return core_ta_open_stress(nParamTypes, pParams);
 	default:
 		break;
 	}
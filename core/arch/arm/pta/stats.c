@@ -5,12 +5,17 @@
 #include <compiler.h>
 #include <stdio.h>
 #include <trace.h>
+#include <kernel/mutex.h>
 #include <kernel/pseudo_ta.h>
+#include <kernel/tee_ta_manager.h>
+#include <kernel/thread.h>
 #include <mm/tee_pager.h>
 #include <mm/tee_mm.h>
 #include <string.h>
 #include <string_ext.h>
 #include <malloc.h>
+#include <tee/tee_fs.h>
+#include <tee/tee_fs_rpc.h>
 
 #define TA_NAME		"stats.ta"
 
@@ -20,6 +25,10 @@
 
 #define STATS_CMD_PAGER_STATS		0
 #define STATS_CMD_ALLOC_STATS		1
+#define STATS_CMD_REE_FS_STATS		2
+#define STATS_CMD_FS_RPC_POOL_STATS	3
+#define STATS_CMD_MUTEX_STATS		4
+#define STATS_CMD_THREAD_STATS		5
 
 #define STATS_NB_POOLS			3
 
@@ -115,6 +124,113 @@ static TEE_Result get_pager_stats(uint32_t type, TEE_Param p[TEE_NUM_PARAMS])
 	return TEE_SUCCESS;
 }
 
+static TEE_Result get_ree_fs_stats(uint32_t type,
+				   TEE_Param p[TEE_NUM_PARAMS])
+{
+	struct tee_ree_fs_stats stats;
+
+	if (TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_OUTPUT,
+			    TEE_PARAM_TYPE_VALUE_OUTPUT,
+			    TEE_PARAM_TYPE_VALUE_OUTPUT,
+			    TEE_PARAM_TYPE_VALUE_OUTPUT) != type) {
+		EMSG("expect 4 output values as argument");
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	tee_ree_fs_get_stats(&stats);
+	p[0].value.a = stats.cache_hits;
+	p[0].value.b = stats.cache_misses;
+	p[1].value.a = stats.cache_evictions;
+	p[1].value.b = stats.cache_writebacks;
+	p[2].value.a = stats.cache_blocks;
+	p[2].value.b = stats.cache_dirty;
+	p[3].value.a = stats.readahead_blocks;
+	p[3].value.b = stats.readahead_window;
+
+	return TEE_SUCCESS;
+}
+
+static TEE_Result get_fs_rpc_pool_stats(uint32_t type,
+					TEE_Param p[TEE_NUM_PARAMS])
+{
+	struct tee_fs_rpc_pool_stats stats;
+
+	if (TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_OUTPUT,
+			    TEE_PARAM_TYPE_VALUE_OUTPUT,
+			    TEE_PARAM_TYPE_VALUE_OUTPUT,
+			    TEE_PARAM_TYPE_NONE) != type) {
+		EMSG("expect 3 output values as argument");
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	tee_fs_rpc_cache_get_stats(&stats);
+	p[0].value.a = stats.num_payloads;
+	p[0].value.b = stats.total_bytes;
+	p[1].value.a = stats.free_bytes;
+	p[1].value.b = 0;
+	p[2].value.a = stats.allocs_avoided;
+	p[2].value.b = stats.frees_avoided;
+
+	return TEE_SUCCESS;
+}
+
+static TEE_Result get_mutex_stats(uint32_t type, TEE_Param p[TEE_NUM_PARAMS])
+{
+	struct mutex_stats total;
+	struct mutex_stats ctxes;
+
+	/*
+	 * p[0] and p[1].value.a: contended, spin_acquired and sleeps summed
+	 * over all mutexes
+	 * p[2] and p[3].value.a: same counters for the mutex protecting the
+	 * list of TA contexts, taken each time a session is opened
+	 */
+	if (TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_OUTPUT,
+			    TEE_PARAM_TYPE_VALUE_OUTPUT,
+			    TEE_PARAM_TYPE_VALUE_OUTPUT,
+			    TEE_PARAM_TYPE_VALUE_OUTPUT) != type) {
+		EMSG("expect 4 output values as argument");
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	mutex_get_total_stats(&total);
+	tee_ta_get_ctxes_mutex_stats(&ctxes);
+	p[0].value.a = total.contended;
+	p[0].value.b = total.spin_acquired;
+	p[1].value.a = total.sleeps;
+	p[1].value.b = 0;
+	p[2].value.a = ctxes.contended;
+	p[2].value.b = ctxes.spin_acquired;
+	p[3].value.a = ctxes.sleeps;
+	p[3].value.b = 0;
+
+	return TEE_SUCCESS;
+}
+
+static TEE_Result get_thread_stats(uint32_t type,
+				   TEE_Param p[TEE_NUM_PARAMS])
+{
+	struct thread_stats stats;
+
+	if (TEE_PARAM_TYPES(TEE_PARAM_TYPE_VALUE_OUTPUT,
+			    TEE_PARAM_TYPE_VALUE_OUTPUT,
+			    TEE_PARAM_TYPE_VALUE_OUTPUT,
+			    TEE_PARAM_TYPE_NONE) != type) {
+		EMSG("expect 3 output values as argument");
+		return TEE_ERROR_BAD_PARAMETERS;
+	}
+
+	thread_get_stats(&stats);
+	p[0].value.a = stats.busy;
+	p[0].value.b = stats.busy_max;
+	p[1].value.a = stats.dyn_stacks;
+	p[1].value.b = stats.limit_hits;
+	p[2].value.a = CFG_NUM_THREADS;
+	p[2].value.b = 0;
+
+	return TEE_SUCCESS;
+}
+
 /*
  * Trusted Application Entry Points
  */
@@ -128,6 +244,14 @@ static TEE_Result invoke_command(void *psess __unused,
 		return get_pager_stats(ptypes, params);
 	case STATS_CMD_ALLOC_STATS:
 		return get_alloc_stats(ptypes, params);
+	case STATS_CMD_REE_FS_STATS:
+		return get_ree_fs_stats(ptypes, params);
+	case STATS_CMD_FS_RPC_POOL_STATS:
+		return get_fs_rpc_pool_stats(ptypes, params);
+	case STATS_CMD_MUTEX_STATS:
+		return get_mutex_stats(ptypes, params);
+	case STATS_CMD_THREAD_STATS:
+		return get_thread_stats(ptypes, params);
 	default:
 		break;
 	}
@@ -9,6 +9,7 @@
 #include <sm/optee_smc.h>
 #include <kernel/generic_boot.h>
 #include <kernel/tee_l2cc_mutex.h>
+#include <kernel/wait_queue.h>
 #include <kernel/misc.h>
 #include <mm/core_mmu.h>
 
@@ -74,14 +75,24 @@ static void tee_entry_exchange_capabilities(struct thread_smc_args *args)
 	 * OPTEE_SMC_NSEC_CAP_UNIPROCESSOR.
 	 */
 
-	if (args->a1 & ~OPTEE_SMC_NSEC_CAP_UNIPROCESSOR) {
+	if (args->a1 & ~(OPTEE_SMC_NSEC_CAP_UNIPROCESSOR |
+			 OPTEE_SMC_NSEC_CAP_WQ_WAKEUP_LIST)) {
 		/* Unknown capability. */
 		args->a0 = OPTEE_SMC_RETURN_ENOTAVAIL;
 		return;
 	}
 
+	wq_set_wakeup_list_supported(args->a1 &
+				     OPTEE_SMC_NSEC_CAP_WQ_WAKEUP_LIST);
+
 	args->a0 = OPTEE_SMC_RETURN_OK;
 	args->a1 = OPTEE_SMC_SEC_CAP_HAVE_RESERVED_SHM;
+#ifdef CFG_CORE_CMD_RING
+	args->a1 |= OPTEE_SMC_SEC_CAP_CMD_RING;
+#endif
+#ifdef CFG_CORE_CALL_QUEUE
+	args->a1 |= OPTEE_SMC_SEC_CAP_CALL_QUEUE;
+#endif
 
 #if defined(CFG_DYN_SHM_CAP)
 	dyn_shm_en = core_mmu_nsec_ddr_is_defined();
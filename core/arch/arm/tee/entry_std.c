@@ -4,6 +4,7 @@
  * Copyright (c) 2014, STMicroelectronics International N.V.
  */
 
+#include <arm.h>
 #include <assert.h>
 #include <bench.h>
 #include <compiler.h>
@@ -11,13 +12,16 @@
 #include <io.h>
 #include <kernel/linker.h>
 #include <kernel/msg_param.h>
+#include <kernel/mutex.h>
 #include <kernel/panic.h>
+#include <kernel/refcount.h>
 #include <kernel/tee_misc.h>
 #include <mm/core_memprot.h>
 #include <mm/core_mmu.h>
 #include <mm/mobj.h>
 #include <optee_msg.h>
 #include <sm/optee_smc.h>
+#include <stdlib.h>
 #include <string.h>
 #include <tee/entry_std.h>
 #include <tee/tee_cryp_utl.h>
@@ -38,6 +42,68 @@ static struct mobj **sdp_mem_mobjs;
 
 static unsigned int session_pnum;
 
+static bool cmd_ring_remove(uint32_t session);
+
+#ifdef CFG_CORE_CMD_RING
+/*
+ * struct cmd_ring - a registered command ring
+ * @session:	id of the session the ring belongs to
+ * @mobj:	shared memory of the ring, mapped while registered
+ * @shm:	the ring in shared memory
+ * @num_entries: number of entries, copied at registration
+ * @tail:	index of the next entry to process, master copy of
+ *		@shm->tail which normal world could overwrite
+ * @refc:	one reference while registered and one per doorbell
+ *		being processed
+ */
+struct cmd_ring {
+	uint32_t session;
+	struct mobj *mobj;
+	struct optee_msg_cmd_ring *shm;
+	uint32_t num_entries;
+	uint32_t tail;
+	struct refcount refc;
+	TAILQ_ENTRY(cmd_ring) link;
+};
+
+static TAILQ_HEAD(, cmd_ring) cmd_rings = TAILQ_HEAD_INITIALIZER(cmd_rings);
+static struct mutex cmd_ring_mu = MUTEX_INITIALIZER;
+#endif
+
+#ifdef CFG_CORE_CALL_QUEUE
+/*
+ * struct cmd_queue - a registered call queue
+ * @id:		id of the queue, returned at registration
+ * @mobj:	shared memory of the queue, mapped while registered
+ * @shm:	the queue in shared memory
+ * @cqes:	the completion queue, following the submission queue
+ * @num_entries: number of entries of each queue, copied at registration
+ * @sq_tail:	index of the next request to process, master copy of
+ *		@shm->sq_tail which normal world could overwrite
+ * @cq_head:	index of the next completion to post, master copy of
+ *		@shm->cq_head
+ * @mu:		serializes doorbells of the queue
+ * @refc:	one reference while registered and one per doorbell
+ *		being processed
+ */
+struct cmd_queue {
+	uint32_t id;
+	struct mobj *mobj;
+	struct optee_msg_call_queue *shm;
+	struct optee_msg_call_cqe *cqes;
+	uint32_t num_entries;
+	uint32_t sq_tail;
+	uint32_t cq_head;
+	struct mutex mu;
+	struct refcount refc;
+	TAILQ_ENTRY(cmd_queue) link;
+};
+
+static TAILQ_HEAD(, cmd_queue) cmd_queues = TAILQ_HEAD_INITIALIZER(cmd_queues);
+static struct mutex cmd_queue_mu = MUTEX_INITIALIZER;
+static uint32_t cmd_queue_last_id;
+#endif
+
 static bool param_mem_from_mobj(struct param_mem *mem, struct mobj *mobj,
 				const paddr_t pa, const size_t sz)
 {
@@ -345,6 +411,8 @@ static void entry_close_session(struct thread_smc_args *smc_args,
 
 	s = (struct tee_ta_session *)(vaddr_t)arg->session;
 	res = tee_ta_close_session(s, &tee_open_sessions, NSAPP_IDENTITY);
+	if (res == TEE_SUCCESS)
+		cmd_ring_remove(arg->session);
 out:
 	arg->ret = res;
 	arg->ret_origin = TEE_ORIGIN_TEE;
@@ -457,6 +525,530 @@ static void unregister_shm(struct thread_smc_args *smc_args,
 	smc_args->a0 = OPTEE_SMC_RETURN_OK;
 }
 
+#if defined(CFG_CORE_CMD_RING) || defined(CFG_CORE_CALL_QUEUE)
+/* Maps the ring or queue passed in a TMEM_INPUT parameter */
+static struct mobj *map_ring_param(const struct optee_msg_param *param)
+{
+	uint64_t attr = READ_ONCE(param->attr);
+	paddr_t pa = READ_ONCE(param->u.tmem.buf_ptr);
+	size_t sz = READ_ONCE(param->u.tmem.size);
+	uint64_t shm_ref = READ_ONCE(param->u.tmem.shm_ref);
+
+	if ((attr & OPTEE_MSG_ATTR_TYPE_MASK) != OPTEE_MSG_ATTR_TYPE_TMEM_INPUT)
+		return NULL;
+
+	if (attr & OPTEE_MSG_ATTR_NONCONTIG)
+		return msg_param_mobj_from_noncontig(pa, sz, shm_ref, true);
+
+	if (!core_pbuf_is(CORE_MEM_NSEC_SHM, pa, sz) ||
+	    !ALIGNMENT_IS_OK(pa, uint64_t))
+		return NULL;
+
+	return mobj_shm_alloc(pa, sz);
+}
+#endif
+
+#ifdef CFG_CORE_CMD_RING
+/* Called with cmd_ring_mu held */
+static struct cmd_ring *cmd_ring_find(uint32_t session)
+{
+	struct cmd_ring *ring;
+
+	TAILQ_FOREACH(ring, &cmd_rings, link)
+		if (ring->session == session)
+			return ring;
+
+	return NULL;
+}
+
+static struct cmd_ring *cmd_ring_get(uint32_t session)
+{
+	struct cmd_ring *ring;
+
+	mutex_lock(&cmd_ring_mu);
+	ring = cmd_ring_find(session);
+	if (ring && !refcount_inc(&ring->refc))
+		ring = NULL;
+	mutex_unlock(&cmd_ring_mu);
+
+	return ring;
+}
+
+static void cmd_ring_put(struct cmd_ring *ring)
+{
+	if (refcount_dec(&ring->refc)) {
+		mobj_free(ring->mobj);
+		free(ring);
+	}
+}
+
+/* Unregisters the ring of a session, if there's one */
+static bool cmd_ring_remove(uint32_t session)
+{
+	struct cmd_ring *ring;
+
+	mutex_lock(&cmd_ring_mu);
+	ring = cmd_ring_find(session);
+	if (ring)
+		TAILQ_REMOVE(&cmd_rings, ring, link);
+	mutex_unlock(&cmd_ring_mu);
+
+	if (!ring)
+		return false;
+
+	cmd_ring_put(ring);
+	return true;
+}
+
+static void register_cmd_ring(struct thread_smc_args *smc_args,
+			      struct optee_msg_arg *arg, uint32_t num_params)
+{
+	TEE_Result res = TEE_ERROR_BAD_PARAMETERS;
+	struct cmd_ring *ring = NULL;
+	struct tee_ta_session *s;
+	size_t max_entries;
+
+	smc_args->a0 = OPTEE_SMC_RETURN_OK;
+	arg->ret_origin = TEE_ORIGIN_TEE;
+
+	if (num_params != 1)
+		goto out;
+
+	s = tee_ta_get_session(arg->session, false, &tee_open_sessions);
+	if (!s)
+		goto out;
+	tee_ta_put_session(s);
+
+	ring = calloc(1, sizeof(*ring));
+	if (!ring) {
+		res = TEE_ERROR_OUT_OF_MEMORY;
+		goto out;
+	}
+
+	ring->mobj = map_ring_param(arg->params);
+	if (!ring->mobj)
+		goto out;
+	ring->shm = mobj_get_va(ring->mobj, 0);
+	if (!ring->shm || ring->mobj->size < sizeof(*ring->shm))
+		goto out;
+
+	max_entries = (ring->mobj->size - sizeof(*ring->shm)) /
+		      sizeof(struct optee_msg_cmd_ring_entry);
+	ring->num_entries = READ_ONCE(ring->shm->num_entries);
+	if (!ring->num_entries || !IS_POWER_OF_TWO(ring->num_entries) ||
+	    ring->num_entries > max_entries)
+		goto out;
+
+	ring->session = arg->session;
+	ring->tail = 0;
+	ring->shm->tail = 0;
+	refcount_set(&ring->refc, 1);
+
+	mutex_lock(&cmd_ring_mu);
+	if (cmd_ring_find(ring->session)) {
+		res = TEE_ERROR_ACCESS_CONFLICT;
+	} else {
+		TAILQ_INSERT_TAIL(&cmd_rings, ring, link);
+		res = TEE_SUCCESS;
+	}
+	mutex_unlock(&cmd_ring_mu);
+
+out:
+	if (res && ring) {
+		mobj_free(ring->mobj);
+		free(ring);
+	}
+	arg->ret = res;
+}
+
+static void unregister_cmd_ring(struct thread_smc_args *smc_args,
+				struct optee_msg_arg *arg, uint32_t num_params)
+{
+	if (!num_params && cmd_ring_remove(arg->session))
+		arg->ret = TEE_SUCCESS;
+	else
+		arg->ret = TEE_ERROR_BAD_PARAMETERS;
+	arg->ret_origin = TEE_ORIGIN_TEE;
+	smc_args->a0 = OPTEE_SMC_RETURN_OK;
+}
+
+static void cmd_ring_invoke(struct tee_ta_session *s,
+			    struct optee_msg_cmd_ring_entry *e)
+{
+	TEE_Result res;
+	TEE_ErrorOrigin err_orig = TEE_ORIGIN_TEE;
+	struct tee_ta_param param = { 0 };
+	uint64_t saved_attr[TEE_NUM_PARAMS] = { 0 };
+	uint32_t num_params = READ_ONCE(e->num_params);
+
+	if (num_params > OPTEE_MSG_CMD_RING_NUM_PARAMS) {
+		num_params = 0;
+		res = TEE_ERROR_BAD_PARAMETERS;
+		goto out;
+	}
+
+	res = copy_in_params(e->params, num_params, &param, saved_attr);
+	if (res != TEE_SUCCESS)
+		goto out;
+
+	res = tee_ta_invoke_command(&err_orig, s, NSAPP_IDENTITY,
+				    TEE_TIMEOUT_INFINITE, READ_ONCE(e->func),
+				    &param);
+
+	copy_out_param(&param, num_params, e->params, saved_attr);
+
+out:
+	cleanup_shm_refs(saved_attr, &param, num_params);
+
+	e->ret = res;
+	e->ret_origin = err_orig;
+}
+
+/*
+ * Doorbell of a command ring. The ring memory stays mapped and the
+ * session is looked up once per doorbell, which saves the mapping of a
+ * struct optee_msg_arg and the session lookup for each command.
+ */
+static void entry_cmd_ring(struct thread_smc_args *smc_args)
+{
+	struct cmd_ring *ring = cmd_ring_get(smc_args->a1);
+	struct tee_ta_session *s = NULL;
+	uint32_t count = 0;
+	uint32_t head;
+
+	smc_args->a0 = OPTEE_SMC_RETURN_EBADCMD;
+	if (!ring)
+		return;
+
+	/* Enable foreign interrupts for STD calls */
+	thread_set_foreign_intr(true);
+
+	/*
+	 * Holding the session exclusively also serializes doorbells of
+	 * the same ring.
+	 */
+	s = tee_ta_get_session(ring->session, true, &tee_open_sessions);
+	if (!s)
+		goto out;
+
+	while (true) {
+		head = READ_ONCE(ring->shm->head);
+		if (head == ring->tail)
+			break;
+		if (head - ring->tail > ring->num_entries) {
+			EMSG("Corrupt command ring, head %" PRIu32
+			     " tail %" PRIu32, head, ring->tail);
+			goto out;
+		}
+		/* Read the entries only after head */
+		dsb_ish();
+
+		while (ring->tail != head) {
+			cmd_ring_invoke(s, ring->shm->entries +
+					   (ring->tail &
+					    (ring->num_entries - 1)));
+			ring->tail++;
+			count++;
+			/* Publish the result before the entry is released */
+			dsb_ishst();
+			ring->shm->tail = ring->tail;
+		}
+	}
+
+	smc_args->a0 = OPTEE_SMC_RETURN_OK;
+	smc_args->a1 = count;
+out:
+	if (s)
+		tee_ta_put_session(s);
+	cmd_ring_put(ring);
+}
+#else
+static void register_cmd_ring(struct thread_smc_args *smc_args,
+			      struct optee_msg_arg *arg __unused,
+			      uint32_t num_params __unused)
+{
+	smc_args->a0 = OPTEE_SMC_RETURN_EBADCMD;
+}
+
+static void unregister_cmd_ring(struct thread_smc_args *smc_args,
+				struct optee_msg_arg *arg __unused,
+				uint32_t num_params __unused)
+{
+	smc_args->a0 = OPTEE_SMC_RETURN_EBADCMD;
+}
+
+static bool cmd_ring_remove(uint32_t session __unused)
+{
+	return false;
+}
+
+static void entry_cmd_ring(struct thread_smc_args *smc_args)
+{
+	smc_args->a0 = OPTEE_SMC_RETURN_UNKNOWN_FUNCTION;
+}
+#endif /*CFG_CORE_CMD_RING*/
+
+#ifdef CFG_CORE_CALL_QUEUE
+/* Called with cmd_queue_mu held */
+static struct cmd_queue *cmd_queue_find(uint32_t id)
+{
+	struct cmd_queue *q;
+
+	TAILQ_FOREACH(q, &cmd_queues, link)
+		if (q->id == id)
+			return q;
+
+	return NULL;
+}
+
+static struct cmd_queue *cmd_queue_get(uint32_t id)
+{
+	struct cmd_queue *q;
+
+	mutex_lock(&cmd_queue_mu);
+	q = cmd_queue_find(id);
+	if (q && !refcount_inc(&q->refc))
+		q = NULL;
+	mutex_unlock(&cmd_queue_mu);
+
+	return q;
+}
+
+static void cmd_queue_put(struct cmd_queue *q)
+{
+	if (refcount_dec(&q->refc)) {
+		mutex_destroy(&q->mu);
+		mobj_free(q->mobj);
+		free(q);
+	}
+}
+
+static void register_call_queue(struct thread_smc_args *smc_args,
+				struct optee_msg_arg *arg, uint32_t num_params)
+{
+	TEE_Result res = TEE_ERROR_BAD_PARAMETERS;
+	struct cmd_queue *q = NULL;
+	size_t max_entries;
+	uint64_t attr;
+
+	smc_args->a0 = OPTEE_SMC_RETURN_OK;
+	arg->ret_origin = TEE_ORIGIN_TEE;
+
+	if (num_params != 2)
+		goto out;
+	attr = READ_ONCE(arg->params[1].attr);
+	if ((attr & OPTEE_MSG_ATTR_TYPE_MASK) !=
+	    OPTEE_MSG_ATTR_TYPE_VALUE_OUTPUT)
+		goto out;
+
+	q = calloc(1, sizeof(*q));
+	if (!q) {
+		res = TEE_ERROR_OUT_OF_MEMORY;
+		goto out;
+	}
+
+	q->mobj = map_ring_param(arg->params);
+	if (!q->mobj)
+		goto out;
+	q->shm = mobj_get_va(q->mobj, 0);
+	if (!q->shm || q->mobj->size < sizeof(*q->shm))
+		goto out;
+
+	max_entries = (q->mobj->size - sizeof(*q->shm)) /
+		      (sizeof(struct optee_msg_call_sqe) +
+		       sizeof(struct optee_msg_call_cqe));
+	q->num_entries = READ_ONCE(q->shm->num_entries);
+	if (!q->num_entries || !IS_POWER_OF_TWO(q->num_entries) ||
+	    q->num_entries > max_entries)
+		goto out;
+
+	q->cqes = (void *)(q->shm->sqes + q->num_entries);
+	q->sq_tail = 0;
+	q->cq_head = 0;
+	q->shm->sq_tail = 0;
+	q->shm->cq_head = 0;
+	mutex_init(&q->mu);
+	refcount_set(&q->refc, 1);
+
+	mutex_lock(&cmd_queue_mu);
+	do {
+		q->id = ++cmd_queue_last_id;
+	} while (!q->id || cmd_queue_find(q->id));
+	TAILQ_INSERT_TAIL(&cmd_queues, q, link);
+	mutex_unlock(&cmd_queue_mu);
+
+	arg->params[1].u.value.a = q->id;
+	res = TEE_SUCCESS;
+out:
+	if (res && q) {
+		mobj_free(q->mobj);
+		free(q);
+	}
+	arg->ret = res;
+}
+
+static void unregister_call_queue(struct thread_smc_args *smc_args,
+				  struct optee_msg_arg *arg,
+				  uint32_t num_params)
+{
+	struct cmd_queue *q = NULL;
+	uint64_t attr;
+
+	arg->ret = TEE_ERROR_BAD_PARAMETERS;
+	arg->ret_origin = TEE_ORIGIN_TEE;
+	smc_args->a0 = OPTEE_SMC_RETURN_OK;
+
+	if (num_params != 1)
+		return;
+	attr = READ_ONCE(arg->params[0].attr);
+	if ((attr & OPTEE_MSG_ATTR_TYPE_MASK) !=
+	    OPTEE_MSG_ATTR_TYPE_VALUE_INPUT)
+		return;
+
+	mutex_lock(&cmd_queue_mu);
+	q = cmd_queue_find(READ_ONCE(arg->params[0].u.value.a));
+	if (q)
+		TAILQ_REMOVE(&cmd_queues, q, link);
+	mutex_unlock(&cmd_queue_mu);
+
+	if (q) {
+		cmd_queue_put(q);
+		arg->ret = TEE_SUCCESS;
+	}
+}
+
+/*
+ * Processes one request through the same entry functions as
+ * OPTEE_SMC_CALL_WITH_ARG. The request is copied to a struct optee_msg_arg
+ * in secure memory first, so normal world can't change it while it's
+ * being processed.
+ */
+static void cmd_queue_process(struct optee_msg_call_sqe *sqe,
+			      struct optee_msg_call_cqe *cqe)
+{
+	union {
+		struct optee_msg_arg arg;
+		uint8_t buf[OPTEE_MSG_GET_ARG_SIZE(
+				OPTEE_MSG_CALL_QUEUE_NUM_PARAMS)];
+	} u = { .buf = { 0 } };
+	struct optee_msg_arg *arg = &u.arg;
+	struct thread_smc_args smc_args = { 0 };
+	uint32_t num_params = READ_ONCE(sqe->num_params);
+
+	arg->cmd = READ_ONCE(sqe->cmd);
+	arg->func = READ_ONCE(sqe->func);
+	arg->session = READ_ONCE(sqe->session);
+
+	if (num_params > OPTEE_MSG_CALL_QUEUE_NUM_PARAMS) {
+		arg->ret = TEE_ERROR_BAD_PARAMETERS;
+		arg->ret_origin = TEE_ORIGIN_TEE;
+		goto out;
+	}
+	arg->num_params = num_params;
+	memcpy(arg->params, sqe->params, num_params * sizeof(*arg->params));
+
+	switch (arg->cmd) {
+	case OPTEE_MSG_CMD_OPEN_SESSION:
+		entry_open_session(&smc_args, arg, num_params);
+		break;
+	case OPTEE_MSG_CMD_CLOSE_SESSION:
+		entry_close_session(&smc_args, arg, num_params);
+		break;
+	case OPTEE_MSG_CMD_INVOKE_COMMAND:
+		entry_invoke_command(&smc_args, arg, num_params);
+		break;
+	default:
+		arg->ret = TEE_ERROR_NOT_SUPPORTED;
+		arg->ret_origin = TEE_ORIGIN_TEE;
+		goto out;
+	}
+
+	memcpy(sqe->params, arg->params, num_params * sizeof(*arg->params));
+out:
+	cqe->user_data = READ_ONCE(sqe->user_data);
+	cqe->session = arg->session;
+	cqe->ret = arg->ret;
+	cqe->ret_origin = arg->ret_origin;
+}
+
+/*
+ * Doorbell of a call queue. All requests submitted so far are processed
+ * before returning to normal world, which amortizes the world switch and
+ * the thread allocation over the whole batch.
+ */
+static void entry_call_queue(struct thread_smc_args *smc_args)
+{
+	struct cmd_queue *q = cmd_queue_get(smc_args->a1);
+	uint32_t mask;
+	uint32_t count = 0;
+	uint32_t sq_head;
+
+	smc_args->a0 = OPTEE_SMC_RETURN_EBADCMD;
+	if (!q)
+		return;
+	mask = q->num_entries - 1;
+
+	/* Enable foreign interrupts for STD calls */
+	thread_set_foreign_intr(true);
+
+	mutex_lock(&q->mu);
+	while (true) {
+		sq_head = READ_ONCE(q->shm->sq_head);
+		if (sq_head == q->sq_tail)
+			break;
+		if (sq_head - q->sq_tail > q->num_entries) {
+			EMSG("Corrupt call queue, sq_head %" PRIu32
+			     " sq_tail %" PRIu32, sq_head, q->sq_tail);
+			goto out;
+		}
+		/* Read the requests only after sq_head */
+		dsb_ish();
+
+		while (q->sq_tail != sq_head) {
+			/* Completion queue full, normal world will retry */
+			if (q->cq_head - READ_ONCE(q->shm->cq_tail) >=
+			    q->num_entries)
+				goto done;
+
+			cmd_queue_process(q->shm->sqes + (q->sq_tail & mask),
+					  q->cqes + (q->cq_head & mask));
+			q->sq_tail++;
+			q->cq_head++;
+			count++;
+			/* Publish the completion before the indexes */
+			dsb_ishst();
+			q->shm->sq_tail = q->sq_tail;
+			q->shm->cq_head = q->cq_head;
+		}
+	}
+done:
+	smc_args->a0 = OPTEE_SMC_RETURN_OK;
+	smc_args->a1 = count;
+out:
+	mutex_unlock(&q->mu);
+	cmd_queue_put(q);
+}
+#else
+static void register_call_queue(struct thread_smc_args *smc_args,
+				struct optee_msg_arg *arg __unused,
+				uint32_t num_params __unused)
+{
+	smc_args->a0 = OPTEE_SMC_RETURN_EBADCMD;
+}
+
+static void unregister_call_queue(struct thread_smc_args *smc_args,
+				  struct optee_msg_arg *arg __unused,
+				  uint32_t num_params __unused)
+{
+	smc_args->a0 = OPTEE_SMC_RETURN_EBADCMD;
+}
+
+static void entry_call_queue(struct thread_smc_args *smc_args)
+{
+	smc_args->a0 = OPTEE_SMC_RETURN_UNKNOWN_FUNCTION;
+}
+#endif /*CFG_CORE_CALL_QUEUE*/
+
 static struct mobj *map_cmd_buffer(paddr_t parg, uint32_t *num_params)
 {
 	struct mobj *mobj;
@@ -512,6 +1104,16 @@ void __weak tee_entry_std(struct thread_smc_args *smc_args)
 	uint32_t num_params = 0;		/* fix gcc warning */
 	struct mobj *mobj;
 
+	if (smc_args->a0 == OPTEE_SMC_CALL_WITH_CMD_RING) {
+		entry_cmd_ring(smc_args);
+		return;
+	}
+
+	if (smc_args->a0 == OPTEE_SMC_CALL_WITH_QUEUE) {
+		entry_call_queue(smc_args);
+		return;
+	}
+
 	if (smc_args->a0 != OPTEE_SMC_CALL_WITH_ARG) {
 		EMSG("Unknown SMC 0x%" PRIx64, (uint64_t)smc_args->a0);
 		DMSG("Expected 0x%x\n", OPTEE_SMC_CALL_WITH_ARG);
@@ -563,6 +1165,18 @@ void __weak tee_entry_std(struct thread_smc_args *smc_args)
 	case OPTEE_MSG_CMD_UNREGISTER_SHM:
 		unregister_shm(smc_args, arg, num_params);
 		break;
+	case OPTEE_MSG_CMD_REGISTER_CMD_RING:
+		register_cmd_ring(smc_args, arg, num_params);
+		break;
+	case OPTEE_MSG_CMD_UNREGISTER_CMD_RING:
+		unregister_cmd_ring(smc_args, arg, num_params);
+		break;
+	case OPTEE_MSG_CMD_REGISTER_CALL_QUEUE:
+		register_call_queue(smc_args, arg, num_params);
+		break;
+	case OPTEE_MSG_CMD_UNREGISTER_CALL_QUEUE:
+		unregister_call_queue(smc_args, arg, num_params);
+		break;
 
 	default:
 		EMSG("Unknown cmd 0x%x\n", arg->cmd);
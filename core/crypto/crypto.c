@@ -44,6 +44,16 @@ TEE_Result crypto_hash_final(void *ctx __unused, uint32_t algo __unused,
 {
 	return TEE_ERROR_NOT_IMPLEMENTED;
 }
+
+TEE_Result crypto_hash_multi(void *ctx __unused, uint32_t algo __unused,
+			     const uint8_t *data __unused,
+			     size_t stride __unused,
+			     const size_t *len __unused, size_t num __unused,
+			     uint8_t *digest __unused,
+			     size_t digest_len __unused)
+{
+	return TEE_ERROR_NOT_IMPLEMENTED;
+}
 #endif /*_CFG_CRYPTO_WITH_HASH*/
 
 #if !defined(_CFG_CRYPTO_WITH_CIPHER)
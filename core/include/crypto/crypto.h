@@ -35,6 +35,14 @@ TEE_Result crypto_hash_final(void *ctx, uint32_t algo, uint8_t *digest,
 			     size_t len);
 void crypto_hash_free_ctx(void *ctx, uint32_t algo);
 void crypto_hash_copy_state(void *dst_ctx, void *src_ctx, uint32_t algo);
+/*
+ * Calculates the digests of @num independent messages. Message n is
+ * @len[n] bytes long and starts at @data + n * @stride, its digest is
+ * stored at @digest + n * @digest_len. @ctx is used as scratch context.
+ */
+TEE_Result crypto_hash_multi(void *ctx, uint32_t algo, const uint8_t *data,
+			     size_t stride, const size_t *len, size_t num,
+			     uint8_t *digest, size_t digest_len);
 
 /* Symmetric ciphers */
 TEE_Result crypto_cipher_alloc_ctx(void **ctx, uint32_t algo);
@@ -7,12 +7,34 @@
 
 #include <stdint.h>
 
+/*
+ * A handle is the index of its slot in the low HANDLE_INDEX_BITS bits and
+ * the generation of the slot in the bits above. The generation of a slot
+ * is bumped each time a handle is released, so a stale handle doesn't
+ * match a later handle reusing the slot, until the generation wraps.
+ */
+#define HANDLE_INDEX_BITS	20
+
+/*
+ * struct handle_db - handle database
+ * @ptrs:	pointer of each slot, NULL if the slot is free
+ * @gens:	generation of each slot
+ * @next_free:	for a free slot, the next free slot, free slots are linked
+ *		starting at @free_head and ending with @max_ptrs
+ * @max_ptrs:	number of slots
+ * @free_head:	first free slot, @max_ptrs if there's none
+ *
+ * All zero is a valid empty database.
+ */
 struct handle_db {
 	void **ptrs;
+	uint32_t *gens;
+	uint32_t *next_free;
 	size_t max_ptrs;
+	size_t free_head;
 };
 
-#define HANDLE_DB_INITIALIZER { NULL, 0 }
+#define HANDLE_DB_INITIALIZER { NULL, NULL, NULL, 0, 0 }
 
 /*
  * Frees all internal data structures of the database, but does not free
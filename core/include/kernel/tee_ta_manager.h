@@ -84,12 +84,16 @@ struct tee_ta_ctx {
 	uint32_t panic_code;	/* Code supplied for panic */
 	uint32_t ref_count;	/* Reference counter for multi session TA */
 	bool busy;		/* context is busy and cannot be entered */
+	struct mutex busy_mu;	/* Protects busy */
 	struct condvar busy_cv;	/* CV used when context is busy */
 };
 
 struct tee_ta_session {
 	TAILQ_ENTRY(tee_ta_session) link;
 	TAILQ_ENTRY(tee_ta_session) link_tsd;
+	TAILQ_ENTRY(tee_ta_session) link_hash;
+	/* List of open sessions the session belongs to */
+	struct tee_ta_session_head *open_sessions;
 	struct tee_ta_ctx *ctx;	/* TA context */
 	TEE_Identity clnt_id;	/* Identify of client */
 	bool cancel;		/* True if TAF is cancelled */
@@ -111,6 +115,11 @@ extern struct tee_ta_ctx_head tee_ctxes;
 
 extern struct mutex tee_ta_mutex;
 
+#ifdef CFG_WITH_STATS
+/* Returns the contention counters of the mutex protecting tee_ctxes */
+void tee_ta_get_ctxes_mutex_stats(struct mutex_stats *stats);
+#endif
+
 TEE_Result tee_ta_open_session(TEE_ErrorOrigin *err,
 			       struct tee_ta_session **sess,
 			       struct tee_ta_session_head *open_sessions,
@@ -196,6 +196,129 @@ struct optee_msg_arg {
 	struct optee_msg_param params[];
 };
 
+/* Maximum number of parameters of a command in a command ring */
+#define OPTEE_MSG_CMD_RING_NUM_PARAMS	4
+
+/**
+ * struct optee_msg_cmd_ring_entry - invoke command in a command ring
+ * @func: Trusted Application function, specific to the Trusted Application
+ * @ret: return value
+ * @ret_origin: origin of the return value
+ * @num_params: number of parameters used in @params
+ * @params: the parameters, same as for OPTEE_MSG_CMD_INVOKE_COMMAND
+ */
+struct optee_msg_cmd_ring_entry {
+	uint32_t func;
+	uint32_t ret;
+	uint32_t ret_origin;
+	uint32_t num_params;
+	struct optee_msg_param params[OPTEE_MSG_CMD_RING_NUM_PARAMS];
+};
+
+/**
+ * struct optee_msg_cmd_ring - command ring of a session
+ * @head: index of the next entry to be filled, updated by normal world
+ *	  once the entry is complete
+ * @tail: index of the next entry to be processed, updated by secure
+ *	  world once the result of the entry is written back
+ * @num_entries: number of entries, a power of two. Read by secure world
+ *		 when the ring is registered.
+ * @pad: unused
+ * @entries: the entries
+ *
+ * Both indexes start at 0 and are free running, index i refers to entry
+ * i % num_entries. Entries between @tail and @head are invoked in order,
+ * each on the session the ring is registered for, when normal world
+ * rings the doorbell with OPTEE_SMC_CALL_WITH_CMD_RING.
+ */
+struct optee_msg_cmd_ring {
+	uint32_t head;
+	uint32_t tail;
+	uint32_t num_entries;
+	uint32_t pad;
+	struct optee_msg_cmd_ring_entry entries[];
+};
+
+/*
+ * Maximum number of parameters of a request in a call queue, room for the
+ * two meta parameters of OPTEE_MSG_CMD_OPEN_SESSION and four TA parameters
+ */
+#define OPTEE_MSG_CALL_QUEUE_NUM_PARAMS	6
+
+/**
+ * struct optee_msg_call_sqe - submission queue entry of a call queue
+ * @user_data: opaque to secure world, copied to the completion entry
+ * @cmd: OPTEE_MSG_CMD_OPEN_SESSION, OPTEE_MSG_CMD_INVOKE_COMMAND or
+ *	 OPTEE_MSG_CMD_CLOSE_SESSION
+ * @func: same as struct optee_msg_arg::func
+ * @session: same as struct optee_msg_arg::session, the session opened by
+ *	     OPTEE_MSG_CMD_OPEN_SESSION is returned in the completion entry
+ * @num_params: number of parameters used in @params
+ * @params: the parameters, same as for struct optee_msg_arg. Output
+ *	    parameters are updated before the completion entry is posted.
+ */
+struct optee_msg_call_sqe {
+	uint64_t user_data;
+	uint32_t cmd;
+	uint32_t func;
+	uint32_t session;
+	uint32_t num_params;
+	struct optee_msg_param params[OPTEE_MSG_CALL_QUEUE_NUM_PARAMS];
+};
+
+/**
+ * struct optee_msg_call_cqe - completion queue entry of a call queue
+ * @user_data: copied from the submission queue entry
+ * @session: session of the request, the new session for
+ *	     OPTEE_MSG_CMD_OPEN_SESSION
+ * @ret: return value
+ * @ret_origin: origin of the return value
+ * @pad: unused
+ */
+struct optee_msg_call_cqe {
+	uint64_t user_data;
+	uint32_t session;
+	uint32_t ret;
+	uint32_t ret_origin;
+	uint32_t pad;
+};
+
+/**
+ * struct optee_msg_call_queue - submission and completion queue
+ * @sq_head: index of the next submission entry to be filled, updated by
+ *	     normal world once the entry is complete
+ * @sq_tail: index of the next submission entry to be processed, updated
+ *	     by secure world once the request is completed
+ * @cq_head: index of the next completion entry to be posted, updated by
+ *	     secure world once the entry is complete
+ * @cq_tail: index of the next completion entry to be consumed, updated by
+ *	     normal world once it has read the entry
+ * @num_entries: number of entries of each queue, a power of two. Read by
+ *		 secure world when the queue is registered.
+ * @pad: unused
+ * @sqes: the submission queue, followed by @num_entries struct
+ *	  optee_msg_call_cqe making up the completion queue
+ *
+ * All indexes start at 0 and are free running, index i refers to entry
+ * i % num_entries. When normal world rings the doorbell with
+ * OPTEE_SMC_CALL_WITH_QUEUE secure world processes the requests between
+ * @sq_tail and @sq_head in order and posts one completion entry for each.
+ * Processing stops early if the completion queue is full, normal world
+ * then has to consume completions and ring the doorbell again.
+ *
+ * A submission entry may be reused once @sq_tail has passed it, its
+ * output parameters must be read before that.
+ */
+struct optee_msg_call_queue {
+	uint32_t sq_head;
+	uint32_t sq_tail;
+	uint32_t cq_head;
+	uint32_t cq_tail;
+	uint32_t num_entries;
+	uint32_t pad[3];
+	struct optee_msg_call_sqe sqes[];
+};
+
 /**
  * OPTEE_MSG_GET_ARG_SIZE - return size of struct optee_msg_arg
  *
@@ -296,6 +419,39 @@ struct optee_msg_arg {
  * [in] param[0].u.rmem.shm_ref		holds shared memory reference
  * [in] param[0].u.rmem.offs		0
  * [in] param[0].u.rmem.size		0
+ *
+ * OPTEE_MSG_CMD_REGISTER_CMD_RING registers a command ring, struct
+ * optee_msg_cmd_ring, for the session in struct optee_msg_arg::session.
+ * The ring stays mapped until it's unregistered with
+ * OPTEE_MSG_CMD_UNREGISTER_CMD_RING or the session is closed. Only
+ * available if secure world reports OPTEE_SMC_SEC_CAP_CMD_RING. The
+ * information is passed as:
+ * [in] param[0].attr			OPTEE_MSG_ATTR_TYPE_TMEM_INPUT
+ *					[| OPTEE_MSG_ATTR_NONCONTIG]
+ * [in] param[0].u.tmem.buf_ptr		physical address (of first fragment)
+ * [in] param[0].u.tmem.size		size of the ring
+ * [in] param[0].u.tmem.shm_ref		holds shared memory reference
+ *
+ * OPTEE_MSG_CMD_UNREGISTER_CMD_RING unregisters the command ring of the
+ * session in struct optee_msg_arg::session, no parameters.
+ *
+ * OPTEE_MSG_CMD_REGISTER_CALL_QUEUE registers a call queue, struct
+ * optee_msg_call_queue, used to submit open session, invoke command and
+ * close session requests without a struct optee_msg_arg each. The queue
+ * stays mapped until it's unregistered with
+ * OPTEE_MSG_CMD_UNREGISTER_CALL_QUEUE. Only available if secure world
+ * reports OPTEE_SMC_SEC_CAP_CALL_QUEUE. The information is passed as:
+ * [in] param[0].attr			OPTEE_MSG_ATTR_TYPE_TMEM_INPUT
+ *					[| OPTEE_MSG_ATTR_NONCONTIG]
+ * [in] param[0].u.tmem.buf_ptr		physical address (of first fragment)
+ * [in] param[0].u.tmem.size		size of the queue
+ * [in] param[0].u.tmem.shm_ref		holds shared memory reference
+ * [out] param[1].attr			OPTEE_MSG_ATTR_TYPE_VALUE_OUTPUT
+ * [out] param[1].u.value.a		id of the queue
+ *
+ * OPTEE_MSG_CMD_UNREGISTER_CALL_QUEUE unregisters a call queue:
+ * [in] param[0].attr			OPTEE_MSG_ATTR_TYPE_VALUE_INPUT
+ * [in] param[0].u.value.a		id of the queue
  */
 #define OPTEE_MSG_CMD_OPEN_SESSION	0
 #define OPTEE_MSG_CMD_INVOKE_COMMAND	1
@@ -303,6 +459,10 @@ struct optee_msg_arg {
 #define OPTEE_MSG_CMD_CANCEL		3
 #define OPTEE_MSG_CMD_REGISTER_SHM	4
 #define OPTEE_MSG_CMD_UNREGISTER_SHM	5
+#define OPTEE_MSG_CMD_REGISTER_CMD_RING	6
+#define OPTEE_MSG_CMD_UNREGISTER_CMD_RING	7
+#define OPTEE_MSG_CMD_REGISTER_CALL_QUEUE	8
+#define OPTEE_MSG_CMD_UNREGISTER_CALL_QUEUE	9
 #define OPTEE_MSG_FUNCID_CALL_WITH_ARG	0x0004
 
 /*****************************************************************************
@@ -346,10 +506,19 @@ struct optee_msg_arg {
  * Waking up a key
  * [in] param[0].u.value.a OPTEE_MSG_RPC_WAIT_QUEUE_WAKEUP
  * [in] param[0].u.value.b wakeup key
+ *
+ * Waking up a list of keys, only used if normal world has reported
+ * OPTEE_SMC_NSEC_CAP_WQ_WAKEUP_LIST
+ * [in] param[0].u.value.a OPTEE_MSG_RPC_WAIT_QUEUE_WAKEUP_LIST
+ * [in] param[0].u.value.b number of keys, at most
+ *			   OPTEE_MSG_RPC_WAIT_QUEUE_WAKEUP_LIST_MAX
+ * [in] param[1..3].u.value.a-c wakeup keys, three per parameter
  */
 #define OPTEE_MSG_RPC_CMD_WAIT_QUEUE	4
 #define OPTEE_MSG_RPC_WAIT_QUEUE_SLEEP	0
 #define OPTEE_MSG_RPC_WAIT_QUEUE_WAKEUP	1
+#define OPTEE_MSG_RPC_WAIT_QUEUE_WAKEUP_LIST	2
+#define OPTEE_MSG_RPC_WAIT_QUEUE_WAKEUP_LIST_MAX	9
 
 /*
  * Suspend execution
@@ -6,6 +6,8 @@
 #ifndef __OPTEE_MSG_SUPPLICANT_H
 #define __OPTEE_MSG_SUPPLICANT_H
 
+#include <stdint.h>
+
 /*
  * Load a TA into memory
  */
@@ -133,6 +135,45 @@
  */
 #define OPTEE_MRF_READDIR		10
 
+/*
+ * Read several extents from a file
+ *
+ * [in]     param[0].u.value.a	OPTEE_MRF_READV
+ * [in]     param[0].u.value.b	file descriptor of open file
+ * [in]     param[0].u.value.c	number of extents
+ * [in]     param[1].u.tmem	array of struct optee_mrf_extent
+ * [out]    param[2].u.tmem	buffer to hold returned data
+ *
+ * The data of each extent is stored directly after the data of the
+ * previous extent in the buffer of param[2]. If the number of extents is
+ * 0, param[1] and param[2] are omitted. This is used to probe if the
+ * command is supported.
+ */
+#define OPTEE_MRF_READV			11
+
+/*
+ * Write several extents to a file
+ *
+ * [in]     param[0].u.value.a	OPTEE_MRF_WRITEV
+ * [in]     param[0].u.value.b	file descriptor of open file
+ * [in]     param[0].u.value.c	number of extents
+ * [in]     param[1].u.tmem	array of struct optee_mrf_extent
+ * [in]     param[2].u.tmem	buffer holding data to be written
+ *
+ * The data is laid out in the buffer of param[2] as for OPTEE_MRF_READV.
+ */
+#define OPTEE_MRF_WRITEV		12
+
+/*
+ * struct optee_mrf_extent - an extent of a file
+ * @offset:	offset into file
+ * @length:	number of bytes
+ */
+struct optee_mrf_extent {
+	uint64_t offset;
+	uint64_t length;
+};
+
 /*
  * End of definitions for messages with .cmd == OPTEE_MSG_RPC_CMD_FS
  */
@@ -151,4 +151,21 @@ TEE_Result tee_fs_dirfile_get_next(struct tee_fs_dirfile_dirh *dirh,
 				   const TEE_UUID *uuid, int *idx, void *oid,
 				   size_t *oidlen);
 
+/**
+ * tee_fs_dirfile_get_next_entry() - get next file of any TA
+ * @dirh:	dirfile handle
+ * @idx:	pointer to index
+ * @uuid:	uuid of the TA owning the file
+ * @oid:	object id
+ * @oidlen:	length of object id
+ * @dfh:	file handle
+ *
+ * Like tee_fs_dirfile_get_next() but not restricted to the files of one
+ * TA, used to traverse all files.
+ */
+TEE_Result tee_fs_dirfile_get_next_entry(struct tee_fs_dirfile_dirh *dirh,
+					 int *idx, TEE_UUID *uuid, void *oid,
+					 size_t *oidlen,
+					 struct tee_fs_dirfile_fileh *dfh);
+
 #endif /*__TEE_FS_DIRFILE_H*/
@@ -70,6 +70,20 @@ enum tee_fs_htree_type {
 
 struct tee_fs_rpc_operation;
 
+/* Maximum number of elements and bytes transferred by one vectored RPC */
+#define TEE_FS_HTREE_RPC_MAX_ELEMS	32
+#define TEE_FS_HTREE_RPC_MAX_SIZE	(64 * 1024)
+
+/**
+ * struct tee_fs_htree_rpc_elem - element of a vectored RPC operation
+ * @idx:	index of the element, as the @idx argument below
+ * @vers:	version of the element, as the @vers argument below
+ */
+struct tee_fs_htree_rpc_elem {
+	size_t idx;
+	uint8_t vers;
+};
+
 /**
  * struct tee_fs_htree_storage - storage description supplied by user of
  * this interface
@@ -78,10 +92,17 @@ struct tee_fs_rpc_operation;
  *			operation
  * @rpc_write_init:	initialize a struct tee_fs_rpc_operation for an RPC
  *			write operation
+ * @rpc_readv_init:	optional, initialize a struct tee_fs_rpc_operation
+ *			for an RPC read of several elements of the same type
+ * @rpc_writev_init:	optional, initialize a struct tee_fs_rpc_operation
+ *			for an RPC write of several elements of the same type
  *
  * The @idx arguments starts counting from 0. The @vers arguments are either
  * 0 or 1. The @data arguments is a pointer to a buffer in non-secure shared
- * memory where the encrypted data is stored.
+ * memory where the encrypted data is stored. For the vectored operations
+ * the data of the elements is stored consecutively in @data, in the order
+ * of @elem. The vectored operations may return TEE_ERROR_NOT_SUPPORTED in
+ * which case the elements are transferred one by one instead.
  */
 struct tee_fs_htree_storage {
 	size_t block_size;
@@ -94,6 +115,19 @@ struct tee_fs_htree_storage {
 				     enum tee_fs_htree_type type, size_t idx,
 				     uint8_t vers, void **data);
 	TEE_Result (*rpc_write_final)(struct tee_fs_rpc_operation *op);
+	TEE_Result (*rpc_readv_init)(void *aux,
+				     struct tee_fs_rpc_operation *op,
+				     enum tee_fs_htree_type type,
+				     const struct tee_fs_htree_rpc_elem *elem,
+				     size_t num_elem, void **data);
+	TEE_Result (*rpc_readv_final)(struct tee_fs_rpc_operation *op,
+				      size_t *bytes);
+	TEE_Result (*rpc_writev_init)(void *aux,
+				      struct tee_fs_rpc_operation *op,
+				      enum tee_fs_htree_type type,
+				      const struct tee_fs_htree_rpc_elem *elem,
+				      size_t num_elem, void **data);
+	TEE_Result (*rpc_writev_final)(struct tee_fs_rpc_operation *op);
 };
 
 struct tee_fs_htree;
@@ -125,6 +159,14 @@ void tee_fs_htree_close(struct tee_fs_htree **ht);
  */
 struct tee_fs_htree_meta *tee_fs_htree_get_meta(struct tee_fs_htree *ht);
 
+/**
+ * tee_fs_htree_get_hash() - get the hash of the hash tree as of the last
+ * time it was opened or synced to storage
+ * @ht:		hash tree
+ * @hash:	hash is copied here, TEE_FS_HTREE_HASH_SIZE bytes
+ */
+void tee_fs_htree_get_hash(struct tee_fs_htree *ht, uint8_t *hash);
+
 /**
  * tee_fs_htree_meta_set_dirty() - tell hash tree that meta were modified
  */
@@ -170,4 +212,38 @@ TEE_Result tee_fs_htree_write_block(struct tee_fs_htree **ht, size_t block_num,
 TEE_Result tee_fs_htree_read_block(struct tee_fs_htree **ht, size_t block_num,
 				   void *block);
 
+/**
+ * tee_fs_htree_write_blocks() - encrypt and write consecutive data blocks
+ * to storage
+ * @ht:		hash tree
+ * @block_num:	number of the first block
+ * @num_blocks:	number of blocks
+ * @blocks:	array of @num_blocks pointers to blocks of stor->block_size
+ *		size
+ *
+ * Uses vectored RPCs if supported by the storage.
+ *
+ * Frees the hash tree and sets *ht to NULL on failure and returns an error code
+ */
+TEE_Result tee_fs_htree_write_blocks(struct tee_fs_htree **ht,
+				     size_t block_num, size_t num_blocks,
+				     const void * const *blocks);
+
+/**
+ * tee_fs_htree_read_blocks() - read and decrypt consecutive data blocks
+ * from storage
+ * @ht:		hash tree
+ * @block_num:	number of the first block
+ * @num_blocks:	number of blocks
+ * @blocks:	array of @num_blocks pointers to blocks of stor->block_size
+ *		size
+ *
+ * Uses vectored RPCs if supported by the storage.
+ *
+ * Frees the hash tree and sets *ht to NULL on failure and returns an error code
+ */
+TEE_Result tee_fs_htree_read_blocks(struct tee_fs_htree **ht,
+				    size_t block_num, size_t num_blocks,
+				    void * const *blocks);
+
 #endif /*__TEE_FS_HTREE_H*/
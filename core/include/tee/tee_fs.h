@@ -8,7 +8,9 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 #include <tee_api_types.h>
+#include <tee/fs_htree.h>
 
 #define TEE_FS_NAME_MAX 350
 
@@ -44,20 +46,83 @@ struct tee_file_operations {
 			     bool overwrite);
 	TEE_Result (*remove)(struct tee_pobj *po);
 	TEE_Result (*truncate)(struct tee_file_handle *fh, size_t size);
+	/* Commits earlier writes to storage, optional */
+	TEE_Result (*sync)(struct tee_file_handle *fh);
 
 	TEE_Result (*opendir)(const TEE_UUID *uuid, struct tee_fs_dir **d);
 	TEE_Result (*readdir)(struct tee_fs_dir *d, struct tee_fs_dirent **ent);
 	void (*closedir)(struct tee_fs_dir *d);
 };
 
+/*
+ * Statistics on the REE FS
+ */
+struct tee_ree_fs_stats {
+	size_t cache_hits;	/* blocks found in the block cache */
+	size_t cache_misses;	/* blocks read from storage */
+	size_t cache_evictions;	/* blocks evicted from the block cache */
+	size_t cache_writebacks; /* dirty blocks written to storage */
+	size_t cache_blocks;	/* blocks currently cached */
+	size_t cache_dirty;	/* dirty blocks currently cached */
+	size_t readahead_blocks; /* blocks read ahead into the block cache */
+	size_t readahead_window; /* read-ahead window of the latest read */
+};
+
 #ifdef CFG_REE_FS
 extern const struct tee_file_operations ree_fs_ops;
+
+void tee_ree_fs_get_stats(struct tee_ree_fs_stats *stats);
+
+/*
+ * Position of tee_ree_fs_verify_next() in the REE FS, initialize with
+ * TEE_REE_FS_SCRUB_INITIALIZER to start with the first file.
+ * @idx:	index in the directory file of the current file
+ * @block:	next block of the current file to verify, 0 when the next
+ *		file is to be verified
+ * @hash:	hash of the current file, a rewritten file is started over
+ * @uuid, @oid, @oidlen: identify the current file
+ * @removed:	true if the current file was removed as corrupt
+ */
+struct tee_ree_fs_scrub {
+	int idx;
+	size_t block;
+	uint8_t hash[TEE_FS_HTREE_HASH_SIZE];
+	TEE_UUID uuid;
+	uint8_t oid[TEE_OBJECT_ID_MAX_LEN];
+	size_t oidlen;
+	bool removed;
+};
+
+#define TEE_REE_FS_SCRUB_INITIALIZER	{ .idx = -1 }
+
+/*
+ * Verifies at most @max_blocks data blocks of the current file of @s, or
+ * of the next file if @s->block is 0, and the hash tree nodes leading to
+ * them. The REE FS is locked only for the duration of the call. On
+ * return @s->block is 0 when the last block of the file has been
+ * verified and @bytes is increased with the amount of data read.
+ * Returns TEE_ERROR_CORRUPT_OBJECT if the file failed verification, in
+ * which case the file is removed if @remove_corrupt is true and no TA
+ * has it open. Returns TEE_ERROR_SECURITY if the directory file failed
+ * verification and TEE_ERROR_ITEM_NOT_FOUND after the last file.
+ */
+TEE_Result tee_ree_fs_verify_next(struct tee_ree_fs_scrub *s,
+				  size_t max_blocks, bool remove_corrupt,
+				  size_t *bytes);
+#else
+static inline void tee_ree_fs_get_stats(struct tee_ree_fs_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+}
 #endif
 #ifdef CFG_RPMB_FS
 extern const struct tee_file_operations rpmb_fs_ops;
 
 TEE_Result tee_rpmb_fs_raw_open(const char *fname, bool create,
 				struct tee_file_handle **fh);
+
+/* Removes a file opened with tee_rpmb_fs_raw_open(), which must be closed */
+TEE_Result tee_rpmb_fs_raw_remove(const char *fname);
 #endif
 
 #endif /*TEE_FS_H*/
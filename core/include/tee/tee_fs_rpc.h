@@ -12,6 +12,7 @@
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <string.h>
 #include <tee_api_types.h>
 #include <tee/tee_fs.h>
 #include <kernel/thread.h>
@@ -23,6 +24,7 @@ struct tee_fs_rpc_operation {
 };
 
 struct tee_fs_dirfile_fileh;
+struct optee_mrf_extent;
 
 TEE_Result tee_fs_rpc_open(uint32_t id, struct tee_pobj *po, int *fd);
 TEE_Result tee_fs_rpc_open_dfh(uint32_t id,
@@ -31,6 +33,9 @@ TEE_Result tee_fs_rpc_create(uint32_t id, struct tee_pobj *po, int *fd);
 TEE_Result tee_fs_rpc_create_dfh(uint32_t id,
 				 const struct tee_fs_dirfile_fileh *dfh,
 				 int *fd);
+/* Opens or creates a file in the root of the REE FS storage by name */
+TEE_Result tee_fs_rpc_open_fname(uint32_t id, const char *fname, int *fd);
+TEE_Result tee_fs_rpc_create_fname(uint32_t id, const char *fname, int *fd);
 TEE_Result tee_fs_rpc_close(uint32_t id, int fd);
 
 TEE_Result tee_fs_rpc_read_init(struct tee_fs_rpc_operation *op,
@@ -44,6 +49,30 @@ TEE_Result tee_fs_rpc_write_init(struct tee_fs_rpc_operation *op,
 				 size_t data_len, void **data);
 TEE_Result tee_fs_rpc_write_final(struct tee_fs_rpc_operation *op);
 
+/*
+ * Vectored versions of the read and write operations above, a single
+ * request transfers @num_extents extents of the file. The caller fills in
+ * the returned @extents array, the data of the extents is stored
+ * consecutively in the returned data buffer of @data_len bytes.
+ *
+ * Returns TEE_ERROR_NOT_SUPPORTED if tee-supplicant doesn't support
+ * vectored requests, the single extent functions should be used instead.
+ */
+TEE_Result tee_fs_rpc_readv_init(struct tee_fs_rpc_operation *op,
+				 uint32_t id, int fd, size_t num_extents,
+				 size_t data_len,
+				 struct optee_mrf_extent **extents,
+				 void **out_data);
+TEE_Result tee_fs_rpc_readv_final(struct tee_fs_rpc_operation *op,
+				  size_t *data_len);
+
+TEE_Result tee_fs_rpc_writev_init(struct tee_fs_rpc_operation *op,
+				  uint32_t id, int fd, size_t num_extents,
+				  size_t data_len,
+				  struct optee_mrf_extent **extents,
+				  void **data);
+TEE_Result tee_fs_rpc_writev_final(struct tee_fs_rpc_operation *op);
+
 
 TEE_Result tee_fs_rpc_truncate(uint32_t id, int fd, size_t len);
 TEE_Result tee_fs_rpc_remove(uint32_t id, struct tee_pobj *po);
@@ -58,21 +87,51 @@ TEE_Result tee_fs_rpc_closedir(uint32_t id, struct tee_fs_dir *d);
 TEE_Result tee_fs_rpc_readdir(uint32_t id, struct tee_fs_dir *d,
 			      struct tee_fs_dirent **ent);
 
+/*
+ * Statistics on the pool of FS RPC payloads
+ */
+struct tee_fs_rpc_pool_stats {
+	size_t num_payloads;	/* payloads allocated for the pool */
+	size_t total_bytes;	/* size of all payloads of the pool */
+	size_t free_bytes;	/* size of the payloads in the pool now */
+	size_t allocs_avoided;	/* payloads taken from the pool */
+	size_t frees_avoided;	/* payloads returned to the pool */
+};
+
 struct thread_specific_data;
 #if defined(CFG_WITH_USER_TA) && (defined(CFG_REE_FS) || defined(CFG_RPMB_FS))
-/* Frees the cache of allocated FS RPC memory */
+/* Releases the FS RPC memory of the thread, to the pool if possible */
 void tee_fs_rpc_cache_clear(struct thread_specific_data *tsd);
+
+/*
+ * Removes one payload from the pool of FS RPC memory and returns its
+ * cookie for normal world to free it. Returns false if the pool is empty.
+ */
+bool tee_fs_rpc_cache_drain(uint64_t *cookie);
+
+void tee_fs_rpc_cache_get_stats(struct tee_fs_rpc_pool_stats *stats);
 #else
 static inline void tee_fs_rpc_cache_clear(
 			struct thread_specific_data *tsd __unused)
 {
 }
+
+static inline bool tee_fs_rpc_cache_drain(uint64_t *cookie __unused)
+{
+	return false;
+}
+
+static inline void tee_fs_rpc_cache_get_stats(
+			struct tee_fs_rpc_pool_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+}
 #endif
 
 /*
  * Returns a pointer to the cached FS RPC memory. Each thread has a unique
- * cache. The pointer is guaranteed to point to a large enough area or to
- * be NULL.
+ * cache, taken from a pool shared by all threads when possible. The
+ * pointer is guaranteed to point to a large enough area or to be NULL.
  */
 void *tee_fs_rpc_cache_alloc(size_t size, struct mobj **mobj, uint64_t *cookie);
 
@@ -14,6 +14,7 @@
 
 struct tee_obj {
 	TAILQ_ENTRY(tee_obj) link;
+	uint32_t id;		/* handle of the object as seen by the TA */
 	TEE_ObjectInfo info;
 	bool busy;		/* true if used by an operation */
 	uint32_t have_attrs;	/* bitfield identifying set properties */
@@ -24,7 +25,7 @@ struct tee_obj {
 	uint32_t flags;		/* permission flags for persistent objects */
 };
 
-void tee_obj_add(struct user_ta_ctx *utc, struct tee_obj *o);
+TEE_Result tee_obj_add(struct user_ta_ctx *utc, struct tee_obj *o);
 
 TEE_Result tee_obj_get(struct user_ta_ctx *utc, uint32_t obj_id,
 		       struct tee_obj **obj);
@@ -10,6 +10,7 @@
 #include <tee/tee_obj.h>
 
 struct user_ta_ctx;
+struct tee_cryp_state;
 
 TEE_Result syscall_cryp_obj_get_info(unsigned long obj, TEE_ObjectInfo *info);
 TEE_Result syscall_cryp_obj_restrict_usage(unsigned long obj,
@@ -36,6 +37,10 @@ TEE_Result syscall_cryp_state_copy(unsigned long dst, unsigned long src);
 TEE_Result syscall_cryp_state_free(unsigned long state);
 void tee_svc_cryp_free_states(struct user_ta_ctx *utc);
 
+/* Looks up the crypto state of a TA by the id the TA uses */
+TEE_Result tee_cryp_state_get(struct user_ta_ctx *utc, uint32_t state_id,
+			      struct tee_cryp_state **state);
+
 /* iv and iv_len are ignored for hash algorithms */
 TEE_Result syscall_hash_init(unsigned long state, const void *iv,
 			size_t iv_len);
@@ -63,6 +63,8 @@ TEE_Result syscall_storage_obj_trunc(unsigned long obj, size_t len);
 TEE_Result syscall_storage_obj_seek(unsigned long obj, int32_t offset,
 				    unsigned long whence);
 
+TEE_Result syscall_storage_obj_sync(unsigned long obj);
+
 void tee_svc_storage_close_all_enum(struct user_ta_ctx *utc);
 
 void tee_svc_storage_init(void);
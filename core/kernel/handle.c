@@ -14,66 +14,123 @@
  */
 #define HANDLE_DB_INITIAL_MAX_PTRS	4
 
+#define HANDLE_MAX_PTRS		(1U << HANDLE_INDEX_BITS)
+#define HANDLE_INDEX_MASK	(HANDLE_MAX_PTRS - 1)
+/* Keeps handles positive */
+#define HANDLE_GEN_MASK		((1U << (31 - HANDLE_INDEX_BITS)) - 1)
+
 void handle_db_destroy(struct handle_db *db)
 {
 	if (db) {
 		free(db->ptrs);
+		free(db->gens);
+		free(db->next_free);
 		db->ptrs = NULL;
+		db->gens = NULL;
+		db->next_free = NULL;
 		db->max_ptrs = 0;
+		db->free_head = 0;
 	}
 }
 
-int handle_get(struct handle_db *db, void *ptr)
+static int make_handle(struct handle_db *db, size_t n)
+{
+	return n | ((db->gens[n] & HANDLE_GEN_MASK) << HANDLE_INDEX_BITS);
+}
+
+/* Returns the slot of a handle if it's valid, else -1 */
+static int handle_to_slot(struct handle_db *db, int handle)
 {
 	size_t n;
-	void *p;
-	size_t new_max_ptrs;
 
-	if (!db || !ptr)
+	if (!db || handle < 0)
 		return -1;
 
-	/* Try to find an empty location */
-	for (n = 0; n < db->max_ptrs; n++) {
-		if (!db->ptrs[n]) {
-			db->ptrs[n] = ptr;
-			return n;
-		}
-	}
+	n = handle & HANDLE_INDEX_MASK;
+	if (n >= db->max_ptrs || !db->ptrs[n] || make_handle(db, n) != handle)
+		return -1;
+
+	return n;
+}
+
+/* Called when there's no free slot, links the new slots as free */
+static int grow(struct handle_db *db)
+{
+	size_t new_max_ptrs;
+	void *p;
+	size_t n;
 
-	/* No location available, grow the ptrs array */
 	if (db->max_ptrs)
 		new_max_ptrs = db->max_ptrs * 2;
 	else
 		new_max_ptrs = HANDLE_DB_INITIAL_MAX_PTRS;
+	if (new_max_ptrs > HANDLE_MAX_PTRS)
+		return -1;
+
 	p = realloc(db->ptrs, new_max_ptrs * sizeof(void *));
 	if (!p)
 		return -1;
 	db->ptrs = p;
+	p = realloc(db->gens, new_max_ptrs * sizeof(uint32_t));
+	if (!p)
+		return -1;
+	db->gens = p;
+	p = realloc(db->next_free, new_max_ptrs * sizeof(uint32_t));
+	if (!p)
+		return -1;
+	db->next_free = p;
+
 	memset(db->ptrs + db->max_ptrs, 0,
 	       (new_max_ptrs - db->max_ptrs) * sizeof(void *));
+	memset(db->gens + db->max_ptrs, 0,
+	       (new_max_ptrs - db->max_ptrs) * sizeof(uint32_t));
+	for (n = db->max_ptrs; n < new_max_ptrs; n++)
+		db->next_free[n] = n + 1;
+
+	/* The free list was empty, so free_head is the first new slot */
 	db->max_ptrs = new_max_ptrs;
+	return 0;
+}
 
-	/* Since n stopped at db->max_ptrs there is an empty location there */
+int handle_get(struct handle_db *db, void *ptr)
+{
+	size_t n;
+
+	if (!db || !ptr)
+		return -1;
+
+	/* No location available, grow the arrays */
+	if (db->free_head == db->max_ptrs && grow(db))
+		return -1;
+
+	n = db->free_head;
+	db->free_head = db->next_free[n];
 	db->ptrs[n] = ptr;
-	return n;
+	return make_handle(db, n);
 }
 
 void *handle_put(struct handle_db *db, int handle)
 {
+	int n = handle_to_slot(db, handle);
 	void *p;
 
-	if (!db || handle < 0 || (size_t)handle >= db->max_ptrs)
+	if (n < 0)
 		return NULL;
 
-	p = db->ptrs[handle];
-	db->ptrs[handle] = NULL;
+	p = db->ptrs[n];
+	db->ptrs[n] = NULL;
+	db->gens[n]++;
+	db->next_free[n] = db->free_head;
+	db->free_head = n;
 	return p;
 }
 
 void *handle_lookup(struct handle_db *db, int handle)
 {
-	if (!db || handle < 0 || (size_t)handle >= db->max_ptrs)
+	int n = handle_to_slot(db, handle);
+
+	if (n < 0)
 		return NULL;
 
-	return db->ptrs[handle];
+	return db->ptrs[n];
 }
@@ -10,6 +10,8 @@
 #include <string.h>
 #include <arm.h>
 #include <assert.h>
+#include <atomic.h>
+#include <initcall.h>
 #include <kernel/mutex.h>
 #include <kernel/panic.h>
 #include <kernel/pseudo_ta.h>
@@ -31,11 +33,44 @@
 #include <utee_types.h>
 #include <util.h>
 
-/* This mutex protects the critical section in tee_ta_init_session */
+/*
+ * Locking in the TA manager, locks further down in the list may be taken
+ * while holding one further up but not the other way around:
+ * - tee_ta_mutex serializes loading of TAs in tee_ta_init_session(), so a
+ *   single instance TA is only loaded once. Nothing else waits for it.
+ * - tee_ctxes_mutex protects tee_ctxes and the ref_count of the contexts.
+ *   It's read locked to look up a context by UUID, a session taking a
+ *   reference on the context then updates ref_count atomically.
+ * - Per context busy_mu, per session bucket mutexes, open_sessions_mutex
+ *   and the single-instance lock are taken on their own.
+ */
 struct mutex tee_ta_mutex = MUTEX_INITIALIZER;
 struct tee_ta_ctx_head tee_ctxes = TAILQ_HEAD_INITIALIZER(tee_ctxes);
+static struct mutex tee_ctxes_mutex = MUTEX_INITIALIZER;
+
+/* Protects the open_sessions lists */
+static struct mutex open_sessions_mutex = MUTEX_INITIALIZER;
+
+#if !CFG_TA_SESSION_HASH_SIZE || \
+	(CFG_TA_SESSION_HASH_SIZE & (CFG_TA_SESSION_HASH_SIZE - 1))
+#error CFG_TA_SESSION_HASH_SIZE must be a power of two
+#endif
+
+/*
+ * Open sessions are indexed by id in a hash table, in addition to the
+ * open_sessions list they belong to. The mutex of a bucket protects the
+ * sessions hashed to the bucket: the bucket list as well as ref_count,
+ * lock_thread and unlink of each session.
+ */
+struct session_bucket {
+	struct mutex mu;
+	struct tee_ta_session_head sessions;
+};
+
+static struct session_bucket session_buckets[CFG_TA_SESSION_HASH_SIZE];
 
 #ifndef CFG_CONCURRENT_SINGLE_INSTANCE_TA
+static struct mutex tee_ta_single_instance_mutex = MUTEX_INITIALIZER;
 static struct condvar tee_ta_cv = CONDVAR_INITIALIZER;
 static int tee_ta_single_instance_thread = THREAD_ID_INVALID;
 static size_t tee_ta_single_instance_count;
@@ -57,22 +92,27 @@ static bool has_single_instance_lock(void)
 #else
 static void lock_single_instance(void)
 {
-	/* Requires tee_ta_mutex to be held */
+	mutex_lock(&tee_ta_single_instance_mutex);
+
 	if (tee_ta_single_instance_thread != thread_get_id()) {
 		/* Wait until the single-instance lock is available. */
 		while (tee_ta_single_instance_thread != THREAD_ID_INVALID)
-			condvar_wait(&tee_ta_cv, &tee_ta_mutex);
+			condvar_wait(&tee_ta_cv,
+				     &tee_ta_single_instance_mutex);
 
 		tee_ta_single_instance_thread = thread_get_id();
 		assert(tee_ta_single_instance_count == 0);
 	}
 
 	tee_ta_single_instance_count++;
+
+	mutex_unlock(&tee_ta_single_instance_mutex);
 }
 
 static void unlock_single_instance(void)
 {
-	/* Requires tee_ta_mutex to be held */
+	mutex_lock(&tee_ta_single_instance_mutex);
+
 	assert(tee_ta_single_instance_thread == thread_get_id());
 	assert(tee_ta_single_instance_count > 0);
 
@@ -81,11 +121,16 @@ static void unlock_single_instance(void)
 		tee_ta_single_instance_thread = THREAD_ID_INVALID;
 		condvar_signal(&tee_ta_cv);
 	}
+
+	mutex_unlock(&tee_ta_single_instance_mutex);
 }
 
 static bool has_single_instance_lock(void)
 {
-	/* Requires tee_ta_mutex to be held */
+	/*
+	 * Only the owner sets the value to its own id, or changes it from
+	 * its own id, so the owner can check it without the mutex.
+	 */
 	return tee_ta_single_instance_thread == thread_get_id();
 }
 #endif
@@ -97,35 +142,36 @@ static bool tee_ta_try_set_busy(struct tee_ta_ctx *ctx)
 	if (ctx->flags & TA_FLAG_CONCURRENT)
 		return true;
 
-	mutex_lock(&tee_ta_mutex);
-
 	if (ctx->flags & TA_FLAG_SINGLE_INSTANCE)
 		lock_single_instance();
 
+	mutex_lock(&ctx->busy_mu);
+
 	if (has_single_instance_lock()) {
-		if (ctx->busy) {
-			/*
-			 * We're holding the single-instance lock and the
-			 * TA is busy, as waiting now would only cause a
-			 * dead-lock, we release the lock and return false.
-			 */
+		/*
+		 * We're holding the single-instance lock and if the TA is
+		 * busy waiting now would only cause a dead-lock, we
+		 * release the lock below and return false.
+		 */
+		if (ctx->busy)
 			rc = false;
-			if (ctx->flags & TA_FLAG_SINGLE_INSTANCE)
-				unlock_single_instance();
-		}
 	} else {
 		/*
 		 * We're not holding the single-instance lock, we're free to
 		 * wait for the TA to become available.
 		 */
 		while (ctx->busy)
-			condvar_wait(&ctx->busy_cv, &tee_ta_mutex);
+			condvar_wait(&ctx->busy_cv, &ctx->busy_mu);
 	}
 
 	/* Either it's already true or we should set it to true */
 	ctx->busy = true;
 
-	mutex_unlock(&tee_ta_mutex);
+	mutex_unlock(&ctx->busy_mu);
+
+	if (!rc && (ctx->flags & TA_FLAG_SINGLE_INSTANCE))
+		unlock_single_instance();
+
 	return rc;
 }
 
@@ -140,17 +186,39 @@ static void tee_ta_clear_busy(struct tee_ta_ctx *ctx)
 	if (ctx->flags & TA_FLAG_CONCURRENT)
 		return;
 
-	mutex_lock(&tee_ta_mutex);
+	mutex_lock(&ctx->busy_mu);
 
 	assert(ctx->busy);
 	ctx->busy = false;
 	condvar_signal(&ctx->busy_cv);
 
+	mutex_unlock(&ctx->busy_mu);
+
 	if (ctx->flags & TA_FLAG_SINGLE_INSTANCE)
 		unlock_single_instance();
+}
+
+static struct session_bucket *session_bucket(uint32_t id)
+{
+	/* Ids are heap addresses, mix in the upper bits */
+	uint32_t h = (id >> 3) * 0x9e3779b1;
+
+	return session_buckets + ((h ^ (h >> 16)) &
+				  (CFG_TA_SESSION_HASH_SIZE - 1));
+}
+
+static TEE_Result init_session_buckets(void)
+{
+	size_t n;
+
+	for (n = 0; n < ARRAY_SIZE(session_buckets); n++) {
+		mutex_init(&session_buckets[n].mu);
+		TAILQ_INIT(&session_buckets[n].sessions);
+	}
 
-	mutex_unlock(&tee_ta_mutex);
+	return TEE_SUCCESS;
 }
+service_init(init_session_buckets);
 
 static void dec_session_ref_count(struct tee_ta_session *s)
 {
@@ -162,7 +230,9 @@ static void dec_session_ref_count(struct tee_ta_session *s)
 
 void tee_ta_put_session(struct tee_ta_session *s)
 {
-	mutex_lock(&tee_ta_mutex);
+	struct session_bucket *b = session_bucket((vaddr_t)s);
+
+	mutex_lock(&b->mu);
 
 	if (s->lock_thread == thread_get_id()) {
 		s->lock_thread = THREAD_ID_INVALID;
@@ -170,16 +240,17 @@ void tee_ta_put_session(struct tee_ta_session *s)
 	}
 	dec_session_ref_count(s);
 
-	mutex_unlock(&tee_ta_mutex);
+	mutex_unlock(&b->mu);
 }
 
-static struct tee_ta_session *find_session(uint32_t id,
-			struct tee_ta_session_head *open_sessions)
+/* Called with the mutex of @b held */
+static struct tee_ta_session *find_session(struct session_bucket *b,
+			uint32_t id, struct tee_ta_session_head *open_sessions)
 {
 	struct tee_ta_session *s;
 
-	TAILQ_FOREACH(s, open_sessions, link) {
-		if ((vaddr_t)s == id)
+	TAILQ_FOREACH(s, &b->sessions, link_hash) {
+		if ((vaddr_t)s == id && s->open_sessions == open_sessions)
 			return s;
 	}
 	return NULL;
@@ -188,12 +259,13 @@ static struct tee_ta_session *find_session(uint32_t id,
 struct tee_ta_session *tee_ta_get_session(uint32_t id, bool exclusive,
 			struct tee_ta_session_head *open_sessions)
 {
+	struct session_bucket *b = session_bucket(id);
 	struct tee_ta_session *s;
 
-	mutex_lock(&tee_ta_mutex);
+	mutex_lock(&b->mu);
 
 	while (true) {
-		s = find_session(id, open_sessions);
+		s = find_session(b, id, open_sessions);
 		if (!s)
 			break;
 		if (s->unlink) {
@@ -207,7 +279,7 @@ struct tee_ta_session *tee_ta_get_session(uint32_t id, bool exclusive,
 		assert(s->lock_thread != thread_get_id());
 
 		while (s->lock_thread != THREAD_ID_INVALID && !s->unlink)
-			condvar_wait(&s->lock_cv, &tee_ta_mutex);
+			condvar_wait(&s->lock_cv, &b->mu);
 
 		if (s->unlink) {
 			dec_session_ref_count(s);
@@ -219,14 +291,26 @@ struct tee_ta_session *tee_ta_get_session(uint32_t id, bool exclusive,
 		break;
 	}
 
-	mutex_unlock(&tee_ta_mutex);
+	mutex_unlock(&b->mu);
 	return s;
 }
 
+/* Makes the session visible to tee_ta_get_session() */
+static void tee_ta_link_session(struct tee_ta_session *s)
+{
+	struct session_bucket *b = session_bucket((vaddr_t)s);
+
+	mutex_lock(&b->mu);
+	TAILQ_INSERT_TAIL(&b->sessions, s, link_hash);
+	mutex_unlock(&b->mu);
+}
+
 static void tee_ta_unlink_session(struct tee_ta_session *s,
 			struct tee_ta_session_head *open_sessions)
 {
-	mutex_lock(&tee_ta_mutex);
+	struct session_bucket *b = session_bucket((vaddr_t)s);
+
+	mutex_lock(&b->mu);
 
 	assert(s->ref_count >= 1);
 	assert(s->lock_thread == thread_get_id());
@@ -236,16 +320,23 @@ static void tee_ta_unlink_session(struct tee_ta_session *s,
 	condvar_broadcast(&s->lock_cv);
 
 	while (s->ref_count != 1)
-		condvar_wait(&s->refc_cv, &tee_ta_mutex);
+		condvar_wait(&s->refc_cv, &b->mu);
 
-	TAILQ_REMOVE(open_sessions, s, link);
+	TAILQ_REMOVE(&b->sessions, s, link_hash);
 
-	mutex_unlock(&tee_ta_mutex);
+	mutex_unlock(&b->mu);
+
+	mutex_lock(&open_sessions_mutex);
+	TAILQ_REMOVE(open_sessions, s, link);
+	mutex_unlock(&open_sessions_mutex);
 }
 
 /*
  * tee_ta_context_find - Find TA in session list based on a UUID (input)
- * Returns a pointer to the session
+ * Returns a pointer to the session. Called with tee_ctxes_mutex held.
+ *
+ * There's one context per loaded TA, only a handful, so a list walked
+ * under a read lock is kept rather than an index by UUID.
  */
 static struct tee_ta_ctx *tee_ta_context_find(const TEE_UUID *uuid)
 {
@@ -413,7 +504,7 @@ TEE_Result tee_ta_close_session(struct tee_ta_session *csess,
 
 	tee_ta_clear_busy(ctx);
 
-	mutex_lock(&tee_ta_mutex);
+	mutex_lock(&tee_ctxes_mutex);
 
 	if (ctx->ref_count <= 0)
 		panic();
@@ -425,21 +516,25 @@ TEE_Result tee_ta_close_session(struct tee_ta_session *csess,
 		DMSG("Destroy TA ctx");
 
 		TAILQ_REMOVE(&tee_ctxes, ctx, link);
-		mutex_unlock(&tee_ta_mutex);
+		mutex_unlock(&tee_ctxes_mutex);
 
 		condvar_destroy(&ctx->busy_cv);
+		mutex_destroy(&ctx->busy_mu);
 
 		pgt_flush_ctx(ctx);
 		ctx->ops->destroy(ctx);
 	} else
-		mutex_unlock(&tee_ta_mutex);
+		mutex_unlock(&tee_ctxes_mutex);
 
 	return TEE_SUCCESS;
 }
 
+/* Called with tee_ctxes_mutex read locked */
 static TEE_Result tee_ta_init_session_with_context(struct tee_ta_ctx *ctx,
 			struct tee_ta_session *s)
 {
+	uint32_t ref_count = 0;
+
 	/*
 	 * If TA isn't single instance it should be loaded as new
 	 * instance instead of doing anything with this instance.
@@ -453,16 +548,54 @@ static TEE_Result tee_ta_init_session_with_context(struct tee_ta_ctx *ctx,
 	 * The TA is single instance, if it isn't multi session we
 	 * can't create another session unless its reference is zero
 	 */
-	if (!(ctx->flags & TA_FLAG_MULTI_SESSION) && ctx->ref_count)
-		return TEE_ERROR_BUSY;
+	if (!(ctx->flags & TA_FLAG_MULTI_SESSION)) {
+		/* The compare and swap may fail spuriously, retry then */
+		while (!atomic_cas_u32(&ctx->ref_count, &ref_count, 1))
+			if (ref_count)
+				return TEE_ERROR_BUSY;
+	} else {
+		atomic_inc32(&ctx->ref_count);
+	}
 
 	DMSG("Re-open TA %pUl", (void *)&ctx->uuid);
 
-	ctx->ref_count++;
 	s->ctx = ctx;
 	return TEE_SUCCESS;
 }
 
+static TEE_Result tee_ta_init_session_with_loaded_ctx(const TEE_UUID *uuid,
+			struct tee_ta_session *s)
+{
+	TEE_Result res = TEE_ERROR_ITEM_NOT_FOUND;
+	struct tee_ta_ctx *ctx;
+
+	mutex_read_lock(&tee_ctxes_mutex);
+	ctx = tee_ta_context_find(uuid);
+	if (ctx)
+		res = tee_ta_init_session_with_context(ctx, s);
+	mutex_read_unlock(&tee_ctxes_mutex);
+
+	return res;
+}
+
+#ifdef CFG_WITH_STATS
+void tee_ta_get_ctxes_mutex_stats(struct mutex_stats *stats)
+{
+	mutex_get_stats(&tee_ctxes_mutex, stats);
+}
+#endif
+
+/* Makes a newly loaded TA visible to tee_ta_context_find() */
+static void tee_ta_register_ctx(struct tee_ta_ctx *ctx)
+{
+	mutex_init(&ctx->busy_mu);
+	condvar_init(&ctx->busy_cv);
+
+	mutex_lock(&tee_ctxes_mutex);
+	TAILQ_INSERT_TAIL(&tee_ctxes, ctx, link);
+	mutex_unlock(&tee_ctxes_mutex);
+}
+
 
 static TEE_Result tee_ta_init_session(TEE_ErrorOrigin *err,
 				struct tee_ta_session_head *open_sessions,
@@ -470,7 +603,6 @@ static TEE_Result tee_ta_init_session(TEE_ErrorOrigin *err,
 				struct tee_ta_session **sess)
 {
 	TEE_Result res;
-	struct tee_ta_ctx *ctx;
 	struct tee_ta_session *s = calloc(1, sizeof(struct tee_ta_session));
 
 	*err = TEE_ORIGIN_TEE;
@@ -482,43 +614,43 @@ static TEE_Result tee_ta_init_session(TEE_ErrorOrigin *err,
 	condvar_init(&s->lock_cv);
 	s->lock_thread = THREAD_ID_INVALID;
 	s->ref_count = 1;
-
-
-	/*
-	 * We take the global TA mutex here and hold it while doing
-	 * RPC to load the TA. This big critical section should be broken
-	 * down into smaller pieces.
-	 */
-
-
-	mutex_lock(&tee_ta_mutex);
-	TAILQ_INSERT_TAIL(open_sessions, s, link);
+	s->open_sessions = open_sessions;
 
 	/* Look for already loaded TA */
-	ctx = tee_ta_context_find(uuid);
-	if (ctx) {
-		res = tee_ta_init_session_with_context(ctx, s);
-		if (res == TEE_SUCCESS || res != TEE_ERROR_ITEM_NOT_FOUND)
-			goto out;
-	}
-
-	/* Look for pseudo TA */
-	res = tee_ta_init_pseudo_ta_session(uuid, s);
-	if (res == TEE_SUCCESS || res != TEE_ERROR_ITEM_NOT_FOUND)
-		goto out;
+	res = tee_ta_init_session_with_loaded_ctx(uuid, s);
+	if (res == TEE_ERROR_ITEM_NOT_FOUND) {
+		/*
+		 * Hold tee_ta_mutex while doing RPC to load the TA, look
+		 * again in case another thread has just loaded it.
+		 */
+		mutex_lock(&tee_ta_mutex);
+
+		res = tee_ta_init_session_with_loaded_ctx(uuid, s);
+		if (res == TEE_ERROR_ITEM_NOT_FOUND) {
+			/* Look for pseudo TA */
+			res = tee_ta_init_pseudo_ta_session(uuid, s);
+			/* Look for user TA */
+			if (res == TEE_ERROR_ITEM_NOT_FOUND)
+				res = tee_ta_init_user_ta_session(uuid, s);
+			if (res == TEE_SUCCESS)
+				tee_ta_register_ctx(s->ctx);
+		}
 
-	/* Look for user TA */
-	res = tee_ta_init_user_ta_session(uuid, s);
+		mutex_unlock(&tee_ta_mutex);
+	}
 
-out:
-	if (res == TEE_SUCCESS) {
-		*sess = s;
-	} else {
-		TAILQ_REMOVE(open_sessions, s, link);
+	if (res != TEE_SUCCESS) {
 		free(s);
+		return res;
 	}
-	mutex_unlock(&tee_ta_mutex);
-	return res;
+
+	mutex_lock(&open_sessions_mutex);
+	TAILQ_INSERT_TAIL(open_sessions, s, link);
+	mutex_unlock(&open_sessions_mutex);
+
+	tee_ta_link_session(s);
+	*sess = s;
+	return TEE_SUCCESS;
 }
 
 TEE_Result tee_ta_open_session(TEE_ErrorOrigin *err,
@@ -261,6 +261,10 @@ int sha256_process(hash_state * md, const unsigned char *in, unsigned long inlen
 int sha256_done(hash_state * md, unsigned char *hash);
 int sha256_test(void);
 extern const struct ltc_hash_descriptor sha256_desc;
+#if defined(LTC_SHA256_ARM32_CE) || defined(LTC_SHA256_ARM64_CE)
+int sha256_ce_multi(const unsigned char *in, unsigned long stride,
+                    const size_t *inlen, unsigned long num, unsigned char *out);
+#endif
 
 #ifdef LTC_SHA224
 #ifndef LTC_SHA256
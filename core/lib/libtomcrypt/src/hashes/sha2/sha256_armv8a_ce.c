@@ -70,21 +70,24 @@ const struct ltc_hash_descriptor sha256_desc =
 /* Implemented in assembly */
 int sha256_ce_transform(ulong32 *state, unsigned char *buf, int blocks);
 
+/* Caller must have enabled the FPU */
+static int sha256_compress_nblocks_nofpu(hash_state *md, unsigned char *buf,
+                                         int blocks)
+{
+    sha256_ce_transform(md->sha256.state, buf, blocks);
+    return CRYPT_OK;
+}
+
 static int sha256_compress_nblocks(hash_state *md, unsigned char *buf, int blocks)
 {
     struct tomcrypt_arm_neon_state state;
 
     tomcrypt_arm_neon_enable(&state);
-    sha256_ce_transform(md->sha256.state, buf, blocks);
+    sha256_compress_nblocks_nofpu(md, buf, blocks);
     tomcrypt_arm_neon_disable(&state);
     return CRYPT_OK;
 }
 
-static int sha256_compress(hash_state *md, unsigned char *buf)
-{
-   return sha256_compress_nblocks(md, buf, 1);
-}
-
 /**
    Initialize the hash state
    @param md   The hash state you wish to initialize
@@ -116,13 +119,12 @@ int sha256_init(hash_state * md)
 */
 HASH_PROCESS_NBLOCKS(sha256_process, sha256_compress_nblocks, sha256, 64)
 
-/**
-   Terminate the hash to get the digest
-   @param md  The hash state
-   @param out [out] The destination of the hash (32 bytes)
-   @return CRYPT_OK if successful
-*/
-int sha256_done(hash_state * md, unsigned char *out)
+static HASH_PROCESS_NBLOCKS(sha256_process_nofpu, sha256_compress_nblocks_nofpu,
+                            sha256, 64)
+
+static int sha256_done_nblocks(hash_state *md, unsigned char *out,
+                               int (*compress_n)(hash_state *, unsigned char *,
+                                                 int))
 {
     int i;
 
@@ -148,7 +150,7 @@ int sha256_done(hash_state * md, unsigned char *out)
         while (md->sha256.curlen < 64) {
             md->sha256.buf[md->sha256.curlen++] = (unsigned char)0;
         }
-        sha256_compress(md, md->sha256.buf);
+        compress_n(md, md->sha256.buf, 1);
         md->sha256.curlen = 0;
     }
 
@@ -159,7 +161,7 @@ int sha256_done(hash_state * md, unsigned char *out)
 
     /* store length */
     STORE64H(md->sha256.length, md->sha256.buf+56);
-    sha256_compress(md, md->sha256.buf);
+    compress_n(md, md->sha256.buf, 1);
 
     /* copy output */
     for (i = 0; i < 8; i++) {
@@ -171,6 +173,53 @@ int sha256_done(hash_state * md, unsigned char *out)
     return CRYPT_OK;
 }
 
+/**
+   Terminate the hash to get the digest
+   @param md  The hash state
+   @param out [out] The destination of the hash (32 bytes)
+   @return CRYPT_OK if successful
+*/
+int sha256_done(hash_state * md, unsigned char *out)
+{
+    return sha256_done_nblocks(md, out, sha256_compress_nblocks);
+}
+
+/**
+   Hash several independent messages, enabling the FPU only once
+   @param in      The first message to hash
+   @param stride  Distance between the start of two messages (octets)
+   @param inlen   The lengths of the messages (octets)
+   @param num     The number of messages
+   @param out     [out] The destination of the hashes (32 bytes each)
+   @return CRYPT_OK if successful
+*/
+int sha256_ce_multi(const unsigned char *in, unsigned long stride,
+                    const size_t *inlen, unsigned long num, unsigned char *out)
+{
+    struct tomcrypt_arm_neon_state state;
+    hash_state md;
+    unsigned long n;
+    int err = CRYPT_OK;
+
+    LTC_ARGCHK(in != NULL);
+    LTC_ARGCHK(inlen != NULL);
+    LTC_ARGCHK(out != NULL);
+
+    tomcrypt_arm_neon_enable(&state);
+    for (n = 0; n < num; n++) {
+        sha256_init(&md);
+        err = sha256_process_nofpu(&md, in + n * stride, inlen[n]);
+        if (err != CRYPT_OK)
+            break;
+        err = sha256_done_nblocks(&md, out + n * 32,
+                                  sha256_compress_nblocks_nofpu);
+        if (err != CRYPT_OK)
+            break;
+    }
+    tomcrypt_arm_neon_disable(&state);
+    return err;
+}
+
 /**
   Self-test the hash
   @return CRYPT_OK if successful, CRYPT_NOP if self-tests have been disabled
@@ -411,6 +411,38 @@ TEE_Result crypto_hash_final(void *ctx, uint32_t algo, uint8_t *digest,
 
 	return TEE_SUCCESS;
 }
+
+TEE_Result crypto_hash_multi(void *ctx, uint32_t algo, const uint8_t *data,
+			     size_t stride, const size_t *len, size_t num,
+			     uint8_t *digest, size_t digest_len)
+{
+	TEE_Result res;
+	size_t n;
+
+#if defined(CFG_CRYPTO_SHA256_ARM32_CE) || defined(CFG_CRYPTO_SHA256_ARM64_CE)
+	/* Keep the FPU enabled for all the messages */
+	if (algo == TEE_ALG_SHA256 && digest_len == TEE_SHA256_HASH_SIZE) {
+		if (sha256_ce_multi(data, stride, len, num, digest) != CRYPT_OK)
+			return TEE_ERROR_BAD_STATE;
+		return TEE_SUCCESS;
+	}
+#endif
+
+	for (n = 0; n < num; n++) {
+		res = crypto_hash_init(ctx, algo);
+		if (res != TEE_SUCCESS)
+			return res;
+		res = crypto_hash_update(ctx, algo, data + n * stride, len[n]);
+		if (res != TEE_SUCCESS)
+			return res;
+		res = crypto_hash_final(ctx, algo, digest + n * digest_len,
+					digest_len);
+		if (res != TEE_SUCCESS)
+			return res;
+	}
+
+	return TEE_SUCCESS;
+}
 #endif /*_CFG_CRYPTO_WITH_HASH*/
 
 /******************************************************************************
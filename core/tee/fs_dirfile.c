@@ -10,13 +10,45 @@
 #include <string.h>
 #include <tee/fs_dirfile.h>
 #include <types_ext.h>
+#include <util.h>
 
+#define DENT_IDX_FREE		-2
+#define DENT_IDX_END		-1
+#define DENT_IDX_MIN_BUCKETS	16
+
+/*
+ * struct dent_idx - index entry of a dirfile entry
+ * @hash:	hash of TA UUID and object id of the entry
+ * @next:	next entry in the same bucket, DENT_IDX_END if last or
+ *		DENT_IDX_FREE if the entry isn't in use
+ */
+struct dent_idx {
+	uint32_t hash;
+	int next;
+};
+
+/*
+ * Entries in use are indexed by the hash of TA UUID and object id, the
+ * buckets are chained through @idx which is indexed by entry number. A
+ * matching hash is confirmed by reading the entry, so a lookup normally
+ * reads a single entry instead of scanning the dirfile.
+ *
+ * @buckets:	first entry of each bucket or DENT_IDX_END
+ * @nbuckets:	number of buckets, a power of 2
+ * @idx:	array of @nidx index entries
+ * @first_free:	no free entry below this
+ */
 struct tee_fs_dirfile_dirh {
 	const struct tee_fs_dirfile_operations *fops;
 	struct tee_file_handle *fh;
 	int nbits;
 	bitstr_t *files;
 	size_t ndents;
+	int *buckets;
+	size_t nbuckets;
+	struct dent_idx *idx;
+	size_t nidx;
+	size_t first_free;
 };
 
 struct dirfile_entry {
@@ -79,6 +111,136 @@ static bool test_file(struct tee_fs_dirfile_dirh *dirh, int idx)
 	return false;
 }
 
+static uint32_t dent_hash(const TEE_UUID *uuid, const void *oid,
+			  size_t oidlen)
+{
+	const uint8_t *p = (const uint8_t *)uuid;
+	uint32_t h = 2166136261;	/* FNV-1a */
+	size_t n;
+
+	for (n = 0; n < sizeof(*uuid); n++)
+		h = (h ^ p[n]) * 16777619;
+	p = oid;
+	for (n = 0; n < oidlen; n++)
+		h = (h ^ p[n]) * 16777619;
+
+	return h;
+}
+
+static int *dent_idx_bucket(struct tee_fs_dirfile_dirh *dirh, uint32_t hash)
+{
+	return dirh->buckets + (hash & (dirh->nbuckets - 1));
+}
+
+static void dent_idx_link(struct tee_fs_dirfile_dirh *dirh, size_t n)
+{
+	int *b = dent_idx_bucket(dirh, dirh->idx[n].hash);
+
+	dirh->idx[n].next = *b;
+	*b = n;
+}
+
+static TEE_Result dent_idx_rehash(struct tee_fs_dirfile_dirh *dirh,
+				  size_t nbuckets)
+{
+	int *b = malloc(nbuckets * sizeof(*b));
+	size_t n;
+
+	if (!b)
+		return TEE_ERROR_OUT_OF_MEMORY;
+
+	free(dirh->buckets);
+	dirh->buckets = b;
+	dirh->nbuckets = nbuckets;
+	for (n = 0; n < nbuckets; n++)
+		b[n] = DENT_IDX_END;
+
+	for (n = 0; n < dirh->nidx; n++)
+		if (dirh->idx[n].next != DENT_IDX_FREE)
+			dent_idx_link(dirh, n);
+
+	return TEE_SUCCESS;
+}
+
+/* Makes room for index entry @n and keeps the load factor at most 1 */
+static TEE_Result dent_idx_grow(struct tee_fs_dirfile_dirh *dirh, size_t n)
+{
+	size_t nidx = dirh->nidx;
+	size_t nbuckets;
+	void *p;
+
+	if (n < nidx)
+		return TEE_SUCCESS;
+
+	nidx = MAX(n + 1, nidx * 2);
+	p = realloc(dirh->idx, nidx * sizeof(*dirh->idx));
+	if (!p)
+		return TEE_ERROR_OUT_OF_MEMORY;
+	dirh->idx = p;
+	for (; dirh->nidx < nidx; dirh->nidx++)
+		dirh->idx[dirh->nidx].next = DENT_IDX_FREE;
+
+	nbuckets = MAX(dirh->nbuckets, (size_t)DENT_IDX_MIN_BUCKETS);
+	while (nbuckets < nidx)
+		nbuckets *= 2;
+	if (nbuckets == dirh->nbuckets)
+		return TEE_SUCCESS;
+
+	return dent_idx_rehash(dirh, nbuckets);
+}
+
+static void dent_idx_remove(struct tee_fs_dirfile_dirh *dirh, size_t n)
+{
+	int *p;
+
+	if (n >= dirh->nidx || dirh->idx[n].next == DENT_IDX_FREE)
+		return;
+
+	p = dent_idx_bucket(dirh, dirh->idx[n].hash);
+	while (*p != (int)n)
+		p = &dirh->idx[*p].next;
+	*p = dirh->idx[n].next;
+	dirh->idx[n].next = DENT_IDX_FREE;
+
+	if (n < dirh->first_free)
+		dirh->first_free = n;
+}
+
+/* Indexes entry @n, room for it must have been made with dent_idx_grow() */
+static void dent_idx_set(struct tee_fs_dirfile_dirh *dirh, size_t n,
+			 const TEE_UUID *uuid, const void *oid, size_t oidlen)
+{
+	assert(n < dirh->nidx);
+
+	dent_idx_remove(dirh, n);
+	dirh->idx[n].hash = dent_hash(uuid, oid, oidlen);
+	dent_idx_link(dirh, n);
+}
+
+static TEE_Result dent_idx_add(struct tee_fs_dirfile_dirh *dirh, size_t n,
+			       const TEE_UUID *uuid, const void *oid,
+			       size_t oidlen)
+{
+	TEE_Result res = dent_idx_grow(dirh, n);
+
+	if (!res)
+		dent_idx_set(dirh, n, uuid, oid, oidlen);
+
+	return res;
+}
+
+static size_t dent_idx_find_free(struct tee_fs_dirfile_dirh *dirh)
+{
+	size_t n;
+
+	for (n = dirh->first_free; n < dirh->nidx; n++)
+		if (dirh->idx[n].next == DENT_IDX_FREE)
+			break;
+	dirh->first_free = n;
+
+	return MIN(n, dirh->ndents);
+}
+
 static TEE_Result read_dent(struct tee_fs_dirfile_dirh *dirh, int idx,
 			    struct dirfile_entry *dent)
 {
@@ -99,12 +261,30 @@ static TEE_Result write_dent(struct tee_fs_dirfile_dirh *dirh, size_t n,
 {
 	TEE_Result res;
 
+	/*
+	 * Make room in the index before writing, once the entry is written
+	 * it must be indexed or it can't be found any longer.
+	 */
+	if (dent->oidlen) {
+		res = dent_idx_grow(dirh, n);
+		if (res)
+			return res;
+	}
+
 	res = dirh->fops->write(dirh->fh, sizeof(*dent) * n,
 				dent, sizeof(*dent));
-	if (!res && n >= dirh->ndents)
+	if (res)
+		return res;
+
+	if (n >= dirh->ndents)
 		dirh->ndents = n + 1;
 
-	return res;
+	if (dent->oidlen)
+		dent_idx_set(dirh, n, &dent->uuid, dent->oid, dent->oidlen);
+	else
+		dent_idx_remove(dirh, n);
+
+	return TEE_SUCCESS;
 }
 
 TEE_Result tee_fs_dirfile_open(bool create, uint8_t *hash,
@@ -149,6 +329,10 @@ TEE_Result tee_fs_dirfile_open(bool create, uint8_t *hash,
 		res = set_file(dirh, dent.file_number);
 		if (res != TEE_SUCCESS)
 			goto out;
+
+		res = dent_idx_add(dirh, n, &dent.uuid, dent.oid, dent.oidlen);
+		if (res != TEE_SUCCESS)
+			goto out;
 	}
 out:
 	if (!res) {
@@ -165,6 +349,8 @@ void tee_fs_dirfile_close(struct tee_fs_dirfile_dirh *dirh)
 	if (dirh) {
 		dirh->fops->close(dirh->fh);
 		free(dirh->files);
+		free(dirh->buckets);
+		free(dirh->idx);
 		free(dirh);
 	}
 }
@@ -200,35 +386,39 @@ TEE_Result tee_fs_dirfile_find(struct tee_fs_dirfile_dirh *dirh,
 {
 	TEE_Result res;
 	struct dirfile_entry dent;
+	uint32_t hash;
 	int n;
-	int first_free = -1;
 
-	for (n = 0;; n++) {
-		res = read_dent(dirh, n, &dent);
-		if (res == TEE_ERROR_ITEM_NOT_FOUND && !oidlen) {
-			memset(&dent, 0, sizeof(dent));
-			if (first_free != -1)
-				n = first_free;
-			break;
-		}
-		if (res)
-			return res;
+	if (!oidlen) {
+		/* Find a free entry, possibly one past the last entry */
+		memset(&dent, 0, sizeof(dent));
+		n = dent_idx_find_free(dirh);
+		goto out;
+	}
 
-		/* TODO check this loop when oidlen == 0 */
+	if (!dirh->nbuckets)
+		return TEE_ERROR_ITEM_NOT_FOUND;
 
-		if (!dent.oidlen && first_free == -1)
-			first_free = n;
-		if (dent.oidlen != oidlen)
+	hash = dent_hash(uuid, oid, oidlen);
+	for (n = *dent_idx_bucket(dirh, hash); n != DENT_IDX_END;
+	     n = dirh->idx[n].next) {
+		if (dirh->idx[n].hash != hash)
 			continue;
 
-		assert(!oidlen || !dent.oidlen ||
-		       test_file(dirh, dent.file_number));
+		res = read_dent(dirh, n, &dent);
+		if (res)
+			return res;
 
-		if (!memcmp(&dent.uuid, uuid, sizeof(dent.uuid)) &&
+		assert(test_file(dirh, dent.file_number));
+
+		if (dent.oidlen == oidlen &&
+		    !memcmp(&dent.uuid, uuid, sizeof(dent.uuid)) &&
 		    !memcmp(&dent.oid, oid, oidlen))
-			break;
+			goto out;
 	}
 
+	return TEE_ERROR_ITEM_NOT_FOUND;
+out:
 	if (dfh) {
 		dfh->idx = n;
 		dfh->file_number = dent.file_number;
@@ -365,3 +555,37 @@ TEE_Result tee_fs_dirfile_get_next(struct tee_fs_dirfile_dirh *dirh,
 
 	return TEE_SUCCESS;
 }
+
+TEE_Result tee_fs_dirfile_get_next_entry(struct tee_fs_dirfile_dirh *dirh,
+					 int *idx, TEE_UUID *uuid, void *oid,
+					 size_t *oidlen,
+					 struct tee_fs_dirfile_fileh *dfh)
+{
+	TEE_Result res;
+	int i = *idx + 1;
+	struct dirfile_entry dent;
+
+	if (i < 0)
+		i = 0;
+
+	for (;; i++) {
+		res = read_dent(dirh, i, &dent);
+		if (res)
+			return res;
+		if (dent.oidlen)
+			break;
+	}
+
+	if (*oidlen < dent.oidlen)
+		return TEE_ERROR_SHORT_BUFFER;
+
+	memcpy(oid, dent.oid, dent.oidlen);
+	*oidlen = dent.oidlen;
+	*uuid = dent.uuid;
+	dfh->file_number = dent.file_number;
+	memcpy(dfh->hash, dent.hash, sizeof(dent.hash));
+	dfh->idx = i;
+	*idx = i;
+
+	return TEE_SUCCESS;
+}
@@ -81,6 +81,7 @@ struct htree_node {
 	size_t id;
 	bool dirty;
 	bool block_updated;
+	bool verified;
 	struct tee_fs_htree_node_image node;
 	struct htree_node *parent;
 	struct htree_node *child[2];
@@ -95,6 +96,7 @@ struct tee_fs_htree {
 	const TEE_UUID *uuid;
 	const struct tee_fs_htree_storage *stor;
 	void *stor_aux;
+	void *hash_ctx;
 };
 
 struct traverse_arg;
@@ -167,12 +169,87 @@ static TEE_Result rpc_write_head(struct tee_fs_htree *ht, size_t vers,
 			 head, sizeof(*head));
 }
 
-static TEE_Result rpc_write_node(struct tee_fs_htree *ht, size_t node_id,
-				 size_t vers,
-				 const struct tee_fs_htree_node_image *node)
+static size_t rpc_vec_max_elems(size_t elem_size)
 {
-	return rpc_write(ht, TEE_FS_HTREE_TYPE_NODE, node_id - 1, vers,
-			 node, sizeof(*node));
+	size_t n = MIN((size_t)TEE_FS_HTREE_RPC_MAX_ELEMS,
+		       TEE_FS_HTREE_RPC_MAX_SIZE / elem_size);
+
+	return MAX(n, (size_t)1);
+}
+
+/*
+ * Reads @num elements of the same type with a single vectored RPC if
+ * supported by the storage, else one by one. @num must not exceed
+ * rpc_vec_max_elems(@dlen).
+ */
+static TEE_Result rpc_read_vec(struct tee_fs_htree *ht,
+			       enum tee_fs_htree_type type,
+			       const struct tee_fs_htree_rpc_elem *elem,
+			       size_t num, void * const *data, size_t dlen)
+{
+	TEE_Result res = TEE_ERROR_NOT_SUPPORTED;
+	struct tee_fs_rpc_operation op;
+	size_t bytes;
+	void *p;
+	size_t n;
+
+	if (num > 1 && ht->stor->rpc_readv_init)
+		res = ht->stor->rpc_readv_init(ht->stor_aux, &op, type, elem,
+					       num, &p);
+	if (res == TEE_ERROR_NOT_SUPPORTED) {
+		for (n = 0; n < num; n++) {
+			res = rpc_read(ht, type, elem[n].idx, elem[n].vers,
+				       data[n], dlen);
+			if (res != TEE_SUCCESS)
+				return res;
+		}
+		return TEE_SUCCESS;
+	}
+	if (res != TEE_SUCCESS)
+		return res;
+
+	res = ht->stor->rpc_readv_final(&op, &bytes);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	if (bytes != num * dlen)
+		return TEE_ERROR_CORRUPT_OBJECT;
+
+	for (n = 0; n < num; n++)
+		memcpy(data[n], (uint8_t *)p + n * dlen, dlen);
+	return TEE_SUCCESS;
+}
+
+/* The write counterpart of rpc_read_vec() */
+static TEE_Result rpc_write_vec(struct tee_fs_htree *ht,
+				enum tee_fs_htree_type type,
+				const struct tee_fs_htree_rpc_elem *elem,
+				size_t num, const void * const *data,
+				size_t dlen)
+{
+	TEE_Result res = TEE_ERROR_NOT_SUPPORTED;
+	struct tee_fs_rpc_operation op;
+	void *p;
+	size_t n;
+
+	if (num > 1 && ht->stor->rpc_writev_init)
+		res = ht->stor->rpc_writev_init(ht->stor_aux, &op, type, elem,
+						num, &p);
+	if (res == TEE_ERROR_NOT_SUPPORTED) {
+		for (n = 0; n < num; n++) {
+			res = rpc_write(ht, type, elem[n].idx, elem[n].vers,
+					data[n], dlen);
+			if (res != TEE_SUCCESS)
+				return res;
+		}
+		return TEE_SUCCESS;
+	}
+	if (res != TEE_SUCCESS)
+		return res;
+
+	for (n = 0; n < num; n++)
+		memcpy((uint8_t *)p + n * dlen, data[n], dlen);
+	return ht->stor->rpc_writev_final(&op);
 }
 
 static TEE_Result traverse_post_order(struct traverse_arg *targ,
@@ -252,55 +329,6 @@ static struct htree_node *find_node(struct tee_fs_htree *ht, size_t node_id)
 	return NULL;
 }
 
-static TEE_Result get_node(struct tee_fs_htree *ht, bool create,
-			   size_t node_id, struct htree_node **node_ret)
-{
-	struct htree_node *node;
-	struct htree_node *nc;
-	size_t n;
-
-	node = find_closest_node(ht, node_id);
-	if (!node)
-		return TEE_ERROR_GENERIC;
-	if (node->id == node_id)
-		goto ret_node;
-
-	/*
-	 * Trying to read beyond end of file should be caught earlier than
-	 * here.
-	 */
-	if (!create)
-		return TEE_ERROR_GENERIC;
-
-	/*
-	 * Add missing nodes, some nodes may already be there. When we've
-	 * processed the range all nodes up to node_id will be in the tree.
-	 */
-	for (n = node->id + 1; n <= node_id; n++) {
-		node = find_closest_node(ht, n);
-		if (node->id == n)
-			continue;
-		/* Node id n should be a child of node */
-		assert((n >> 1) == node->id);
-		assert(!node->child[n & 1]);
-
-		nc = calloc(1, sizeof(*nc));
-		if (!nc)
-			return TEE_ERROR_OUT_OF_MEMORY;
-		nc->id = n;
-		nc->parent = node;
-		node->child[n & 1] = nc;
-		node = nc;
-	}
-
-	if (node->id > ht->imeta.max_node_id)
-		ht->imeta.max_node_id = node->id;
-
-ret_node:
-	*node_ret = node;
-	return TEE_SUCCESS;
-}
-
 static int get_idx_from_counter(uint32_t counter0, uint32_t counter1)
 {
 	if (!(counter0 & 1)) {
@@ -366,36 +394,96 @@ static TEE_Result init_head_from_data(struct tee_fs_htree *ht,
 	return TEE_SUCCESS;
 }
 
+#ifndef CFG_FS_HTREE_LAZY_VERIFY
 static TEE_Result init_tree_from_data(struct tee_fs_htree *ht)
 {
+	const size_t node_size = sizeof(struct tee_fs_htree_node_image);
+	const size_t max_elems = rpc_vec_max_elems(node_size);
+	struct tee_fs_htree_rpc_elem elem[TEE_FS_HTREE_RPC_MAX_ELEMS];
+	void *data[TEE_FS_HTREE_RPC_MAX_ELEMS];
 	TEE_Result res;
-	struct tee_fs_htree_node_image node_image;
 	struct htree_node *node;
 	struct htree_node *nc;
-	size_t committed_version;
+	size_t first_id;
 	size_t node_id = 2;
+	size_t num;
 
 	while (node_id <= ht->imeta.max_node_id) {
-		node = find_node(ht, node_id >> 1);
-		if (!node)
-			return TEE_ERROR_GENERIC;
-		committed_version = !!(node->node.flags &
-				    HTREE_NODE_COMMITTED_CHILD(node_id & 1));
-
-		res = rpc_read_node(ht, node_id, committed_version,
-				    &node_image);
-		if (res != TEE_SUCCESS)
-			return res;
+		/*
+		 * The committed version of a node is recorded in the
+		 * parent node, so only nodes with a parent read in a
+		 * previous batch can be included in this batch. This
+		 * results in the tree being read level by level.
+		 */
+		first_id = node_id;
+		num = 0;
+		while (node_id <= ht->imeta.max_node_id &&
+		       num < max_elems && (node_id >> 1) < first_id) {
+			node = find_node(ht, node_id >> 1);
+			if (!node)
+				return TEE_ERROR_GENERIC;
+
+			nc = calloc(1, sizeof(*nc));
+			if (!nc)
+				return TEE_ERROR_OUT_OF_MEMORY;
+			nc->id = node_id;
+			nc->parent = node;
+			node->child[node_id & 1] = nc;
+
+			elem[num].idx = node_id - 1;
+			elem[num].vers = !!(node->node.flags &
+				HTREE_NODE_COMMITTED_CHILD(node_id & 1));
+			data[num] = &nc->node;
+			num++;
+			node_id++;
+		}
 
-		res = get_node(ht, true, node_id, &nc);
+		res = rpc_read_vec(ht, TEE_FS_HTREE_TYPE_NODE, elem, num, data,
+				   node_size);
 		if (res != TEE_SUCCESS)
 			return res;
-		nc->node = node_image;
-		node_id++;
 	}
 
 	return TEE_SUCCESS;
 }
+#endif /*!CFG_FS_HTREE_LAZY_VERIFY*/
+
+/*
+ * Assembles the data hashed for @node in @msg, that is the node image
+ * except the hash, followed by @meta if supplied and then the hashes of the
+ * children. Returns the number of bytes stored in @msg.
+ */
+static size_t get_node_hash_msg(struct htree_node *node,
+				struct tee_fs_htree_meta *meta, uint8_t *msg)
+{
+	uint8_t *ndata = (uint8_t *)&node->node + sizeof(node->node.hash);
+	size_t nsize = sizeof(node->node) - sizeof(node->node.hash);
+	size_t n;
+	size_t len = 0;
+
+	memcpy(msg, ndata, nsize);
+	len += nsize;
+
+	if (meta) {
+		memcpy(msg + len, meta, sizeof(*meta));
+		len += sizeof(*meta);
+	}
+
+	for (n = 0; n < ARRAY_SIZE(node->child); n++) {
+		if (node->child[n]) {
+			memcpy(msg + len, node->child[n]->node.hash,
+			       sizeof(node->child[n]->node.hash));
+			len += sizeof(node->child[n]->node.hash);
+		}
+	}
+
+	return len;
+}
+
+#define HTREE_HASH_MSG_MAX_SIZE	(sizeof(struct tee_fs_htree_node_image) - \
+				 TEE_FS_HTREE_HASH_SIZE + \
+				 sizeof(struct tee_fs_htree_meta) + \
+				 2 * TEE_FS_HTREE_HASH_SIZE)
 
 static TEE_Result calc_node_hash(struct htree_node *node,
 				 struct tee_fs_htree_meta *meta, void *ctx,
@@ -403,38 +491,85 @@ static TEE_Result calc_node_hash(struct htree_node *node,
 {
 	TEE_Result res;
 	uint32_t alg = TEE_FS_HTREE_HASH_ALG;
-	uint8_t *ndata = (uint8_t *)&node->node + sizeof(node->node.hash);
-	size_t nsize = sizeof(node->node) - sizeof(node->node.hash);
+	uint8_t msg[HTREE_HASH_MSG_MAX_SIZE];
+	size_t len = get_node_hash_msg(node, meta, msg);
 
 	res = crypto_hash_init(ctx, alg);
 	if (res != TEE_SUCCESS)
 		return res;
 
-	res = crypto_hash_update(ctx, alg, ndata, nsize);
+	res = crypto_hash_update(ctx, alg, msg, len);
 	if (res != TEE_SUCCESS)
 		return res;
 
-	if (meta) {
-		res = crypto_hash_update(ctx, alg, (void *)meta, sizeof(*meta));
-		if (res != TEE_SUCCESS)
-			return res;
-	}
+	return crypto_hash_final(ctx, alg, digest, TEE_FS_HTREE_HASH_SIZE);
+}
 
-	if (node->child[0]) {
-		res = crypto_hash_update(ctx, alg, node->child[0]->node.hash,
-					 sizeof(node->child[0]->node.hash));
-		if (res != TEE_SUCCESS)
-			return res;
-	}
+/*
+ * Node hashes are calculated in batches when the tree is synced, while
+ * nodes are verified one by one as they are loaded. The messages of all
+ * nodes in a batch are assembled in a contiguous buffer and hashed in one
+ * pass with crypto_hash_multi(), which can keep the FPU enabled for the
+ * whole batch when the SHA-256 Crypto Extensions are used.
+ */
+#define HTREE_HASH_BATCH_SIZE	32
 
-	if (node->child[1]) {
-		res = crypto_hash_update(ctx, alg, node->child[1]->node.hash,
-					 sizeof(node->child[1]->node.hash));
-		if (res != TEE_SUCCESS)
-			return res;
+struct hash_batch {
+	void *ctx;
+	size_t num;
+	struct htree_node *node[HTREE_HASH_BATCH_SIZE];
+	size_t len[HTREE_HASH_BATCH_SIZE];
+	uint8_t msg[HTREE_HASH_BATCH_SIZE][HTREE_HASH_MSG_MAX_SIZE];
+	uint8_t digest[HTREE_HASH_BATCH_SIZE][TEE_FS_HTREE_HASH_SIZE];
+};
+
+static TEE_Result hash_batch_alloc(struct hash_batch **hb_ret)
+{
+	TEE_Result res;
+	struct hash_batch *hb = calloc(1, sizeof(*hb));
+
+	if (!hb)
+		return TEE_ERROR_OUT_OF_MEMORY;
+
+	res = crypto_hash_alloc_ctx(&hb->ctx, TEE_FS_HTREE_HASH_ALG);
+	if (res != TEE_SUCCESS) {
+		free(hb);
+		return res;
 	}
 
-	return crypto_hash_final(ctx, alg, digest, TEE_FS_HTREE_HASH_SIZE);
+	*hb_ret = hb;
+	return TEE_SUCCESS;
+}
+
+static void hash_batch_free(struct hash_batch *hb)
+{
+	if (!hb)
+		return;
+	crypto_hash_free_ctx(hb->ctx, TEE_FS_HTREE_HASH_ALG);
+	free(hb);
+}
+
+/* Returns true when the batch is full */
+static bool hash_batch_add(struct hash_batch *hb, struct htree_node *node,
+			   struct tee_fs_htree_meta *meta)
+{
+	assert(hb->num < HTREE_HASH_BATCH_SIZE);
+
+	hb->node[hb->num] = node;
+	hb->len[hb->num] = get_node_hash_msg(node, meta, hb->msg[hb->num]);
+	hb->num++;
+
+	return hb->num == HTREE_HASH_BATCH_SIZE;
+}
+
+static TEE_Result hash_batch_calc(struct hash_batch *hb)
+{
+	if (!hb->num)
+		return TEE_SUCCESS;
+
+	return crypto_hash_multi(hb->ctx, TEE_FS_HTREE_HASH_ALG, hb->msg[0],
+				 sizeof(hb->msg[0]), hb->len, hb->num,
+				 hb->digest[0], sizeof(hb->digest[0]));
 }
 
 static TEE_Result authenc_init(void **ctx_ret, TEE_OperationMode mode,
@@ -566,37 +701,198 @@ static TEE_Result verify_root(struct tee_fs_htree *ht)
 				     sizeof(ht->imeta), &ht->imeta);
 }
 
-static TEE_Result verify_node(struct traverse_arg *targ,
-			      struct htree_node *node)
+/*
+ * Loads the children of @node not loaded yet, the committed version of each
+ * child is recorded in @node.
+ */
+static TEE_Result load_children(struct tee_fs_htree *ht,
+				struct htree_node *node)
+{
+	struct tee_fs_htree_rpc_elem elem[ARRAY_SIZE(node->child)];
+	struct htree_node *nc[ARRAY_SIZE(node->child)];
+	void *data[ARRAY_SIZE(node->child)];
+	TEE_Result res;
+	size_t node_id;
+	size_t num = 0;
+	size_t n;
+
+	for (n = 0; n < ARRAY_SIZE(node->child); n++) {
+		node_id = node->id * 2 + n;
+		if (node_id > ht->imeta.max_node_id)
+			break;
+		if (node->child[n])
+			continue;
+
+		nc[num] = calloc(1, sizeof(*nc[num]));
+		if (!nc[num]) {
+			res = TEE_ERROR_OUT_OF_MEMORY;
+			goto out;
+		}
+		nc[num]->id = node_id;
+		nc[num]->parent = node;
+
+		elem[num].idx = node_id - 1;
+		elem[num].vers = !!(node->node.flags &
+				    HTREE_NODE_COMMITTED_CHILD(n));
+		data[num] = &nc[num]->node;
+		num++;
+	}
+
+	res = rpc_read_vec(ht, TEE_FS_HTREE_TYPE_NODE, elem, num, data,
+			   sizeof(struct tee_fs_htree_node_image));
+out:
+	for (n = 0; n < num; n++) {
+		if (res == TEE_SUCCESS)
+			node->child[nc[n]->id & 1] = nc[n];
+		else
+			free(nc[n]);
+	}
+	return res;
+}
+
+/*
+ * The hash of @node is trusted once its parent is verified, or for the
+ * root node once the header is authenticated. Verifying @node requires
+ * the hashes of its children so they are loaded first, which in turn
+ * makes their hashes trusted.
+ */
+static TEE_Result verify_node(struct tee_fs_htree *ht, struct htree_node *node)
 {
-	void *ctx = targ->arg;
 	TEE_Result res;
 	uint8_t digest[TEE_FS_HTREE_HASH_SIZE];
 
-	if (node->parent)
-		res = calc_node_hash(node, NULL, ctx, digest);
-	else
-		res = calc_node_hash(node, &targ->ht->imeta.meta, ctx, digest);
-	if (res == TEE_SUCCESS &&
-	    buf_compare_ct(digest, node->node.hash, sizeof(digest)))
+	if (node->verified)
+		return TEE_SUCCESS;
+
+	if (!ht->hash_ctx) {
+		res = crypto_hash_alloc_ctx(&ht->hash_ctx,
+					    TEE_FS_HTREE_HASH_ALG);
+		if (res != TEE_SUCCESS)
+			return res;
+	}
+
+	res = load_children(ht, node);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	res = calc_node_hash(node, node->parent ? NULL : &ht->imeta.meta,
+			     ht->hash_ctx, digest);
+	if (res != TEE_SUCCESS)
+		return res;
+	if (buf_compare_ct(digest, node->node.hash, sizeof(digest)))
 		return TEE_ERROR_CORRUPT_OBJECT;
 
-	return res;
+	node->verified = true;
+	return TEE_SUCCESS;
 }
 
+#ifndef CFG_FS_HTREE_LAZY_VERIFY
 static TEE_Result verify_tree(struct tee_fs_htree *ht)
 {
 	TEE_Result res;
-	void *ctx;
+	struct htree_node *node;
+	size_t node_id;
 
-	res = crypto_hash_alloc_ctx(&ctx, TEE_FS_HTREE_HASH_ALG);
+	/*
+	 * All nodes are already loaded so verify_node() doesn't need to
+	 * read anything. Node id order verifies the tree level by level.
+	 */
+	for (node_id = 1; node_id <= ht->imeta.max_node_id; node_id++) {
+		node = find_node(ht, node_id);
+		if (!node)
+			return TEE_ERROR_GENERIC;
+
+		res = verify_node(ht, node);
+		if (res != TEE_SUCCESS)
+			return res;
+	}
+
+	return TEE_SUCCESS;
+}
+#endif /*!CFG_FS_HTREE_LAZY_VERIFY*/
+
+/*
+ * Like find_closest_node(), but all nodes on the path are verified, which
+ * loads nodes from storage as needed.
+ */
+static TEE_Result get_closest_node(struct tee_fs_htree *ht, size_t node_id,
+				   struct htree_node **node_ret)
+{
+	TEE_Result res;
+	struct htree_node *node = &ht->root;
+	struct htree_node *child;
+	size_t level = node_id_to_level(node_id);
+	size_t n;
+
+	/* n = 1 because root node is level 1 */
+	for (n = 1;; n++) {
+		res = verify_node(ht, node);
+		if (res != TEE_SUCCESS)
+			return res;
+		if (n == level)
+			break;
+
+		child = node->child[((node_id >> (level - n - 1)) & 1)];
+		if (!child)
+			break;
+		node = child;
+	}
+
+	*node_ret = node;
+	return TEE_SUCCESS;
+}
+
+static TEE_Result get_node(struct tee_fs_htree *ht, bool create,
+			   size_t node_id, struct htree_node **node_ret)
+{
+	TEE_Result res;
+	struct htree_node *node;
+	struct htree_node *nc;
+	size_t n;
+
+	res = get_closest_node(ht, node_id, &node);
 	if (res != TEE_SUCCESS)
 		return res;
+	if (node->id == node_id)
+		goto ret_node;
 
-	res = htree_traverse_post_order(ht, verify_node, ctx);
-	crypto_hash_free_ctx(ctx, TEE_FS_HTREE_HASH_ALG);
+	/*
+	 * Trying to read beyond end of file should be caught earlier than
+	 * here.
+	 */
+	if (!create)
+		return TEE_ERROR_GENERIC;
 
-	return res;
+	/*
+	 * Add missing nodes, the nodes up to max_node_id are already in
+	 * storage and loaded when needed. When we've processed the range
+	 * all nodes up to node_id will be in the tree.
+	 */
+	for (n = ht->imeta.max_node_id + 1; n <= node_id; n++) {
+		res = get_closest_node(ht, n, &node);
+		if (res != TEE_SUCCESS)
+			return res;
+		/* Node id n should be a child of node */
+		assert((n >> 1) == node->id);
+		assert(!node->child[n & 1]);
+
+		nc = calloc(1, sizeof(*nc));
+		if (!nc)
+			return TEE_ERROR_OUT_OF_MEMORY;
+		nc->id = n;
+		nc->parent = node;
+		/* There's nothing in storage to verify a new node against */
+		nc->verified = true;
+		node->child[n & 1] = nc;
+		node = nc;
+	}
+
+	if (node->id > ht->imeta.max_node_id)
+		ht->imeta.max_node_id = node->id;
+
+ret_node:
+	*node_ret = node;
+	return TEE_SUCCESS;
 }
 
 static TEE_Result init_root_node(struct tee_fs_htree *ht)
@@ -610,6 +906,7 @@ static TEE_Result init_root_node(struct tee_fs_htree *ht)
 
 	ht->root.id = 1;
 	ht->root.dirty = true;
+	ht->root.verified = true;
 
 	res = calc_node_hash(&ht->root, &ht->imeta.meta, ctx,
 			     ht->root.node.hash);
@@ -662,11 +959,19 @@ TEE_Result tee_fs_htree_open(bool create, uint8_t *hash, const TEE_UUID *uuid,
 		if (res != TEE_SUCCESS)
 			goto out;
 
+#ifdef CFG_FS_HTREE_LAZY_VERIFY
+		/*
+		 * Only the root node is verified here, the other nodes are
+		 * loaded and verified on first use.
+		 */
+		res = verify_node(ht, &ht->root);
+#else
 		res = init_tree_from_data(ht);
 		if (res != TEE_SUCCESS)
 			goto out;
 
 		res = verify_tree(ht);
+#endif
 	}
 out:
 	if (res == TEE_SUCCESS)
@@ -681,6 +986,11 @@ struct tee_fs_htree_meta *tee_fs_htree_get_meta(struct tee_fs_htree *ht)
 	return &ht->imeta.meta;
 }
 
+void tee_fs_htree_get_hash(struct tee_fs_htree *ht, uint8_t *hash)
+{
+	memcpy(hash, ht->root.node.hash, sizeof(ht->root.node.hash));
+}
+
 void tee_fs_htree_meta_set_dirty(struct tee_fs_htree *ht)
 {
 	ht->dirty = true;
@@ -700,50 +1010,141 @@ void tee_fs_htree_close(struct tee_fs_htree **ht)
 	if (!*ht)
 		return;
 	htree_traverse_post_order(*ht, free_node, NULL);
+	crypto_hash_free_ctx((*ht)->hash_ctx, TEE_FS_HTREE_HASH_ALG);
 	free(*ht);
 	*ht = NULL;
 }
 
-static TEE_Result htree_sync_node_to_storage(struct traverse_arg *targ,
-					     struct htree_node *node)
+/*
+ * Nodes synced to storage are collected and written with as few RPCs as
+ * possible. The order doesn't matter as the nodes only become visible when
+ * the header is written.
+ */
+struct sync_arg {
+	struct hash_batch *hb;
+	size_t num;
+	struct tee_fs_htree_rpc_elem elem[TEE_FS_HTREE_RPC_MAX_ELEMS];
+	const void *data[TEE_FS_HTREE_RPC_MAX_ELEMS];
+};
+
+static TEE_Result sync_flush_nodes(struct tee_fs_htree *ht,
+				   struct sync_arg *sarg)
 {
 	TEE_Result res;
-	uint8_t vers;
-	struct tee_fs_htree_meta *meta = NULL;
-
-	/*
-	 * The node can be dirty while the block isn't updated due to
-	 * updated children, but if block is updated the node has to be
-	 * dirty.
-	 */
-	assert(node->dirty >= node->block_updated);
 
-	if (!node->dirty)
+	if (!sarg->num)
 		return TEE_SUCCESS;
 
-	if (node->parent) {
-		uint32_t f = HTREE_NODE_COMMITTED_CHILD(node->id & 1);
+	res = rpc_write_vec(ht, TEE_FS_HTREE_TYPE_NODE, sarg->elem, sarg->num,
+			    sarg->data, sizeof(struct tee_fs_htree_node_image));
+	sarg->num = 0;
+	return res;
+}
 
-		node->parent->dirty = true;
-		node->parent->node.flags ^= f;
-		vers = !!(node->parent->node.flags & f);
-	} else {
-		/*
-		 * Counter isn't updated yet, it's increased just before
-		 * writing the header.
-		 */
-		vers = !(targ->ht->head.counter & 1);
-		meta = &targ->ht->imeta.meta;
-	}
+static TEE_Result sync_hashed_nodes(struct tee_fs_htree *ht,
+				    struct sync_arg *sarg)
+{
+	const size_t max_elems =
+		rpc_vec_max_elems(sizeof(struct tee_fs_htree_node_image));
+	struct hash_batch *hb = sarg->hb;
+	struct htree_node *node;
+	TEE_Result res;
+	uint8_t vers;
+	size_t n;
 
-	res = calc_node_hash(node, meta, targ->arg, node->node.hash);
+	res = hash_batch_calc(hb);
 	if (res != TEE_SUCCESS)
 		return res;
 
-	node->dirty = false;
-	node->block_updated = false;
+	for (n = 0; n < hb->num; n++) {
+		node = hb->node[n];
+		memcpy(node->node.hash, hb->digest[n], sizeof(node->node.hash));
+		node->dirty = false;
+		node->block_updated = false;
+
+		if (node->parent) {
+			uint32_t f = HTREE_NODE_COMMITTED_CHILD(node->id & 1);
+
+			vers = !!(node->parent->node.flags & f);
+		} else {
+			/*
+			 * Counter isn't updated yet, it's increased just
+			 * before writing the header.
+			 */
+			vers = !(ht->head.counter & 1);
+		}
 
-	return rpc_write_node(targ->ht, node->id, vers, &node->node);
+		sarg->elem[sarg->num].idx = node->id - 1;
+		sarg->elem[sarg->num].vers = vers;
+		sarg->data[sarg->num] = &node->node;
+		sarg->num++;
+		if (sarg->num == max_elems) {
+			res = sync_flush_nodes(ht, sarg);
+			if (res != TEE_SUCCESS)
+				return res;
+		}
+	}
+
+	hb->num = 0;
+	return TEE_SUCCESS;
+}
+
+/*
+ * Hashes the dirty nodes one level at a time, starting with the deepest
+ * level, since the hash of a node covers the hashes of its children.
+ */
+static TEE_Result sync_nodes(struct tee_fs_htree *ht, struct sync_arg *sarg)
+{
+	TEE_Result res;
+	struct htree_node *node;
+	size_t level;
+	size_t node_id;
+	size_t last_id;
+
+	for (level = node_id_to_level(ht->imeta.max_node_id); level; level--) {
+		node_id = BIT(level - 1);
+		last_id = MIN(BIT(level) - 1, ht->imeta.max_node_id);
+
+		for (; node_id <= last_id; node_id++) {
+			/* Nodes not loaded yet can't be dirty */
+			node = find_node(ht, node_id);
+			if (!node)
+				continue;
+
+			/*
+			 * The node can be dirty while the block isn't
+			 * updated due to updated children, but if block is
+			 * updated the node has to be dirty.
+			 */
+			assert(node->dirty >= node->block_updated);
+
+			if (!node->dirty)
+				continue;
+
+			if (node->parent) {
+				uint32_t f = HTREE_NODE_COMMITTED_CHILD(
+							node->id & 1);
+
+				node->parent->dirty = true;
+				node->parent->node.flags ^= f;
+			}
+
+			if (!hash_batch_add(sarg->hb, node,
+					    node->parent ? NULL :
+							   &ht->imeta.meta))
+				continue;
+
+			res = sync_hashed_nodes(ht, sarg);
+			if (res != TEE_SUCCESS)
+				return res;
+		}
+
+		res = sync_hashed_nodes(ht, sarg);
+		if (res != TEE_SUCCESS)
+			return res;
+	}
+
+	return sync_flush_nodes(ht, sarg);
 }
 
 static TEE_Result update_root(struct tee_fs_htree *ht)
@@ -766,7 +1167,7 @@ TEE_Result tee_fs_htree_sync_to_storage(struct tee_fs_htree **ht_arg,
 {
 	TEE_Result res;
 	struct tee_fs_htree *ht = *ht_arg;
-	void *ctx;
+	struct sync_arg sarg = { .num = 0 };
 
 	if (!ht)
 		return TEE_ERROR_CORRUPT_OBJECT;
@@ -774,11 +1175,11 @@ TEE_Result tee_fs_htree_sync_to_storage(struct tee_fs_htree **ht_arg,
 	if (!ht->dirty)
 		return TEE_SUCCESS;
 
-	res = crypto_hash_alloc_ctx(&ctx, TEE_FS_HTREE_HASH_ALG);
+	res = hash_batch_alloc(&sarg.hb);
 	if (res != TEE_SUCCESS)
 		return res;
 
-	res = htree_traverse_post_order(ht, htree_sync_node_to_storage, ctx);
+	res = sync_nodes(ht, &sarg);
 	if (res != TEE_SUCCESS)
 		goto out;
 
@@ -795,7 +1196,7 @@ TEE_Result tee_fs_htree_sync_to_storage(struct tee_fs_htree **ht_arg,
 	if (hash)
 		memcpy(hash, ht->root.node.hash, sizeof(ht->root.node.hash));
 out:
-	crypto_hash_free_ctx(ctx, TEE_FS_HTREE_HASH_ALG);
+	hash_batch_free(sarg.hb);
 	if (res != TEE_SUCCESS)
 		tee_fs_htree_close(ht_arg);
 	return res;
@@ -814,103 +1215,251 @@ static TEE_Result get_block_node(struct tee_fs_htree *ht, bool create,
 	return res;
 }
 
-TEE_Result tee_fs_htree_write_block(struct tee_fs_htree **ht_arg,
-				    size_t block_num, const void *block)
+static TEE_Result encrypt_block(struct tee_fs_htree *ht,
+				struct htree_node *node, const void *block,
+				void *enc_block)
 {
-	struct tee_fs_htree *ht = *ht_arg;
 	TEE_Result res;
-	struct tee_fs_rpc_operation op;
-	struct htree_node *node = NULL;
-	uint8_t block_vers;
 	void *ctx;
-	void *enc_block;
-
-	if (!ht)
-		return TEE_ERROR_CORRUPT_OBJECT;
 
-	res = get_block_node(ht, true, block_num, &node);
+	res = authenc_init(&ctx, TEE_MODE_ENCRYPT, ht, &node->node,
+			   ht->stor->block_size);
 	if (res != TEE_SUCCESS)
-		goto out;
+		return res;
 
-	if (!node->block_updated)
-		node->node.flags ^= HTREE_NODE_COMMITTED_BLOCK;
+	return authenc_encrypt_final(ctx, node->node.tag, block,
+				     ht->stor->block_size, enc_block);
+}
 
-	block_vers = !!(node->node.flags & HTREE_NODE_COMMITTED_BLOCK);
-	res = ht->stor->rpc_write_init(ht->stor_aux, &op,
-				       TEE_FS_HTREE_TYPE_BLOCK, block_num,
-				       block_vers, &enc_block);
-	if (res != TEE_SUCCESS)
-		goto out;
+static TEE_Result decrypt_block(struct tee_fs_htree *ht,
+				struct htree_node *node, const void *enc_block,
+				void *block)
+{
+	TEE_Result res;
+	void *ctx;
 
-	res = authenc_init(&ctx, TEE_MODE_ENCRYPT, ht, &node->node,
+	res = authenc_init(&ctx, TEE_MODE_DECRYPT, ht, &node->node,
 			   ht->stor->block_size);
 	if (res != TEE_SUCCESS)
-		goto out;
-	res = authenc_encrypt_final(ctx, node->node.tag, block,
-				    ht->stor->block_size, enc_block);
-	if (res != TEE_SUCCESS)
-		goto out;
+		return res;
 
-	res = ht->stor->rpc_write_final(&op);
-	if (res != TEE_SUCCESS)
-		goto out;
+	return authenc_decrypt_final(ctx, node->node.tag, enc_block,
+				     ht->stor->block_size, block);
+}
 
-	node->block_updated = true;
-	node->dirty = true;
+/* Writes at most rpc_vec_max_elems(block_size) blocks */
+static TEE_Result write_block_vec(struct tee_fs_htree *ht, size_t block_num,
+				  size_t num_blocks,
+				  const void * const *blocks)
+{
+	const size_t bs = ht->stor->block_size;
+	struct tee_fs_htree_rpc_elem elem[TEE_FS_HTREE_RPC_MAX_ELEMS];
+	struct htree_node *nodes[TEE_FS_HTREE_RPC_MAX_ELEMS];
+	struct tee_fs_rpc_operation op;
+	TEE_Result res;
+	void *enc_block;
+	size_t n;
+
+	for (n = 0; n < num_blocks; n++) {
+		res = get_block_node(ht, true, block_num + n, nodes + n);
+		if (res != TEE_SUCCESS)
+			return res;
+
+		if (!nodes[n]->block_updated)
+			nodes[n]->node.flags ^= HTREE_NODE_COMMITTED_BLOCK;
+
+		elem[n].idx = block_num + n;
+		elem[n].vers = !!(nodes[n]->node.flags &
+				  HTREE_NODE_COMMITTED_BLOCK);
+	}
+
+	res = TEE_ERROR_NOT_SUPPORTED;
+	if (num_blocks > 1 && ht->stor->rpc_writev_init)
+		res = ht->stor->rpc_writev_init(ht->stor_aux, &op,
+						TEE_FS_HTREE_TYPE_BLOCK, elem,
+						num_blocks, &enc_block);
+	if (res == TEE_SUCCESS) {
+		for (n = 0; n < num_blocks; n++) {
+			res = encrypt_block(ht, nodes[n], blocks[n],
+					    (uint8_t *)enc_block + n * bs);
+			if (res != TEE_SUCCESS)
+				return res;
+		}
+
+		res = ht->stor->rpc_writev_final(&op);
+		if (res != TEE_SUCCESS)
+			return res;
+	} else if (res == TEE_ERROR_NOT_SUPPORTED) {
+		for (n = 0; n < num_blocks; n++) {
+			res = ht->stor->rpc_write_init(ht->stor_aux, &op,
+						       TEE_FS_HTREE_TYPE_BLOCK,
+						       elem[n].idx,
+						       elem[n].vers,
+						       &enc_block);
+			if (res != TEE_SUCCESS)
+				return res;
+
+			res = encrypt_block(ht, nodes[n], blocks[n],
+					    enc_block);
+			if (res != TEE_SUCCESS)
+				return res;
+
+			res = ht->stor->rpc_write_final(&op);
+			if (res != TEE_SUCCESS)
+				return res;
+		}
+	} else {
+		return res;
+	}
+
+	for (n = 0; n < num_blocks; n++) {
+		nodes[n]->block_updated = true;
+		nodes[n]->dirty = true;
+	}
 	ht->dirty = true;
-out:
+
+	return TEE_SUCCESS;
+}
+
+TEE_Result tee_fs_htree_write_blocks(struct tee_fs_htree **ht_arg,
+				     size_t block_num, size_t num_blocks,
+				     const void * const *blocks)
+{
+	struct tee_fs_htree *ht = *ht_arg;
+	TEE_Result res = TEE_SUCCESS;
+	size_t max_elems;
+	size_t n;
+
+	if (!ht)
+		return TEE_ERROR_CORRUPT_OBJECT;
+
+	max_elems = rpc_vec_max_elems(ht->stor->block_size);
+	while (num_blocks) {
+		n = MIN(num_blocks, max_elems);
+		res = write_block_vec(ht, block_num, n, blocks);
+		if (res != TEE_SUCCESS)
+			break;
+		block_num += n;
+		blocks += n;
+		num_blocks -= n;
+	}
+
 	if (res != TEE_SUCCESS)
 		tee_fs_htree_close(ht_arg);
 	return res;
 }
 
-TEE_Result tee_fs_htree_read_block(struct tee_fs_htree **ht_arg,
-				   size_t block_num, void *block)
+TEE_Result tee_fs_htree_write_block(struct tee_fs_htree **ht_arg,
+				    size_t block_num, const void *block)
 {
-	struct tee_fs_htree *ht = *ht_arg;
-	TEE_Result res;
+	return tee_fs_htree_write_blocks(ht_arg, block_num, 1, &block);
+}
+
+/* Reads at most rpc_vec_max_elems(block_size) blocks */
+static TEE_Result read_block_vec(struct tee_fs_htree *ht, size_t block_num,
+				 size_t num_blocks, void * const *blocks)
+{
+	const size_t bs = ht->stor->block_size;
+	struct tee_fs_htree_rpc_elem elem[TEE_FS_HTREE_RPC_MAX_ELEMS];
+	struct htree_node *nodes[TEE_FS_HTREE_RPC_MAX_ELEMS];
 	struct tee_fs_rpc_operation op;
-	struct htree_node *node;
-	uint8_t block_vers;
-	size_t len;
-	void *ctx;
+	TEE_Result res;
 	void *enc_block;
+	size_t len;
+	size_t n;
 
-	if (!ht)
-		return TEE_ERROR_CORRUPT_OBJECT;
+	for (n = 0; n < num_blocks; n++) {
+		res = get_block_node(ht, false, block_num + n, nodes + n);
+		if (res != TEE_SUCCESS)
+			return res;
 
-	res = get_block_node(ht, false, block_num, &node);
-	if (res != TEE_SUCCESS)
-		goto out;
+		elem[n].idx = block_num + n;
+		elem[n].vers = !!(nodes[n]->node.flags &
+				  HTREE_NODE_COMMITTED_BLOCK);
+	}
 
-	block_vers = !!(node->node.flags & HTREE_NODE_COMMITTED_BLOCK);
-	res = ht->stor->rpc_read_init(ht->stor_aux, &op,
-				      TEE_FS_HTREE_TYPE_BLOCK, block_num,
-				      block_vers, &enc_block);
-	if (res != TEE_SUCCESS)
-		goto out;
+	res = TEE_ERROR_NOT_SUPPORTED;
+	if (num_blocks > 1 && ht->stor->rpc_readv_init)
+		res = ht->stor->rpc_readv_init(ht->stor_aux, &op,
+					       TEE_FS_HTREE_TYPE_BLOCK, elem,
+					       num_blocks, &enc_block);
+	if (res == TEE_SUCCESS) {
+		res = ht->stor->rpc_readv_final(&op, &len);
+		if (res != TEE_SUCCESS)
+			return res;
+		if (len != num_blocks * bs)
+			return TEE_ERROR_CORRUPT_OBJECT;
 
-	res = ht->stor->rpc_read_final(&op, &len);
-	if (res != TEE_SUCCESS)
-		goto out;
-	if (len != ht->stor->block_size) {
-		res = TEE_ERROR_CORRUPT_OBJECT;
-		goto out;
+		for (n = 0; n < num_blocks; n++) {
+			res = decrypt_block(ht, nodes[n],
+					    (uint8_t *)enc_block + n * bs,
+					    blocks[n]);
+			if (res != TEE_SUCCESS)
+				return res;
+		}
+
+		return TEE_SUCCESS;
 	}
 
-	res = authenc_init(&ctx, TEE_MODE_DECRYPT, ht, &node->node,
-			   ht->stor->block_size);
-	if (res != TEE_SUCCESS)
-		goto out;
+	if (res != TEE_ERROR_NOT_SUPPORTED)
+		return res;
+
+	for (n = 0; n < num_blocks; n++) {
+		res = ht->stor->rpc_read_init(ht->stor_aux, &op,
+					      TEE_FS_HTREE_TYPE_BLOCK,
+					      elem[n].idx, elem[n].vers,
+					      &enc_block);
+		if (res != TEE_SUCCESS)
+			return res;
+
+		res = ht->stor->rpc_read_final(&op, &len);
+		if (res != TEE_SUCCESS)
+			return res;
+		if (len != bs)
+			return TEE_ERROR_CORRUPT_OBJECT;
+
+		res = decrypt_block(ht, nodes[n], enc_block, blocks[n]);
+		if (res != TEE_SUCCESS)
+			return res;
+	}
+
+	return TEE_SUCCESS;
+}
+
+TEE_Result tee_fs_htree_read_blocks(struct tee_fs_htree **ht_arg,
+				    size_t block_num, size_t num_blocks,
+				    void * const *blocks)
+{
+	struct tee_fs_htree *ht = *ht_arg;
+	TEE_Result res = TEE_SUCCESS;
+	size_t max_elems;
+	size_t n;
+
+	if (!ht)
+		return TEE_ERROR_CORRUPT_OBJECT;
+
+	max_elems = rpc_vec_max_elems(ht->stor->block_size);
+	while (num_blocks) {
+		n = MIN(num_blocks, max_elems);
+		res = read_block_vec(ht, block_num, n, blocks);
+		if (res != TEE_SUCCESS)
+			break;
+		block_num += n;
+		blocks += n;
+		num_blocks -= n;
+	}
 
-	res = authenc_decrypt_final(ctx, node->node.tag, enc_block,
-				    ht->stor->block_size, block);
-out:
 	if (res != TEE_SUCCESS)
 		tee_fs_htree_close(ht_arg);
 	return res;
 }
 
+TEE_Result tee_fs_htree_read_block(struct tee_fs_htree **ht_arg,
+				   size_t block_num, void *block)
+{
+	return tee_fs_htree_read_blocks(ht_arg, block_num, 1, &block);
+}
+
 TEE_Result tee_fs_htree_truncate(struct tee_fs_htree **ht_arg, size_t block_num)
 {
 	struct tee_fs_htree *ht = *ht_arg;
@@ -921,13 +1470,15 @@ TEE_Result tee_fs_htree_truncate(struct tee_fs_htree **ht_arg, size_t block_num)
 		return TEE_ERROR_CORRUPT_OBJECT;
 
 	while (node_id < ht->imeta.max_node_id) {
-		node = find_closest_node(ht, ht->imeta.max_node_id);
-		assert(node && node->id == ht->imeta.max_node_id);
-		assert(!node->child[0] && !node->child[1]);
-		assert(node->parent);
-		assert(node->parent->child[node->id & 1] == node);
-		node->parent->child[node->id & 1] = NULL;
-		free(node);
+		node = find_node(ht, ht->imeta.max_node_id);
+		/* A node not loaded yet has nothing to free */
+		if (node) {
+			assert(!node->child[0] && !node->child[1]);
+			assert(node->parent);
+			assert(node->parent->child[node->id & 1] == node);
+			node->parent->child[node->id & 1] = NULL;
+			free(node);
+		}
 		ht->imeta.max_node_id--;
 		ht->dirty = true;
 	}
@@ -9,6 +9,7 @@
 #include <kernel/thread.h>
 #include <mm/core_memprot.h>
 #include <optee_msg_supplicant.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string_ext.h>
 #include <string.h>
@@ -73,9 +74,10 @@ TEE_Result tee_fs_rpc_create(uint32_t id, struct tee_pobj *po, int *fd)
 	return operation_open(id, OPTEE_MRF_CREATE, po, fd);
 }
 
+/* Opens @fname if supplied, else the file represented by @dfh */
 static TEE_Result operation_open_dfh(uint32_t id, unsigned int cmd,
 				 const struct tee_fs_dirfile_fileh *dfh,
-				 int *fd)
+				 const char *fname, int *fd)
 {
 	struct tee_fs_rpc_operation op = { .id = id, .num_params = 3 };
 	struct mobj *mobj;
@@ -94,9 +96,17 @@ static TEE_Result operation_open_dfh(uint32_t id, unsigned int cmd,
 				     cookie, MSG_PARAM_MEM_DIR_IN))
 		return TEE_ERROR_BAD_STATE;
 
-	res = tee_svc_storage_create_filename_dfh(va, TEE_FS_NAME_MAX, dfh);
-	if (res != TEE_SUCCESS)
-		return res;
+	if (fname) {
+		int r = snprintf(va, TEE_FS_NAME_MAX, "/%s", fname);
+
+		if (r < 0 || r >= TEE_FS_NAME_MAX)
+			return TEE_ERROR_BAD_PARAMETERS;
+	} else {
+		res = tee_svc_storage_create_filename_dfh(va, TEE_FS_NAME_MAX,
+							  dfh);
+		if (res != TEE_SUCCESS)
+			return res;
+	}
 
 	op.params[2].attr = OPTEE_MSG_ATTR_TYPE_VALUE_OUTPUT;
 
@@ -112,14 +122,24 @@ static TEE_Result operation_open_dfh(uint32_t id, unsigned int cmd,
 TEE_Result tee_fs_rpc_open_dfh(uint32_t id,
 			       const struct tee_fs_dirfile_fileh *dfh, int *fd)
 {
-	return operation_open_dfh(id, OPTEE_MRF_OPEN, dfh, fd);
+	return operation_open_dfh(id, OPTEE_MRF_OPEN, dfh, NULL, fd);
 }
 
 TEE_Result tee_fs_rpc_create_dfh(uint32_t id,
 				 const struct tee_fs_dirfile_fileh *dfh,
 				 int *fd)
 {
-	return operation_open_dfh(id, OPTEE_MRF_CREATE, dfh, fd);
+	return operation_open_dfh(id, OPTEE_MRF_CREATE, dfh, NULL, fd);
+}
+
+TEE_Result tee_fs_rpc_open_fname(uint32_t id, const char *fname, int *fd)
+{
+	return operation_open_dfh(id, OPTEE_MRF_OPEN, NULL, fname, fd);
+}
+
+TEE_Result tee_fs_rpc_create_fname(uint32_t id, const char *fname, int *fd)
+{
+	return operation_open_dfh(id, OPTEE_MRF_CREATE, NULL, fname, fd);
 }
 
 TEE_Result tee_fs_rpc_close(uint32_t id, int fd)
@@ -214,6 +234,134 @@ TEE_Result tee_fs_rpc_write_final(struct tee_fs_rpc_operation *op)
 	return operation_commit(op);
 }
 
+/*
+ * tee-supplicant versions without support for OPTEE_MRF_READV and
+ * OPTEE_MRF_WRITEV fails such requests with TEE_ERROR_BAD_PARAMETERS.
+ * Support is probed with an empty OPTEE_MRF_READV request until the probe
+ * either succeeds or fails with TEE_ERROR_BAD_PARAMETERS or
+ * TEE_ERROR_NOT_SUPPORTED. While it isn't known to be supported the
+ * vectored functions below returns TEE_ERROR_NOT_SUPPORTED and the caller
+ * is expected to fall back to tee_fs_rpc_read_init() and
+ * tee_fs_rpc_write_init() instead.
+ */
+enum vec_support {
+	VEC_SUPPORT_UNKNOWN,
+	VEC_SUPPORT_YES,
+	VEC_SUPPORT_NO,
+};
+
+static enum vec_support vec_support;
+
+static bool vec_is_supported(uint32_t id, int fd)
+{
+	struct tee_fs_rpc_operation op = { .id = id, .num_params = 1 };
+	TEE_Result res;
+
+	if (vec_support != VEC_SUPPORT_UNKNOWN)
+		return vec_support == VEC_SUPPORT_YES;
+
+	op.params[0].attr = OPTEE_MSG_ATTR_TYPE_VALUE_INPUT;
+	op.params[0].u.value.a = OPTEE_MRF_READV;
+	op.params[0].u.value.b = fd;
+	op.params[0].u.value.c = 0;
+
+	res = operation_commit(&op);
+	if (res == TEE_SUCCESS) {
+		vec_support = VEC_SUPPORT_YES;
+	} else if (res == TEE_ERROR_NOT_SUPPORTED ||
+		   res == TEE_ERROR_BAD_PARAMETERS) {
+		DMSG("OPTEE_MRF_READV not supported (%#" PRIx32 ")", res);
+		vec_support = VEC_SUPPORT_NO;
+	} else {
+		/* Transient failure, probe again next time */
+		return false;
+	}
+
+	return vec_support == VEC_SUPPORT_YES;
+}
+
+static TEE_Result operation_init_vec(struct tee_fs_rpc_operation *op,
+				     uint32_t id, unsigned int cmd, int fd,
+				     size_t num_extents, size_t data_len,
+				     enum msg_param_mem_dir data_dir,
+				     struct optee_mrf_extent **extents,
+				     void **data)
+{
+	size_t ext_len = num_extents * sizeof(struct optee_mrf_extent);
+	struct mobj *mobj;
+	uint8_t *va;
+	uint64_t cookie;
+
+	if (!num_extents || !data_len)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	if (!vec_is_supported(id, fd))
+		return TEE_ERROR_NOT_SUPPORTED;
+
+	va = tee_fs_rpc_cache_alloc(ext_len + data_len, &mobj, &cookie);
+	if (!va)
+		return TEE_ERROR_OUT_OF_MEMORY;
+
+	memset(op, 0, sizeof(*op));
+	op->id = id;
+	op->num_params = 3;
+
+	op->params[0].attr = OPTEE_MSG_ATTR_TYPE_VALUE_INPUT;
+	op->params[0].u.value.a = cmd;
+	op->params[0].u.value.b = fd;
+	op->params[0].u.value.c = num_extents;
+
+	if (!msg_param_init_memparam(op->params + 1, mobj, 0, ext_len, cookie,
+				     MSG_PARAM_MEM_DIR_IN))
+		return TEE_ERROR_BAD_STATE;
+
+	if (!msg_param_init_memparam(op->params + 2, mobj, ext_len, data_len,
+				     cookie, data_dir))
+		return TEE_ERROR_BAD_STATE;
+
+	*extents = (struct optee_mrf_extent *)(void *)va;
+	*data = va + ext_len;
+
+	return TEE_SUCCESS;
+}
+
+TEE_Result tee_fs_rpc_readv_init(struct tee_fs_rpc_operation *op,
+				 uint32_t id, int fd, size_t num_extents,
+				 size_t data_len,
+				 struct optee_mrf_extent **extents,
+				 void **out_data)
+{
+	return operation_init_vec(op, id, OPTEE_MRF_READV, fd, num_extents,
+				  data_len, MSG_PARAM_MEM_DIR_OUT, extents,
+				  out_data);
+}
+
+TEE_Result tee_fs_rpc_readv_final(struct tee_fs_rpc_operation *op,
+				  size_t *data_len)
+{
+	TEE_Result res = operation_commit(op);
+
+	if (res == TEE_SUCCESS)
+		*data_len = msg_param_get_buf_size(op->params + 2);
+	return res;
+}
+
+TEE_Result tee_fs_rpc_writev_init(struct tee_fs_rpc_operation *op,
+				  uint32_t id, int fd, size_t num_extents,
+				  size_t data_len,
+				  struct optee_mrf_extent **extents,
+				  void **data)
+{
+	return operation_init_vec(op, id, OPTEE_MRF_WRITEV, fd, num_extents,
+				  data_len, MSG_PARAM_MEM_DIR_IN, extents,
+				  data);
+}
+
+TEE_Result tee_fs_rpc_writev_final(struct tee_fs_rpc_operation *op)
+{
+	return operation_commit(op);
+}
+
 TEE_Result tee_fs_rpc_truncate(uint32_t id, int fd, size_t len)
 {
 	struct tee_fs_rpc_operation op = { .id = id, .num_params = 1 };
@@ -3,31 +3,199 @@
  * Copyright (c) 2016, Linaro Limited
  */
 
+#include <kernel/spinlock.h>
 #include <kernel/thread.h>
 #include <mm/core_memprot.h>
 #include <mm/core_mmu.h>
 #include <mm/mobj.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/queue.h>
 #include <tee/tee_fs_rpc.h>
+#include <util.h>
+
+struct tee_fs_rpc_payload {
+	void *va;
+	struct mobj *mobj;
+	uint64_t cookie;
+	size_t size;
+	bool pooled;
+	SLIST_ENTRY(tee_fs_rpc_payload) link;
+};
+
+/*
+ * Pool of FS RPC payloads
+ *
+ * Each thread keeps one payload, used by all FS RPCs of the thread until
+ * a larger one is needed or the thread returns to normal world. Allocating
+ * and freeing a payload costs one RPC each, so while normal world lets
+ * secure world cache shared memory (see thread_enable_prealloc_rpc_cache())
+ * released payloads are kept in a pool shared by all threads instead of
+ * being freed. The pool holds payloads of a few size classes, at most
+ * CFG_FS_RPC_POOL_SIZE bytes in total. Pooled payloads are global shared
+ * memory so that they can be returned to normal world with
+ * OPTEE_SMC_DISABLE_SHM_CACHE together with the cached RPC arguments.
+ *
+ * Payloads larger than the largest class or exceeding the size of the
+ * pool are allocated and freed as before.
+ */
+static const size_t pool_class_size[] = {
+	SMALL_PAGE_SIZE, 4 * SMALL_PAGE_SIZE, 16 * SMALL_PAGE_SIZE,
+	32 * SMALL_PAGE_SIZE,
+};
+
+static SLIST_HEAD(, tee_fs_rpc_payload) pool_free[ARRAY_SIZE(pool_class_size)];
+static struct tee_fs_rpc_pool_stats pool_stats;
+static unsigned int pool_lock = SPINLOCK_UNLOCK;
+
+/* Returns the index of the smallest class fitting @size, or -1 */
+static int pool_class(size_t size)
+{
+	size_t n;
+
+	for (n = 0; n < ARRAY_SIZE(pool_class_size); n++)
+		if (size <= pool_class_size[n])
+			return n;
+
+	return -1;
+}
+
+static struct tee_fs_rpc_payload *pool_get(int class)
+{
+	struct tee_fs_rpc_payload *p = NULL;
+	uint32_t exceptions = cpu_spin_lock_xsave(&pool_lock);
+	size_t n;
+
+	for (n = class; n < ARRAY_SIZE(pool_class_size); n++) {
+		p = SLIST_FIRST(pool_free + n);
+		if (p) {
+			SLIST_REMOVE_HEAD(pool_free + n, link);
+			pool_stats.free_bytes -= p->size;
+			pool_stats.allocs_avoided++;
+			break;
+		}
+	}
+
+	cpu_spin_unlock_xrestore(&pool_lock, exceptions);
+	return p;
+}
+
+static void pool_put(struct tee_fs_rpc_payload *p)
+{
+	uint32_t exceptions = cpu_spin_lock_xsave(&pool_lock);
+
+	SLIST_INSERT_HEAD(pool_free + pool_class(p->size), p, link);
+	pool_stats.free_bytes += p->size;
+	pool_stats.frees_avoided++;
+
+	cpu_spin_unlock_xrestore(&pool_lock, exceptions);
+}
+
+/* Accounts for a new pooled payload of @size unless the pool is full */
+static bool pool_reserve(size_t size)
+{
+	uint32_t exceptions = cpu_spin_lock_xsave(&pool_lock);
+	bool rv = false;
+
+	if (pool_stats.total_bytes + size <= CFG_FS_RPC_POOL_SIZE) {
+		pool_stats.total_bytes += size;
+		pool_stats.num_payloads++;
+		rv = true;
+	}
+
+	cpu_spin_unlock_xrestore(&pool_lock, exceptions);
+	return rv;
+}
+
+static void pool_unreserve(size_t size)
+{
+	uint32_t exceptions = cpu_spin_lock_xsave(&pool_lock);
+
+	pool_stats.total_bytes -= size;
+	pool_stats.num_payloads--;
+
+	cpu_spin_unlock_xrestore(&pool_lock, exceptions);
+}
+
+static void payload_free(struct tee_fs_rpc_payload *p)
+{
+	if (p->pooled) {
+		/* Only allocated while normal world allows caching */
+		pool_put(p);
+		return;
+	}
+
+	thread_rpc_free_payload(p->cookie, p->mobj);
+	free(p);
+}
+
+static struct tee_fs_rpc_payload *payload_alloc(size_t size)
+{
+	struct tee_fs_rpc_payload *p = NULL;
+	int class = -1;
+	paddr_t pa;
+
+	if (thread_prealloc_rpc_cache_is_enabled())
+		class = pool_class(size);
+
+	if (class >= 0) {
+		p = pool_get(class);
+		if (p)
+			return p;
+	}
+
+	p = calloc(1, sizeof(*p));
+	if (!p)
+		return NULL;
+
+	if (class >= 0 && pool_reserve(pool_class_size[class])) {
+		p->size = pool_class_size[class];
+		p->mobj = thread_rpc_alloc_global_payload(p->size, &p->cookie);
+		if (p->mobj)
+			p->pooled = true;
+		else
+			pool_unreserve(p->size);
+	}
+	if (!p->mobj) {
+		p->size = size;
+		p->mobj = thread_rpc_alloc_payload(size, &p->cookie);
+		if (!p->mobj) {
+			free(p);
+			return NULL;
+		}
+	}
+
+	if (mobj_get_pa(p->mobj, 0, 0, &pa) || !ALIGNMENT_IS_OK(pa, uint64_t))
+		goto err;
+
+	p->va = mobj_get_va(p->mobj, 0);
+	if (!p->va)
+		goto err;
+
+	return p;
+err:
+	if (p->pooled) {
+		thread_rpc_free_global_payload(p->cookie, p->mobj);
+		pool_unreserve(p->size);
+	} else {
+		thread_rpc_free_payload(p->cookie, p->mobj);
+	}
+	free(p);
+	return NULL;
+}
 
 void tee_fs_rpc_cache_clear(struct thread_specific_data *tsd)
 {
 	if (tsd->rpc_fs_payload) {
-		thread_rpc_free_payload(tsd->rpc_fs_payload_cookie,
-					tsd->rpc_fs_payload_mobj);
+		payload_free(tsd->rpc_fs_payload);
 		tsd->rpc_fs_payload = NULL;
-		tsd->rpc_fs_payload_cookie = 0;
-		tsd->rpc_fs_payload_size = 0;
-		tsd->rpc_fs_payload_mobj = NULL;
 	}
 }
 
 void *tee_fs_rpc_cache_alloc(size_t size, struct mobj **mobj, uint64_t *cookie)
 {
 	struct thread_specific_data *tsd = thread_get_tsd();
-	size_t sz = size;
-	uint64_t c = 0;
-	paddr_t p;
-	void *va;
+	struct tee_fs_rpc_payload *p = tsd->rpc_fs_payload;
 
 	if (!size)
 		return NULL;
@@ -36,35 +204,57 @@ void *tee_fs_rpc_cache_alloc(size_t size, struct mobj **mobj, uint64_t *cookie)
 	 * Always allocate in page chunks as normal world allocates payload
 	 * memory as complete pages.
 	 */
-	sz = ROUNDUP(size, SMALL_PAGE_SIZE);
+	size = ROUNDUP(size, SMALL_PAGE_SIZE);
 
-	if (sz > tsd->rpc_fs_payload_size) {
+	if (!p || size > p->size) {
 		tee_fs_rpc_cache_clear(tsd);
 
-		*mobj = thread_rpc_alloc_payload(sz,  &c);
-		if (!*mobj)
+		p = payload_alloc(size);
+		if (!p)
 			return NULL;
+		tsd->rpc_fs_payload = p;
+	}
 
-		if (mobj_get_pa(*mobj, 0, 0, &p))
-			goto err;
+	*mobj = p->mobj;
+	*cookie = p->cookie;
+	return p->va;
+}
 
-		if (!ALIGNMENT_IS_OK(p, uint64_t))
-			goto err;
+bool tee_fs_rpc_cache_drain(uint64_t *cookie)
+{
+	struct tee_fs_rpc_payload *p = NULL;
+	uint32_t exceptions = cpu_spin_lock_xsave(&pool_lock);
+	size_t n;
 
-		va = mobj_get_va(*mobj, 0);
-		if (!va)
-			goto err;
+	for (n = 0; n < ARRAY_SIZE(pool_class_size); n++) {
+		p = SLIST_FIRST(pool_free + n);
+		if (p) {
+			SLIST_REMOVE_HEAD(pool_free + n, link);
+			pool_stats.free_bytes -= p->size;
+			pool_stats.total_bytes -= p->size;
+			pool_stats.num_payloads--;
+			break;
+		}
+	}
 
-		tsd->rpc_fs_payload = va;
-		tsd->rpc_fs_payload_mobj = *mobj;
-		tsd->rpc_fs_payload_cookie = c;
-		tsd->rpc_fs_payload_size = sz;
-	} else
-		*mobj = tsd->rpc_fs_payload_mobj;
+	cpu_spin_unlock_xrestore(&pool_lock, exceptions);
 
-	*cookie = tsd->rpc_fs_payload_cookie;
-	return tsd->rpc_fs_payload;
-err:
-	thread_rpc_free_payload(c, *mobj);
-	return NULL;
+	if (!p)
+		return false;
+
+	*cookie = p->cookie;
+	mobj_free(p->mobj);
+	free(p);
+	return true;
+}
+
+void tee_fs_rpc_cache_get_stats(struct tee_fs_rpc_pool_stats *stats)
+{
+	uint32_t exceptions = cpu_spin_lock_xsave(&pool_lock);
+
+	*stats = pool_stats;
+	pool_stats.allocs_avoided = 0;
+	pool_stats.frees_avoided = 0;
+
+	cpu_spin_unlock_xrestore(&pool_lock, exceptions);
 }
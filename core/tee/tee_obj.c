@@ -14,9 +14,21 @@
 #include <tee/tee_svc_storage.h>
 #include <tee/tee_svc_cryp.h>
 
-void tee_obj_add(struct user_ta_ctx *utc, struct tee_obj *o)
+/*
+ * The id of an object is its handle in utc->object_handles plus one, as
+ * 0 is TEE_HANDLE_NULL. As the handle database is per TA, a TA can't
+ * reach objects of another TA.
+ */
+TEE_Result tee_obj_add(struct user_ta_ctx *utc, struct tee_obj *o)
 {
+	int h = handle_get(&utc->object_handles, o);
+
+	if (h < 0)
+		return TEE_ERROR_OUT_OF_MEMORY;
+
+	o->id = h + 1;
 	TAILQ_INSERT_TAIL(&utc->objects, o, link);
+	return TEE_SUCCESS;
 }
 
 TEE_Result tee_obj_get(struct user_ta_ctx *utc, uint32_t obj_id,
@@ -24,18 +36,21 @@ TEE_Result tee_obj_get(struct user_ta_ctx *utc, uint32_t obj_id,
 {
 	struct tee_obj *o;
 
-	TAILQ_FOREACH(o, &utc->objects, link) {
-		if (obj_id == (vaddr_t)o) {
-			*obj = o;
-			return TEE_SUCCESS;
-		}
-	}
-	return TEE_ERROR_BAD_PARAMETERS;
+	if (!obj_id)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	o = handle_lookup(&utc->object_handles, obj_id - 1);
+	if (!o)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	*obj = o;
+	return TEE_SUCCESS;
 }
 
 void tee_obj_close(struct user_ta_ctx *utc, struct tee_obj *o)
 {
 	TAILQ_REMOVE(&utc->objects, o, link);
+	handle_put(&utc->object_handles, o->id - 1);
 
 	if ((o->info.handleFlags & TEE_HANDLE_FLAG_PERSISTENT)) {
 		o->pobj->fops->close(&o->fh);
@@ -3,15 +3,59 @@
  * Copyright (c) 2014, STMicroelectronics International N.V.
  */
 
+#include <initcall.h>
 #include <kernel/mutex.h>
 #include <stdlib.h>
 #include <string.h>
 #include <tee/tee_pobj.h>
 #include <trace.h>
+#include <util.h>
 
-static TAILQ_HEAD(tee_pobjs, tee_pobj) tee_pobjs =
-		TAILQ_HEAD_INITIALIZER(tee_pobjs);
-static struct mutex pobjs_mutex = MUTEX_INITIALIZER;
+#if !CFG_TEE_POBJ_HASH_SIZE || \
+	(CFG_TEE_POBJ_HASH_SIZE & (CFG_TEE_POBJ_HASH_SIZE - 1))
+#error CFG_TEE_POBJ_HASH_SIZE must be a power of two
+#endif
+
+/*
+ * Open persistent objects are hashed on (uuid, obj_id). The mutex of a
+ * bucket protects the bucket list as well as refcnt of each object
+ * hashed to the bucket.
+ */
+struct pobj_bucket {
+	struct mutex mu;
+	TAILQ_HEAD(tee_pobjs, tee_pobj) pobjs;
+};
+
+static struct pobj_bucket pobj_buckets[CFG_TEE_POBJ_HASH_SIZE];
+
+static TEE_Result init_pobj_buckets(void)
+{
+	size_t n;
+
+	for (n = 0; n < ARRAY_SIZE(pobj_buckets); n++) {
+		mutex_init(&pobj_buckets[n].mu);
+		TAILQ_INIT(&pobj_buckets[n].pobjs);
+	}
+
+	return TEE_SUCCESS;
+}
+service_init(init_pobj_buckets);
+
+static struct pobj_bucket *pobj_bucket(const TEE_UUID *uuid,
+				       const void *obj_id, size_t obj_id_len)
+{
+	const uint8_t *p = (const uint8_t *)uuid;
+	uint32_t h = 2166136261;	/* FNV-1a */
+	size_t n;
+
+	for (n = 0; n < sizeof(*uuid); n++)
+		h = (h ^ p[n]) * 16777619;
+	p = obj_id;
+	for (n = 0; n < obj_id_len; n++)
+		h = (h ^ p[n]) * 16777619;
+
+	return pobj_buckets + (h & (CFG_TEE_POBJ_HASH_SIZE - 1));
+}
 
 static TEE_Result tee_pobj_check_access(uint32_t oflags, uint32_t nflags)
 {
@@ -62,19 +106,21 @@ TEE_Result tee_pobj_get(TEE_UUID *uuid, void *obj_id, uint32_t obj_id_len,
 			const struct tee_file_operations *fops,
 			struct tee_pobj **obj)
 {
+	struct pobj_bucket *b = pobj_bucket(uuid, obj_id, obj_id_len);
 	struct tee_pobj *o;
 	TEE_Result res;
 
 	*obj = NULL;
 
-	mutex_lock(&pobjs_mutex);
+	mutex_lock(&b->mu);
 	/* Check if file is open */
-	TAILQ_FOREACH(o, &tee_pobjs, link) {
+	TAILQ_FOREACH(o, &b->pobjs, link) {
 		if ((obj_id_len == o->obj_id_len) &&
 		    (memcmp(obj_id, o->obj_id, obj_id_len) == 0) &&
 		    (memcmp(uuid, &o->uuid, sizeof(TEE_UUID)) == 0) &&
 		    (fops == o->fops)) {
 			*obj = o;
+			break;
 		}
 	}
 
@@ -111,64 +157,101 @@ TEE_Result tee_pobj_get(TEE_UUID *uuid, void *obj_id, uint32_t obj_id_len,
 	memcpy(o->obj_id, obj_id, obj_id_len);
 	o->obj_id_len = obj_id_len;
 
-	TAILQ_INSERT_TAIL(&tee_pobjs, o, link);
+	TAILQ_INSERT_TAIL(&b->pobjs, o, link);
 	*obj = o;
 
 	res = TEE_SUCCESS;
 out:
 	if (res != TEE_SUCCESS)
 		*obj = NULL;
-	mutex_unlock(&pobjs_mutex);
+	mutex_unlock(&b->mu);
 	return res;
 }
 
 TEE_Result tee_pobj_release(struct tee_pobj *obj)
 {
+	struct pobj_bucket *b;
+	bool last;
+
 	if (obj == NULL)
 		return TEE_ERROR_BAD_PARAMETERS;
 
-	mutex_lock(&pobjs_mutex);
+	/*
+	 * The key of an object only changes in tee_pobj_rename(), which
+	 * requires the caller to hold the only reference.
+	 */
+	b = pobj_bucket(&obj->uuid, obj->obj_id, obj->obj_id_len);
+
+	mutex_lock(&b->mu);
 	obj->refcnt--;
-	if (obj->refcnt == 0) {
-		TAILQ_REMOVE(&tee_pobjs, obj, link);
+	last = !obj->refcnt;
+	if (last)
+		TAILQ_REMOVE(&b->pobjs, obj, link);
+	mutex_unlock(&b->mu);
+
+	if (last) {
 		free(obj->obj_id);
 		free(obj);
 	}
-	mutex_unlock(&pobjs_mutex);
 
 	return TEE_SUCCESS;
 }
 
+static void lock_buckets(struct pobj_bucket *b1, struct pobj_bucket *b2)
+{
+	/* Always lock in address order to avoid deadlocks */
+	if (b1 > b2) {
+		mutex_lock(&b2->mu);
+		mutex_lock(&b1->mu);
+	} else {
+		mutex_lock(&b1->mu);
+		if (b2 != b1)
+			mutex_lock(&b2->mu);
+	}
+}
+
+static void unlock_buckets(struct pobj_bucket *b1, struct pobj_bucket *b2)
+{
+	if (b2 != b1)
+		mutex_unlock(&b2->mu);
+	mutex_unlock(&b1->mu);
+}
+
 TEE_Result tee_pobj_rename(struct tee_pobj *obj, void *obj_id,
 			   uint32_t obj_id_len)
 {
 	TEE_Result res = TEE_SUCCESS;
 	void *new_obj_id = NULL;
+	struct pobj_bucket *old_b;
+	struct pobj_bucket *new_b;
 
 	if (obj == NULL || obj_id == NULL)
 		return TEE_ERROR_BAD_PARAMETERS;
 
-	mutex_lock(&pobjs_mutex);
+	new_obj_id = malloc(obj_id_len);
+	if (new_obj_id == NULL)
+		return TEE_ERROR_OUT_OF_MEMORY;
+	memcpy(new_obj_id, obj_id, obj_id_len);
+
+	old_b = pobj_bucket(&obj->uuid, obj->obj_id, obj->obj_id_len);
+	new_b = pobj_bucket(&obj->uuid, obj_id, obj_id_len);
+
+	lock_buckets(old_b, new_b);
 	if (obj->refcnt != 1) {
 		res = TEE_ERROR_BAD_STATE;
 		goto exit;
 	}
 
-	new_obj_id = malloc(obj_id_len);
-	if (new_obj_id == NULL) {
-		res = TEE_ERROR_OUT_OF_MEMORY;
-		goto exit;
-	}
-	memcpy(new_obj_id, obj_id, obj_id_len);
-
-	/* update internal data */
+	/* update internal data, the object moves to the bucket of its new id */
+	TAILQ_REMOVE(&old_b->pobjs, obj, link);
 	free(obj->obj_id);
 	obj->obj_id = new_obj_id;
 	obj->obj_id_len = obj_id_len;
+	TAILQ_INSERT_TAIL(&new_b->pobjs, obj, link);
 	new_obj_id = NULL;
 
 exit:
-	mutex_unlock(&pobjs_mutex);
+	unlock_buckets(old_b, new_b);
 	free(new_obj_id);
 	return res;
 }
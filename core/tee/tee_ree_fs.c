@@ -4,6 +4,7 @@
  */
 
 #include <assert.h>
+#include <crypto/crypto.h>
 #include <kernel/mutex.h>
 #include <kernel/panic.h>
 #include <kernel/thread.h>
@@ -18,6 +19,7 @@
 #include <tee/fs_dirfile.h>
 #include <tee/fs_htree.h>
 #include <tee/tee_fs.h>
+#include <tee/tee_fs_key_manager.h>
 #include <tee/tee_fs_rpc.h>
 #include <tee/tee_pobj.h>
 #include <trace.h>
@@ -28,11 +30,24 @@
 
 #define BLOCK_SIZE	(1 << BLOCK_SHIFT)
 
+struct dirf_journal;
+
 struct tee_fs_fd {
 	struct tee_fs_htree *ht;
 	int fd;
 	struct tee_fs_dirfile_fileh dfh;
 	const TEE_UUID *uuid;
+#ifdef CFG_REE_FS_READ_AHEAD
+	size_t ra_pos;
+	size_t ra_window;
+#endif
+#ifdef CFG_REE_FS_DIRF_JOURNAL
+	struct dirf_journal *jnl;
+#endif
+#ifdef CFG_REE_FS_ASYNC_COMMIT
+	size_t pending_updates;
+	TAILQ_ENTRY(tee_fs_fd) pending_link;
+#endif
 };
 
 struct tee_fs_dir {
@@ -85,6 +100,424 @@ static void put_tmp_block(void *tmp_block)
 }
 #endif
 
+#ifdef CFG_WITH_STATS
+static struct tee_ree_fs_stats ree_fs_stats;
+
+static inline void incr_cache_hits(void)
+{
+	ree_fs_stats.cache_hits++;
+}
+
+static inline void incr_cache_misses(void)
+{
+	ree_fs_stats.cache_misses++;
+}
+
+static inline void incr_cache_evictions(void)
+{
+	ree_fs_stats.cache_evictions++;
+}
+
+static inline void incr_cache_writebacks(void)
+{
+	ree_fs_stats.cache_writebacks++;
+}
+
+static inline void incr_readahead_blocks(void)
+{
+	ree_fs_stats.readahead_blocks++;
+}
+
+static inline void set_readahead_window(size_t window)
+{
+	ree_fs_stats.readahead_window = window;
+}
+#else
+static inline void incr_cache_hits(void) { }
+static inline void incr_cache_misses(void) { }
+static inline void incr_cache_evictions(void) { }
+static inline void incr_cache_writebacks(void) { }
+static inline void incr_readahead_blocks(void) { }
+static inline void set_readahead_window(size_t window __unused) { }
+#endif
+
+#ifdef CFG_REE_FS_BLOCK_CACHE
+/*
+ * Cache of decrypted and authenticated data blocks shared by all open
+ * files, an entry is identified by the owning file and the block number.
+ *
+ * A block updated by out_of_place_write() is only marked dirty in the
+ * cache. It's encrypted and written to storage when the file is synced
+ * with sync_to_storage(), or when the entry is evicted. Since writing a
+ * block may fail and close the hash tree of the file, a dirty entry can
+ * only be evicted on behalf of the file owning it. Dirty blocks are
+ * written in runs of consecutive blocks to use as few RPCs as possible.
+ *
+ * All access is serialized by ree_fs_mutex.
+ */
+struct block_cache_entry {
+	struct tee_fs_fd *fdp;
+	size_t block_num;
+	unsigned int last_use;
+	bool dirty;
+	bool busy;
+	uint8_t *data;
+};
+
+static struct block_cache_entry block_cache[CFG_REE_FS_BLOCK_CACHE_SIZE];
+static unsigned int block_cache_tick;
+
+static struct block_cache_entry *block_cache_lookup(struct tee_fs_fd *fdp,
+						    size_t block_num)
+{
+	size_t n;
+
+	for (n = 0; n < ARRAY_SIZE(block_cache); n++) {
+		struct block_cache_entry *e = block_cache + n;
+
+		if (e->fdp == fdp && e->block_num == block_num)
+			return e;
+	}
+
+	return NULL;
+}
+
+static bool block_is_cached(struct tee_fs_fd *fdp, size_t block_num)
+{
+	return block_cache_lookup(fdp, block_num);
+}
+
+static struct block_cache_entry *block_cache_find(struct tee_fs_fd *fdp,
+						  size_t block_num)
+{
+	struct block_cache_entry *e = block_cache_lookup(fdp, block_num);
+
+	if (e)
+		e->last_use = ++block_cache_tick;
+
+	return e;
+}
+
+/* Drops all entries of @fdp from block @block_num and onwards */
+static void block_cache_invalidate(struct tee_fs_fd *fdp, size_t block_num)
+{
+	size_t n;
+
+	for (n = 0; n < ARRAY_SIZE(block_cache); n++) {
+		struct block_cache_entry *e = block_cache + n;
+
+		if (e->fdp == fdp && e->block_num >= block_num) {
+			free(e->data);
+			memset(e, 0, sizeof(*e));
+		}
+	}
+}
+
+/* Writes all dirty blocks of @fdp, in block order */
+static TEE_Result block_cache_flush(struct tee_fs_fd *fdp)
+{
+	struct block_cache_entry *run[ARRAY_SIZE(block_cache)];
+	const void *blocks[ARRAY_SIZE(block_cache)];
+	struct block_cache_entry *e;
+	TEE_Result res;
+	size_t num;
+	size_t n;
+
+	while (true) {
+		e = NULL;
+		for (n = 0; n < ARRAY_SIZE(block_cache); n++) {
+			struct block_cache_entry *c = block_cache + n;
+
+			if (c->fdp == fdp && c->dirty &&
+			    (!e || c->block_num < e->block_num))
+				e = c;
+		}
+		if (!e)
+			return TEE_SUCCESS;
+
+		num = 0;
+		while (e && e->dirty) {
+			run[num] = e;
+			blocks[num] = e->data;
+			num++;
+			e = block_cache_lookup(fdp, e->block_num + 1);
+		}
+
+		res = tee_fs_htree_write_blocks(&fdp->ht, run[0]->block_num,
+						num, blocks);
+		if (res != TEE_SUCCESS) {
+			/* The hash tree is closed, nothing cached is valid */
+			block_cache_invalidate(fdp, 0);
+			return res;
+		}
+
+		for (n = 0; n < num; n++) {
+			run[n]->dirty = false;
+			incr_cache_writebacks();
+		}
+	}
+}
+
+/*
+ * Assigns an entry to block @block_num of @fdp, evicting the least
+ * recently used entry if needed. *e_ret is set to NULL if no entry can be
+ * made available, the caller is then expected to bypass the cache.
+ */
+static TEE_Result block_cache_alloc(struct tee_fs_fd *fdp, size_t block_num,
+				   struct block_cache_entry **e_ret)
+{
+	struct block_cache_entry *e = NULL;
+	TEE_Result res;
+	size_t n;
+
+	*e_ret = NULL;
+
+	for (n = 0; n < ARRAY_SIZE(block_cache); n++) {
+		struct block_cache_entry *c = block_cache + n;
+
+		if (!c->fdp) {
+			e = c;
+			break;
+		}
+		if (c->busy || (c->dirty && c->fdp != fdp))
+			continue;
+		if (!e || c->last_use < e->last_use)
+			e = c;
+	}
+
+	if (!e)
+		return TEE_SUCCESS;
+
+	if (e->fdp) {
+		if (e->dirty) {
+			res = block_cache_flush(fdp);
+			if (res != TEE_SUCCESS)
+				return res;
+		}
+		incr_cache_evictions();
+	} else {
+		e->data = malloc(BLOCK_SIZE);
+		if (!e->data)
+			return TEE_SUCCESS;
+	}
+
+	e->fdp = fdp;
+	e->block_num = block_num;
+	e->dirty = false;
+	e->last_use = ++block_cache_tick;
+	*e_ret = e;
+
+	return TEE_SUCCESS;
+}
+
+/*
+ * Supplies a pointer to the content of block @block_num, either from the
+ * cache or read into @tmp_block. On a cache miss the following uncached
+ * blocks up to @last_block_num, plus @ra_blocks blocks of read-ahead, are
+ * read into the cache too, with a single RPC if possible.
+ */
+static TEE_Result read_block(struct tee_fs_fd *fdp, size_t block_num,
+			     size_t last_block_num, size_t ra_blocks,
+			     uint8_t *tmp_block, uint8_t **block)
+{
+	struct tee_fs_htree_meta *meta = tee_fs_htree_get_meta(fdp->ht);
+	struct block_cache_entry *run[ARRAY_SIZE(block_cache)];
+	void *blocks[ARRAY_SIZE(block_cache)];
+	struct block_cache_entry *e = block_cache_find(fdp, block_num);
+	size_t max_block_num;
+	TEE_Result res;
+	size_t num;
+	size_t n;
+
+	if (e) {
+		incr_cache_hits();
+		*block = e->data;
+		return TEE_SUCCESS;
+	}
+
+	res = block_cache_alloc(fdp, block_num, &e);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	if (!e) {
+		incr_cache_misses();
+		*block = tmp_block;
+		res = tee_fs_htree_read_block(&fdp->ht, block_num, tmp_block);
+		if (res != TEE_SUCCESS)
+			block_cache_invalidate(fdp, 0);
+		return res;
+	}
+
+	max_block_num = MIN(last_block_num + ra_blocks,
+			    ROUNDUP(meta->length, BLOCK_SIZE) / BLOCK_SIZE - 1);
+	num = 0;
+	while (true) {
+		e->busy = true;
+		run[num] = e;
+		blocks[num] = e->data;
+		num++;
+
+		if (num == ARRAY_SIZE(run) || block_num + num > max_block_num ||
+		    block_cache_lookup(fdp, block_num + num))
+			break;
+		res = block_cache_alloc(fdp, block_num + num, &e);
+		if (res != TEE_SUCCESS)
+			return res;
+		if (!e)
+			break;
+	}
+
+	res = tee_fs_htree_read_blocks(&fdp->ht, block_num, num, blocks);
+	if (res != TEE_SUCCESS) {
+		block_cache_invalidate(fdp, 0);
+		return res;
+	}
+
+	for (n = 0; n < num; n++) {
+		run[n]->busy = false;
+		if (block_num + n > last_block_num)
+			incr_readahead_blocks();
+		else
+			incr_cache_misses();
+	}
+
+	*block = run[0]->data;
+	return TEE_SUCCESS;
+}
+
+/*
+ * Supplies a pointer to the content of block @block_num, or a zeroed
+ * block if it's beyond end of file, to be modified by the caller and then
+ * passed to update_block().
+ */
+static TEE_Result get_block_for_update(struct tee_fs_fd *fdp,
+				       size_t block_num, uint8_t *tmp_block,
+				       uint8_t **block)
+{
+	struct tee_fs_htree_meta *meta = tee_fs_htree_get_meta(fdp->ht);
+	struct block_cache_entry *e;
+	TEE_Result res;
+
+	if (block_num * BLOCK_SIZE < ROUNDUP(meta->length, BLOCK_SIZE))
+		return read_block(fdp, block_num, block_num, 0, tmp_block,
+				  block);
+
+	e = block_cache_find(fdp, block_num);
+	if (!e) {
+		res = block_cache_alloc(fdp, block_num, &e);
+		if (res != TEE_SUCCESS)
+			return res;
+	}
+
+	if (e)
+		*block = e->data;
+	else
+		*block = tmp_block;
+	memset(*block, 0, BLOCK_SIZE);
+
+	return TEE_SUCCESS;
+}
+
+static TEE_Result update_block(struct tee_fs_fd *fdp, size_t block_num,
+			       uint8_t *tmp_block, uint8_t *block)
+{
+	struct block_cache_entry *e;
+	TEE_Result res;
+
+	if (block == tmp_block) {
+		res = tee_fs_htree_write_block(&fdp->ht, block_num, block);
+		if (res != TEE_SUCCESS)
+			block_cache_invalidate(fdp, 0);
+		return res;
+	}
+
+	e = block_cache_find(fdp, block_num);
+	assert(e && e->data == block);
+	e->dirty = true;
+
+	return TEE_SUCCESS;
+}
+
+static TEE_Result sync_to_storage(struct tee_fs_fd *fdp, uint8_t *hash)
+{
+	TEE_Result res;
+
+	res = block_cache_flush(fdp);
+	if (res == TEE_SUCCESS)
+		res = tee_fs_htree_sync_to_storage(&fdp->ht, hash);
+	if (res != TEE_SUCCESS)
+		block_cache_invalidate(fdp, 0);
+
+	return res;
+}
+
+#ifdef CFG_WITH_STATS
+static void block_cache_get_stats(struct tee_ree_fs_stats *stats)
+{
+	size_t n;
+
+	for (n = 0; n < ARRAY_SIZE(block_cache); n++) {
+		if (block_cache[n].fdp)
+			stats->cache_blocks++;
+		if (block_cache[n].dirty)
+			stats->cache_dirty++;
+	}
+}
+#endif
+#else /*!CFG_REE_FS_BLOCK_CACHE*/
+static bool block_is_cached(struct tee_fs_fd *fdp __unused,
+			    size_t block_num __unused)
+{
+	return false;
+}
+
+static void block_cache_invalidate(struct tee_fs_fd *fdp __unused,
+				   size_t block_num __unused)
+{
+}
+
+static TEE_Result read_block(struct tee_fs_fd *fdp, size_t block_num,
+			     size_t last_block_num __unused,
+			     size_t ra_blocks __unused, uint8_t *tmp_block,
+			     uint8_t **block)
+{
+	*block = tmp_block;
+	return tee_fs_htree_read_block(&fdp->ht, block_num, tmp_block);
+}
+
+static TEE_Result get_block_for_update(struct tee_fs_fd *fdp,
+				       size_t block_num, uint8_t *tmp_block,
+				       uint8_t **block)
+{
+	struct tee_fs_htree_meta *meta = tee_fs_htree_get_meta(fdp->ht);
+
+	if (block_num * BLOCK_SIZE < ROUNDUP(meta->length, BLOCK_SIZE))
+		return read_block(fdp, block_num, block_num, 0, tmp_block,
+				  block);
+
+	*block = tmp_block;
+	memset(tmp_block, 0, BLOCK_SIZE);
+	return TEE_SUCCESS;
+}
+
+static TEE_Result update_block(struct tee_fs_fd *fdp, size_t block_num,
+			       uint8_t *tmp_block __unused, uint8_t *block)
+{
+	return tee_fs_htree_write_block(&fdp->ht, block_num, block);
+}
+
+static TEE_Result sync_to_storage(struct tee_fs_fd *fdp, uint8_t *hash)
+{
+	return tee_fs_htree_sync_to_storage(&fdp->ht, hash);
+}
+
+#ifdef CFG_WITH_STATS
+static void block_cache_get_stats(struct tee_ree_fs_stats *stats __unused)
+{
+}
+#endif
+#endif /*!CFG_REE_FS_BLOCK_CACHE*/
+
 static TEE_Result out_of_place_write(struct tee_fs_fd *fdp, size_t pos,
 				     const void *buf, size_t len)
 {
@@ -93,11 +526,12 @@ static TEE_Result out_of_place_write(struct tee_fs_fd *fdp, size_t pos,
 	size_t end_block_num = pos_to_block_num(pos + len - 1);
 	size_t remain_bytes = len;
 	uint8_t *data_ptr = (uint8_t *)buf;
+	uint8_t *tmp_block;
 	uint8_t *block;
 	struct tee_fs_htree_meta *meta = tee_fs_htree_get_meta(fdp->ht);
 
-	block = get_tmp_block();
-	if (!block)
+	tmp_block = get_tmp_block();
+	if (!tmp_block)
 		return TEE_ERROR_OUT_OF_MEMORY;
 
 	while (start_block_num <= end_block_num) {
@@ -107,23 +541,17 @@ static TEE_Result out_of_place_write(struct tee_fs_fd *fdp, size_t pos,
 		if (size_to_write + offset > BLOCK_SIZE)
 			size_to_write = BLOCK_SIZE - offset;
 
-		if (start_block_num * BLOCK_SIZE <
-		    ROUNDUP(meta->length, BLOCK_SIZE)) {
-			res = tee_fs_htree_read_block(&fdp->ht,
-						      start_block_num, block);
-			if (res != TEE_SUCCESS)
-				goto exit;
-		} else {
-			memset(block, 0, BLOCK_SIZE);
-		}
+		res = get_block_for_update(fdp, start_block_num, tmp_block,
+					   &block);
+		if (res != TEE_SUCCESS)
+			goto exit;
 
 		if (data_ptr)
 			memcpy(block + offset, data_ptr, size_to_write);
 		else
 			memset(block + offset, 0, size_to_write);
 
-		res = tee_fs_htree_write_block(&fdp->ht, start_block_num,
-					       block);
+		res = update_block(fdp, start_block_num, tmp_block, block);
 		if (res != TEE_SUCCESS)
 			goto exit;
 
@@ -140,8 +568,7 @@ static TEE_Result out_of_place_write(struct tee_fs_fd *fdp, size_t pos,
 	}
 
 exit:
-	if (block)
-		put_tmp_block(block);
+	put_tmp_block(tmp_block);
 	return res;
 }
 
@@ -264,12 +691,74 @@ static TEE_Result ree_fs_rpc_write_init(void *aux,
 				     offs, size, data);
 }
 
+static TEE_Result ree_fs_rpc_vec_init(struct tee_fs_fd *fdp, bool write,
+				      struct tee_fs_rpc_operation *op,
+				      enum tee_fs_htree_type type,
+				      const struct tee_fs_htree_rpc_elem *elem,
+				      size_t num_elem, void **data)
+{
+	struct optee_mrf_extent *ext;
+	TEE_Result res;
+	size_t offs;
+	size_t size;
+	size_t n;
+
+	/* All elements are of the same type and thus of the same size */
+	res = get_offs_size(type, elem[0].idx, elem[0].vers, &offs, &size);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	if (write)
+		res = tee_fs_rpc_writev_init(op, OPTEE_MSG_RPC_CMD_FS, fdp->fd,
+					     num_elem, num_elem * size, &ext,
+					     data);
+	else
+		res = tee_fs_rpc_readv_init(op, OPTEE_MSG_RPC_CMD_FS, fdp->fd,
+					    num_elem, num_elem * size, &ext,
+					    data);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	for (n = 0; n < num_elem; n++) {
+		res = get_offs_size(type, elem[n].idx, elem[n].vers, &offs,
+				    &size);
+		if (res != TEE_SUCCESS)
+			return res;
+		ext[n].offset = offs;
+		ext[n].length = size;
+	}
+
+	return TEE_SUCCESS;
+}
+
+static TEE_Result ree_fs_rpc_readv_init(void *aux,
+					struct tee_fs_rpc_operation *op,
+					enum tee_fs_htree_type type,
+					const struct tee_fs_htree_rpc_elem *elem,
+					size_t num_elem, void **data)
+{
+	return ree_fs_rpc_vec_init(aux, false, op, type, elem, num_elem, data);
+}
+
+static TEE_Result ree_fs_rpc_writev_init(void *aux,
+					 struct tee_fs_rpc_operation *op,
+					 enum tee_fs_htree_type type,
+					 const struct tee_fs_htree_rpc_elem *elem,
+					 size_t num_elem, void **data)
+{
+	return ree_fs_rpc_vec_init(aux, true, op, type, elem, num_elem, data);
+}
+
 static const struct tee_fs_htree_storage ree_fs_storage_ops = {
 	.block_size = BLOCK_SIZE,
 	.rpc_read_init = ree_fs_rpc_read_init,
 	.rpc_read_final = tee_fs_rpc_read_final,
 	.rpc_write_init = ree_fs_rpc_write_init,
 	.rpc_write_final = tee_fs_rpc_write_final,
+	.rpc_readv_init = ree_fs_rpc_readv_init,
+	.rpc_readv_final = tee_fs_rpc_readv_final,
+	.rpc_writev_init = ree_fs_rpc_writev_init,
+	.rpc_writev_final = tee_fs_rpc_writev_final,
 };
 
 static TEE_Result ree_fs_ftruncate_internal(struct tee_fs_fd *fdp,
@@ -294,6 +783,8 @@ static TEE_Result ree_fs_ftruncate_internal(struct tee_fs_fd *fdp,
 		if (res != TEE_SUCCESS)
 			return res;
 
+		block_cache_invalidate(fdp, ROUNDUP(new_file_len, BLOCK_SIZE) /
+					    BLOCK_SIZE);
 		res = tee_fs_htree_truncate(&fdp->ht,
 					    new_file_len / BLOCK_SIZE);
 		if (res != TEE_SUCCESS)
@@ -311,6 +802,75 @@ static TEE_Result ree_fs_ftruncate_internal(struct tee_fs_fd *fdp,
 	return TEE_SUCCESS;
 }
 
+#ifdef CFG_REE_FS_READ_AHEAD
+/*
+ * Returns the number of blocks to read ahead for a read of @len bytes at
+ * @pos. The read-ahead window is opened with one block when a read
+ * continues where the previous read of the file ended and is then
+ * doubled for each sequential read up to the size of the block cache.
+ * Any other access closes the window again.
+ */
+static size_t read_ahead_blocks(struct tee_fs_fd *fdp, size_t pos, size_t len)
+{
+	if (pos != fdp->ra_pos)
+		fdp->ra_window = 0;
+	else if (!fdp->ra_window)
+		fdp->ra_window = 1;
+	else
+		fdp->ra_window = MIN(fdp->ra_window * 2,
+				     (size_t)CFG_REE_FS_BLOCK_CACHE_SIZE);
+	fdp->ra_pos = pos + len;
+
+	set_readahead_window(fdp->ra_window);
+	return fdp->ra_window;
+}
+#else
+static size_t read_ahead_blocks(struct tee_fs_fd *fdp __unused,
+				size_t pos __unused, size_t len __unused)
+{
+	return 0;
+}
+#endif
+
+/*
+ * Reads up to @max_blocks whole blocks from @block_num which aren't
+ * cached and decrypts them straight into @buf, the destination buffer of
+ * the read, instead of via a temporary block or the block cache. *@num is
+ * updated with the number of blocks read, 0 if the first block is cached.
+ */
+static TEE_Result read_blocks_direct(struct tee_fs_fd *fdp, size_t block_num,
+				     size_t max_blocks, uint8_t *buf,
+				     size_t *num)
+{
+	void *blocks[TEE_FS_HTREE_RPC_MAX_ELEMS];
+	TEE_Result res;
+	size_t n;
+
+	max_blocks = MIN(max_blocks, ARRAY_SIZE(blocks));
+	for (n = 0; n < max_blocks; n++) {
+		if (block_is_cached(fdp, block_num + n))
+			break;
+		blocks[n] = buf + n * BLOCK_SIZE;
+	}
+
+	*num = n;
+	if (!n)
+		return TEE_SUCCESS;
+
+	res = tee_fs_htree_read_blocks(&fdp->ht, block_num, n, blocks);
+	if (res != TEE_SUCCESS) {
+		/* Don't leave data failing authentication in the buffer */
+		memset(buf, 0, n * BLOCK_SIZE);
+		block_cache_invalidate(fdp, 0);
+		return res;
+	}
+
+	for (n = 0; n < *num; n++)
+		incr_cache_misses();
+
+	return TEE_SUCCESS;
+}
+
 static TEE_Result ree_fs_read_primitive(struct tee_file_handle *fh, size_t pos,
 					void *buf, size_t *len)
 {
@@ -319,7 +879,10 @@ static TEE_Result ree_fs_read_primitive(struct tee_file_handle *fh, size_t pos,
 	int end_block_num;
 	size_t remain_bytes;
 	uint8_t *data_ptr = buf;
-	uint8_t *block = NULL;
+	uint8_t *tmp_block = NULL;
+	uint8_t *block;
+	size_t ra_blocks;
+	size_t num;
 	struct tee_fs_fd *fdp = (struct tee_fs_fd *)fh;
 	struct tee_fs_htree_meta *meta = tee_fs_htree_get_meta(fdp->ht);
 
@@ -338,9 +901,10 @@ static TEE_Result ree_fs_read_primitive(struct tee_file_handle *fh, size_t pos,
 
 	start_block_num = pos_to_block_num(pos);
 	end_block_num = pos_to_block_num(pos + remain_bytes - 1);
+	ra_blocks = read_ahead_blocks(fdp, pos, remain_bytes);
 
-	block = get_tmp_block();
-	if (!block) {
+	tmp_block = get_tmp_block();
+	if (!tmp_block) {
 		res = TEE_ERROR_OUT_OF_MEMORY;
 		goto exit;
 	}
@@ -352,7 +916,23 @@ static TEE_Result ree_fs_read_primitive(struct tee_file_handle *fh, size_t pos,
 		if (size_to_read + offset > BLOCK_SIZE)
 			size_to_read = BLOCK_SIZE - offset;
 
-		res = tee_fs_htree_read_block(&fdp->ht, start_block_num, block);
+		if (!offset && remain_bytes >= BLOCK_SIZE) {
+			res = read_blocks_direct(fdp, start_block_num,
+						 remain_bytes / BLOCK_SIZE,
+						 data_ptr, &num);
+			if (res != TEE_SUCCESS)
+				goto exit;
+			if (num) {
+				data_ptr += num * BLOCK_SIZE;
+				remain_bytes -= num * BLOCK_SIZE;
+				pos += num * BLOCK_SIZE;
+				start_block_num += num;
+				continue;
+			}
+		}
+
+		res = read_block(fdp, start_block_num, end_block_num,
+				 ra_blocks, tmp_block, &block);
 		if (res != TEE_SUCCESS)
 			goto exit;
 
@@ -366,8 +946,8 @@ static TEE_Result ree_fs_read_primitive(struct tee_file_handle *fh, size_t pos,
 	}
 	res = TEE_SUCCESS;
 exit:
-	if (block)
-		put_tmp_block(block);
+	if (tmp_block)
+		put_tmp_block(tmp_block);
 	return res;
 }
 
@@ -395,79 +975,568 @@ static TEE_Result ree_fs_write_primitive(struct tee_file_handle *fh, size_t pos,
 
 	file_size = tee_fs_htree_get_meta(fdp->ht)->length;
 
-	if ((pos + len) < len)
-		return TEE_ERROR_BAD_PARAMETERS;
+	if ((pos + len) < len)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	if (file_size < pos) {
+		res = ree_fs_ftruncate_internal(fdp, pos);
+		if (res != TEE_SUCCESS)
+			return res;
+	}
+
+	return out_of_place_write(fdp, pos, buf, len);
+}
+
+static TEE_Result ree_fs_open_primitive(bool create, uint8_t *hash,
+					const TEE_UUID *uuid,
+					struct tee_fs_dirfile_fileh *dfh,
+					struct tee_file_handle **fh)
+{
+	TEE_Result res;
+	struct tee_fs_fd *fdp;
+
+	fdp = calloc(1, sizeof(struct tee_fs_fd));
+	if (!fdp)
+		return TEE_ERROR_OUT_OF_MEMORY;
+	fdp->fd = -1;
+	fdp->uuid = uuid;
+
+	if (create)
+		res = tee_fs_rpc_create_dfh(OPTEE_MSG_RPC_CMD_FS,
+					    dfh, &fdp->fd);
+	else
+		res = tee_fs_rpc_open_dfh(OPTEE_MSG_RPC_CMD_FS, dfh, &fdp->fd);
+
+	if (res != TEE_SUCCESS)
+		goto out;
+
+	res = tee_fs_htree_open(create, hash, uuid, &ree_fs_storage_ops,
+				fdp, &fdp->ht);
+out:
+	if (res == TEE_SUCCESS) {
+		if (dfh)
+			fdp->dfh = *dfh;
+		else
+			fdp->dfh.idx = -1;
+		*fh = (struct tee_file_handle *)fdp;
+	} else {
+		if (fdp->fd != -1)
+			tee_fs_rpc_close(OPTEE_MSG_RPC_CMD_FS, fdp->fd);
+		if (create)
+			tee_fs_rpc_remove_dfh(OPTEE_MSG_RPC_CMD_FS, dfh);
+		free(fdp);
+	}
+
+	return res;
+}
+
+static void ree_fs_close_primitive(struct tee_file_handle *fh)
+{
+	struct tee_fs_fd *fdp = (struct tee_fs_fd *)fh;
+
+	if (fdp) {
+		block_cache_invalidate(fdp, 0);
+		tee_fs_htree_close(&fdp->ht);
+		tee_fs_rpc_close(OPTEE_MSG_RPC_CMD_FS, fdp->fd);
+		free(fdp);
+	}
+}
+
+#ifdef CFG_REE_FS_DIRF_JOURNAL
+#ifdef CFG_RPMB_FS
+#error "CFG_REE_FS_DIRF_JOURNAL isn't supported with CFG_RPMB_FS"
+#endif
+
+/*
+ * Updates of dirf.db are journaled in an append-only file instead of
+ * committing the hash tree of dirf.db each time. The journal is bound to
+ * the committed state of dirf.db it applies to and replayed on top of it
+ * when dirf.db is opened. Once CFG_REE_FS_DIRF_JOURNAL_RECORDS records have
+ * been appended the journal is compacted, that is, dirf.db is committed
+ * and the journal is reset.
+ *
+ * The journal file is saved as:
+ * +-------------------------+
+ * | struct dirf_journal_head |
+ * +-------------------------+
+ * | struct dirf_journal_rec  |
+ * | data of record          |
+ * +-------------------------+
+ * ...
+ *
+ * Each record is encrypted and authenticated with AES-GCM using a key
+ * stored encrypted with the TSK in the head. The tag of the previous
+ * record (or of the head for the first record) is included in the AAD of
+ * a record, chaining the records together. Replay stops at the first
+ * record which doesn't authenticate, that's the normal case when the last
+ * append was interrupted.
+ */
+#define DIRF_JOURNAL_FNAME		"dirf.jnl"
+#define DIRF_JOURNAL_ALG		TEE_ALG_AES_GCM
+#define DIRF_JOURNAL_KEY_SIZE		TEE_FS_KM_FEK_SIZE
+#define DIRF_JOURNAL_IV_SIZE		TEE_FS_HTREE_IV_SIZE
+#define DIRF_JOURNAL_TAG_SIZE		TEE_FS_HTREE_TAG_SIZE
+#define DIRF_JOURNAL_MAX_DATA		256
+#define DIRF_JOURNAL_MAX_PENDING	4
+
+struct dirf_journal_head {
+	uint8_t enc_key[DIRF_JOURNAL_KEY_SIZE];
+	uint8_t iv[DIRF_JOURNAL_IV_SIZE];
+	uint8_t tag[DIRF_JOURNAL_TAG_SIZE];
+	/* Encrypted hash of the committed dirf.db the journal applies to */
+	uint8_t base_hash[TEE_FS_HTREE_HASH_SIZE];
+};
+
+struct dirf_journal_rec {
+	uint32_t pos;
+	uint32_t len;
+	uint8_t iv[DIRF_JOURNAL_IV_SIZE];
+	uint8_t tag[DIRF_JOURNAL_TAG_SIZE];
+};
+
+#define DIRF_JOURNAL_MAX_SIZE \
+	(sizeof(struct dirf_journal_head) + CFG_REE_FS_DIRF_JOURNAL_RECORDS * \
+	 (sizeof(struct dirf_journal_rec) + DIRF_JOURNAL_MAX_DATA))
+
+struct dirf_journal_write {
+	uint32_t pos;
+	uint32_t len;
+	uint8_t data[DIRF_JOURNAL_MAX_DATA];
+};
+
+/*
+ * @end:		offset where the next record is appended
+ * @num_recs:		number of records in the journal
+ * @need_compact:	set when the pending writes can't be journaled
+ * @pending:		writes to dirf.db since the last commit
+ */
+struct dirf_journal {
+	int fd;
+	uint8_t key[DIRF_JOURNAL_KEY_SIZE];
+	uint8_t last_tag[DIRF_JOURNAL_TAG_SIZE];
+	size_t end;
+	size_t num_recs;
+	bool need_compact;
+	size_t num_pending;
+	struct dirf_journal_write pending[DIRF_JOURNAL_MAX_PENDING];
+};
+
+static TEE_Result journal_crypt(struct dirf_journal *jnl,
+				TEE_OperationMode mode, uint8_t *iv,
+				uint8_t *tag, const void *aad, size_t aad_len,
+				const void *in, void *out, size_t len)
+{
+	const uint32_t alg = DIRF_JOURNAL_ALG;
+	size_t tag_len = DIRF_JOURNAL_TAG_SIZE;
+	size_t out_len = len;
+	TEE_Result res;
+	void *ctx;
+
+	if (mode == TEE_MODE_ENCRYPT) {
+		res = crypto_rng_read(iv, DIRF_JOURNAL_IV_SIZE);
+		if (res != TEE_SUCCESS)
+			return res;
+	}
+
+	res = crypto_authenc_alloc_ctx(&ctx, alg);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	res = crypto_authenc_init(ctx, alg, mode, jnl->key, sizeof(jnl->key),
+				  iv, DIRF_JOURNAL_IV_SIZE,
+				  DIRF_JOURNAL_TAG_SIZE, aad_len, len);
+	if (res != TEE_SUCCESS)
+		goto out_free;
+
+	res = crypto_authenc_update_aad(ctx, alg, mode, aad, aad_len);
+	if (res != TEE_SUCCESS)
+		goto out;
+
+	if (mode == TEE_MODE_ENCRYPT)
+		res = crypto_authenc_enc_final(ctx, alg, in, len, out,
+					       &out_len, tag, &tag_len);
+	else
+		res = crypto_authenc_dec_final(ctx, alg, in, len, out,
+					       &out_len, tag, tag_len);
+	if (res == TEE_SUCCESS &&
+	    (out_len != len || tag_len != DIRF_JOURNAL_TAG_SIZE))
+		res = TEE_ERROR_GENERIC;
+	if (res == TEE_ERROR_MAC_INVALID)
+		res = TEE_ERROR_CORRUPT_OBJECT;
+out:
+	crypto_authenc_final(ctx, alg);
+out_free:
+	crypto_authenc_free_ctx(ctx, alg);
+	return res;
+}
+
+static TEE_Result journal_crypt_rec(struct dirf_journal *jnl,
+				    TEE_OperationMode mode,
+				    struct dirf_journal_rec *rec,
+				    const uint8_t *prev_tag, const void *in,
+				    void *out)
+{
+	uint8_t aad[DIRF_JOURNAL_TAG_SIZE + 2 * sizeof(uint32_t)];
+
+	memcpy(aad, prev_tag, DIRF_JOURNAL_TAG_SIZE);
+	memcpy(aad + DIRF_JOURNAL_TAG_SIZE, &rec->pos, sizeof(rec->pos));
+	memcpy(aad + DIRF_JOURNAL_TAG_SIZE + sizeof(rec->pos), &rec->len,
+	       sizeof(rec->len));
+
+	return journal_crypt(jnl, mode, rec->iv, rec->tag, aad, sizeof(aad),
+			     in, out, rec->len);
+}
+
+/* Starts an empty journal on top of the committed state of dirf.db */
+static TEE_Result journal_reset(struct tee_fs_fd *fdp)
+{
+	struct dirf_journal *jnl = fdp->jnl;
+	struct dirf_journal_head head;
+	uint8_t hash[TEE_FS_HTREE_HASH_SIZE];
+	struct tee_fs_rpc_operation op;
+	TEE_Result res;
+	void *p;
+
+	res = tee_fs_fek_crypt(NULL, TEE_MODE_ENCRYPT, jnl->key,
+			       sizeof(jnl->key), head.enc_key);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	tee_fs_htree_get_hash(fdp->ht, hash);
+	res = journal_crypt(jnl, TEE_MODE_ENCRYPT, head.iv, head.tag,
+			    head.enc_key, sizeof(head.enc_key), hash,
+			    head.base_hash, sizeof(hash));
+	if (res != TEE_SUCCESS)
+		return res;
+
+	res = tee_fs_rpc_write_init(&op, OPTEE_MSG_RPC_CMD_FS, jnl->fd, 0,
+				    sizeof(head), &p);
+	if (res != TEE_SUCCESS)
+		return res;
+	memcpy(p, &head, sizeof(head));
+	res = tee_fs_rpc_write_final(&op);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	/*
+	 * Records left behind if truncation fails are chained to the old
+	 * head and are ignored.
+	 */
+	res = tee_fs_rpc_truncate(OPTEE_MSG_RPC_CMD_FS, jnl->fd, sizeof(head));
+	if (res != TEE_SUCCESS)
+		return res;
+
+	memcpy(jnl->last_tag, head.tag, sizeof(head.tag));
+	jnl->end = sizeof(head);
+	jnl->num_recs = 0;
+	jnl->need_compact = false;
+	return TEE_SUCCESS;
+}
+
+/*
+ * Authenticates the journal in @buf of @len bytes and replays the records
+ * into dirf.db. Returns TEE_ERROR_CORRUPT_OBJECT if the journal doesn't
+ * apply to the committed state of dirf.db.
+ */
+static TEE_Result journal_replay(struct tee_fs_fd *fdp, uint8_t *buf,
+				 size_t len)
+{
+	struct dirf_journal *jnl = fdp->jnl;
+	struct dirf_journal_head head;
+	struct dirf_journal_rec rec;
+	uint8_t hash[TEE_FS_HTREE_HASH_SIZE];
+	uint8_t base_hash[TEE_FS_HTREE_HASH_SIZE];
+	uint8_t data[DIRF_JOURNAL_MAX_DATA];
+	TEE_Result res;
+	size_t offs;
+
+	if (len < sizeof(head))
+		return TEE_ERROR_CORRUPT_OBJECT;
+	memcpy(&head, buf, sizeof(head));
+
+	res = tee_fs_fek_crypt(NULL, TEE_MODE_DECRYPT, head.enc_key,
+			       sizeof(head.enc_key), jnl->key);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	res = journal_crypt(jnl, TEE_MODE_DECRYPT, head.iv, head.tag,
+			    head.enc_key, sizeof(head.enc_key), head.base_hash,
+			    base_hash, sizeof(base_hash));
+	if (res != TEE_SUCCESS)
+		return res;
+
+	/*
+	 * A journal based on another state of dirf.db is left over from
+	 * an interrupted compaction, its records are already committed.
+	 */
+	tee_fs_htree_get_hash(fdp->ht, hash);
+	if (buf_compare_ct(hash, base_hash, sizeof(hash)))
+		return TEE_ERROR_CORRUPT_OBJECT;
+
+	memcpy(jnl->last_tag, head.tag, sizeof(head.tag));
+	offs = sizeof(head);
+	while (len - offs >= sizeof(rec)) {
+		memcpy(&rec, buf + offs, sizeof(rec));
+		if (!rec.len || rec.len > sizeof(data) ||
+		    rec.len > len - offs - sizeof(rec))
+			break;
+
+		if (journal_crypt_rec(jnl, TEE_MODE_DECRYPT, &rec,
+				      jnl->last_tag, buf + offs + sizeof(rec),
+				      data))
+			break;
+
+		res = ree_fs_write_primitive((struct tee_file_handle *)fdp,
+					     rec.pos, data, rec.len);
+		if (res != TEE_SUCCESS)
+			return res;
+
+		memcpy(jnl->last_tag, rec.tag, sizeof(rec.tag));
+		offs += sizeof(rec) + rec.len;
+		jnl->num_recs++;
+	}
+
+	jnl->end = offs;
+	jnl->need_compact = jnl->num_recs >= CFG_REE_FS_DIRF_JOURNAL_RECORDS;
+
+	/* Drop a partially appended record, if any */
+	if (offs < len)
+		return tee_fs_rpc_truncate(OPTEE_MSG_RPC_CMD_FS, jnl->fd, offs);
+	return TEE_SUCCESS;
+}
+
+static TEE_Result journal_load(struct tee_fs_fd *fdp)
+{
+	struct dirf_journal *jnl = fdp->jnl;
+	struct tee_fs_rpc_operation op;
+	TEE_Result res;
+	uint8_t *buf;
+	size_t len;
+	void *p;
+
+	res = tee_fs_rpc_read_init(&op, OPTEE_MSG_RPC_CMD_FS, jnl->fd, 0,
+				   DIRF_JOURNAL_MAX_SIZE, &p);
+	if (res != TEE_SUCCESS)
+		return res;
+	res = tee_fs_rpc_read_final(&op, &len);
+	if (res != TEE_SUCCESS)
+		return res;
+	if (len > DIRF_JOURNAL_MAX_SIZE)
+		return TEE_ERROR_GENERIC;
+
+	/* Copy to secure memory before the content is authenticated */
+	buf = malloc(len);
+	if (!buf)
+		return TEE_ERROR_OUT_OF_MEMORY;
+	memcpy(buf, p, len);
+
+	res = journal_replay(fdp, buf, len);
+	free(buf);
+	return res;
+}
+
+static TEE_Result journal_open(struct tee_fs_fd *fdp, bool create)
+{
+	struct dirf_journal *jnl = calloc(1, sizeof(*jnl));
+	TEE_Result res;
+
+	if (!jnl)
+		return TEE_ERROR_OUT_OF_MEMORY;
+	fdp->jnl = jnl;
+
+	res = tee_fs_rpc_open_fname(OPTEE_MSG_RPC_CMD_FS, DIRF_JOURNAL_FNAME,
+				    &jnl->fd);
+	if (res == TEE_ERROR_ITEM_NOT_FOUND) {
+		create = true;
+		res = tee_fs_rpc_create_fname(OPTEE_MSG_RPC_CMD_FS,
+					      DIRF_JOURNAL_FNAME, &jnl->fd);
+	}
+	if (res != TEE_SUCCESS) {
+		free(jnl);
+		fdp->jnl = NULL;
+		return res;
+	}
+
+	if (!create) {
+		res = journal_load(fdp);
+		/* Otherwise nothing in the journal applies, start over */
+		if (res != TEE_ERROR_CORRUPT_OBJECT)
+			return res;
+	}
+
+	res = crypto_rng_read(jnl->key, sizeof(jnl->key));
+	if (res != TEE_SUCCESS)
+		return res;
+	return journal_reset(fdp);
+}
+
+static void journal_close(struct tee_fs_fd *fdp)
+{
+	if (fdp->jnl) {
+		tee_fs_rpc_close(OPTEE_MSG_RPC_CMD_FS, fdp->jnl->fd);
+		free(fdp->jnl);
+		fdp->jnl = NULL;
+	}
+}
+
+static void journal_add_write(struct tee_fs_fd *fdp, size_t pos,
+			      const void *buf, size_t len)
+{
+	struct dirf_journal *jnl = fdp->jnl;
+	struct dirf_journal_write *w;
+
+	if (!len)
+		return;
+
+	if (jnl->num_pending == ARRAY_SIZE(jnl->pending) ||
+	    len > sizeof(w->data) || pos > UINT32_MAX) {
+		jnl->need_compact = true;
+		return;
+	}
+
+	w = jnl->pending + jnl->num_pending;
+	w->pos = pos;
+	w->len = len;
+	memcpy(w->data, buf, len);
+	jnl->num_pending++;
+}
+
+/* Appends the pending writes to the journal with a single RPC */
+static TEE_Result journal_append(struct dirf_journal *jnl)
+{
+	uint8_t tag[DIRF_JOURNAL_TAG_SIZE];
+	struct tee_fs_rpc_operation op;
+	struct dirf_journal_rec rec;
+	struct dirf_journal_write *w;
+	TEE_Result res;
+	size_t len = 0;
+	size_t offs;
+	uint8_t *data;
+	size_t n;
+	void *p;
+
+	for (n = 0; n < jnl->num_pending; n++)
+		len += sizeof(rec) + jnl->pending[n].len;
+
+	res = tee_fs_rpc_write_init(&op, OPTEE_MSG_RPC_CMD_FS, jnl->fd,
+				    jnl->end, len, &p);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	data = p;
+	memcpy(tag, jnl->last_tag, sizeof(tag));
+	offs = 0;
+	for (n = 0; n < jnl->num_pending; n++) {
+		w = jnl->pending + n;
+		rec.pos = w->pos;
+		rec.len = w->len;
+		res = journal_crypt_rec(jnl, TEE_MODE_ENCRYPT, &rec, tag,
+					w->data, data + offs + sizeof(rec));
+		if (res != TEE_SUCCESS)
+			return res;
+		memcpy(data + offs, &rec, sizeof(rec));
+		memcpy(tag, rec.tag, sizeof(tag));
+		offs += sizeof(rec) + w->len;
+	}
+
+	res = tee_fs_rpc_write_final(&op);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	memcpy(jnl->last_tag, tag, sizeof(tag));
+	jnl->end += len;
+	jnl->num_recs += jnl->num_pending;
+	return TEE_SUCCESS;
+}
+
+static TEE_Result journal_commit(struct tee_fs_fd *fdp)
+{
+	struct dirf_journal *jnl = fdp->jnl;
+	TEE_Result res;
 
-	if (file_size < pos) {
-		res = ree_fs_ftruncate_internal(fdp, pos);
-		if (res != TEE_SUCCESS)
-			return res;
+	if (!jnl->need_compact && jnl->num_recs + jnl->num_pending <=
+				  CFG_REE_FS_DIRF_JOURNAL_RECORDS) {
+		res = journal_append(jnl);
+	} else {
+		res = sync_to_storage(fdp, fdp->dfh.hash);
+		if (res == TEE_SUCCESS)
+			res = journal_reset(fdp);
 	}
 
-	return out_of_place_write(fdp, pos, buf, len);
+	jnl->num_pending = 0;
+	return res;
 }
 
-static TEE_Result ree_fs_open_primitive(bool create, uint8_t *hash,
-					const TEE_UUID *uuid,
-					struct tee_fs_dirfile_fileh *dfh,
-					struct tee_file_handle **fh)
+static TEE_Result ree_dirf_open(bool create, uint8_t *hash,
+				const TEE_UUID *uuid,
+				struct tee_fs_dirfile_fileh *dfh,
+				struct tee_file_handle **fh)
 {
 	TEE_Result res;
-	struct tee_fs_fd *fdp;
 
-	fdp = calloc(1, sizeof(struct tee_fs_fd));
-	if (!fdp)
-		return TEE_ERROR_OUT_OF_MEMORY;
-	fdp->fd = -1;
-	fdp->uuid = uuid;
+	res = ree_fs_open_primitive(create, hash, uuid, dfh, fh);
+	if (res != TEE_SUCCESS)
+		return res;
 
-	if (create)
-		res = tee_fs_rpc_create_dfh(OPTEE_MSG_RPC_CMD_FS,
-					    dfh, &fdp->fd);
-	else
-		res = tee_fs_rpc_open_dfh(OPTEE_MSG_RPC_CMD_FS, dfh, &fdp->fd);
+	res = journal_open((struct tee_fs_fd *)*fh, create);
+	if (res != TEE_SUCCESS) {
+		journal_close((struct tee_fs_fd *)*fh);
+		ree_fs_close_primitive(*fh);
+		*fh = NULL;
+	}
 
-	if (res != TEE_SUCCESS)
-		goto out;
+	return res;
+}
 
-	res = tee_fs_htree_open(create, hash, uuid, &ree_fs_storage_ops,
-				fdp, &fdp->ht);
-out:
-	if (res == TEE_SUCCESS) {
-		if (dfh)
-			fdp->dfh = *dfh;
-		else
-			fdp->dfh.idx = -1;
-		*fh = (struct tee_file_handle *)fdp;
-	} else {
-		if (fdp->fd != -1)
-			tee_fs_rpc_close(OPTEE_MSG_RPC_CMD_FS, fdp->fd);
-		if (create)
-			tee_fs_rpc_remove_dfh(OPTEE_MSG_RPC_CMD_FS, dfh);
-		free(fdp);
+static void ree_dirf_close(struct tee_file_handle *fh)
+{
+	if (fh) {
+		journal_close((struct tee_fs_fd *)fh);
+		ree_fs_close_primitive(fh);
 	}
+}
+
+static TEE_Result ree_dirf_write(struct tee_file_handle *fh, size_t pos,
+				 const void *buf, size_t len)
+{
+	TEE_Result res;
+
+	res = ree_fs_write_primitive(fh, pos, buf, len);
+	if (res == TEE_SUCCESS)
+		journal_add_write((struct tee_fs_fd *)fh, pos, buf, len);
 
 	return res;
 }
 
-static void ree_fs_close_primitive(struct tee_file_handle *fh)
+static TEE_Result ree_dirf_commit_writes(struct tee_file_handle *fh,
+					 uint8_t *hash)
 {
+	TEE_Result res;
 	struct tee_fs_fd *fdp = (struct tee_fs_fd *)fh;
 
-	if (fdp) {
-		tee_fs_htree_close(&fdp->ht);
-		tee_fs_rpc_close(OPTEE_MSG_RPC_CMD_FS, fdp->fd);
-		free(fdp);
-	}
+	res = journal_commit(fdp);
+
+	if (!res && hash)
+		tee_fs_htree_get_hash(fdp->ht, hash);
+
+	return res;
 }
 
+static const struct tee_fs_dirfile_operations ree_dirf_ops = {
+	.open = ree_dirf_open,
+	.close = ree_dirf_close,
+	.read = ree_fs_read_primitive,
+	.write = ree_dirf_write,
+	.commit_writes = ree_dirf_commit_writes,
+};
+#else /*!CFG_REE_FS_DIRF_JOURNAL*/
 static TEE_Result ree_dirf_commit_writes(struct tee_file_handle *fh,
 					 uint8_t *hash)
 {
 	TEE_Result res;
 	struct tee_fs_fd *fdp = (struct tee_fs_fd *)fh;
 
-	res = tee_fs_htree_sync_to_storage(&fdp->ht, fdp->dfh.hash);
+	res = sync_to_storage(fdp, fdp->dfh.hash);
 
 	if (!res && hash)
 		memcpy(hash, fdp->dfh.hash, sizeof(fdp->dfh.hash));
@@ -482,6 +1551,7 @@ static const struct tee_fs_dirfile_operations ree_dirf_ops = {
 	.write = ree_fs_write_primitive,
 	.commit_writes = ree_dirf_commit_writes,
 };
+#endif /*!CFG_REE_FS_DIRF_JOURNAL*/
 
 static struct tee_fs_dirfile_dirh *ree_fs_dirh;
 static size_t ree_fs_dirh_refcount;
@@ -592,7 +1662,13 @@ static void put_dirh_primitive(bool close)
 	 * ree_fs_dirh may actually be NULL.
 	 */
 	ree_fs_dirh_refcount--;
-	if (ree_fs_dirh && (!ree_fs_dirh_refcount || close))
+	/*
+	 * dirf.db is kept open while unused since opening it again would
+	 * read every entry to rebuild the index, and replay the entire
+	 * journal with CFG_REE_FS_DIRF_JOURNAL. Every update is committed
+	 * before the fop returns so nothing is lost by keeping it.
+	 */
+	if (ree_fs_dirh && close)
 		close_dirh(&ree_fs_dirh);
 }
 
@@ -604,6 +1680,152 @@ static void put_dirh(struct tee_fs_dirfile_dirh *dirh, bool close)
 	}
 }
 
+/* Syncs the hash tree of @fdp and records its new hash in dirf.db */
+static TEE_Result commit_fd(struct tee_fs_dirfile_dirh *dirh,
+			    struct tee_fs_fd *fdp)
+{
+	TEE_Result res;
+
+	res = sync_to_storage(fdp, fdp->dfh.hash);
+	if (res)
+		return res;
+
+	res = tee_fs_dirfile_update_hash(dirh, &fdp->dfh);
+	if (res)
+		return res;
+
+	return commit_dirh_writes(dirh);
+}
+
+#ifdef CFG_REE_FS_ASYNC_COMMIT
+/*
+ * Deferred commits
+ *
+ * Committing an update of a file takes several RPCs: the hash tree is
+ * synced to storage and then dirf.db is updated and committed. With
+ * CFG_REE_FS_ASYNC_COMMIT a write or truncate only updates the hash tree
+ * and the block cache in secure memory and queues the file for commit.
+ * The commit is done when the file is synced or closed, before the
+ * object is opened through another handle, or after
+ * CFG_REE_FS_ASYNC_COMMIT_WRITES updates. Until then the object keeps
+ * its last committed state in storage, a reset loses the pending updates
+ * but never leaves a partially updated object.
+ */
+static TAILQ_HEAD(, tee_fs_fd) pending_fds =
+	TAILQ_HEAD_INITIALIZER(pending_fds);
+
+static void pending_remove(struct tee_fs_fd *fdp)
+{
+	if (fdp->pending_updates) {
+		TAILQ_REMOVE(&pending_fds, fdp, pending_link);
+		fdp->pending_updates = 0;
+	}
+}
+
+static TEE_Result commit_pending(struct tee_fs_dirfile_dirh *dirh,
+				 struct tee_fs_fd *fdp)
+{
+	if (!fdp->pending_updates)
+		return TEE_SUCCESS;
+
+	pending_remove(fdp);
+	return commit_fd(dirh, fdp);
+}
+
+/*
+ * Commits the pending updates of all handles of the file of @dfh, the
+ * hash in @dfh is updated accordingly.
+ */
+static TEE_Result commit_pending_dfh(struct tee_fs_dirfile_dirh *dirh,
+				     struct tee_fs_dirfile_fileh *dfh)
+{
+	TEE_Result res;
+	struct tee_fs_fd *fdp;
+	struct tee_fs_fd *next;
+
+	TAILQ_FOREACH_SAFE(fdp, &pending_fds, pending_link, next) {
+		if (fdp->dfh.idx != dfh->idx)
+			continue;
+		res = commit_pending(dirh, fdp);
+		if (res)
+			return res;
+		memcpy(dfh->hash, fdp->dfh.hash, sizeof(dfh->hash));
+	}
+
+	return TEE_SUCCESS;
+}
+
+/* Forgets the pending updates of a file which is about to be removed */
+static void drop_pending_dfh(const struct tee_fs_dirfile_fileh *dfh)
+{
+	struct tee_fs_fd *fdp;
+	struct tee_fs_fd *next;
+
+	TAILQ_FOREACH_SAFE(fdp, &pending_fds, pending_link, next)
+		if (fdp->dfh.idx == dfh->idx)
+			pending_remove(fdp);
+}
+
+static TEE_Result commit_update(struct tee_fs_dirfile_dirh *dirh,
+				struct tee_fs_fd *fdp)
+{
+	if (!fdp->pending_updates)
+		TAILQ_INSERT_TAIL(&pending_fds, fdp, pending_link);
+	fdp->pending_updates++;
+
+	if (fdp->pending_updates < CFG_REE_FS_ASYNC_COMMIT_WRITES)
+		return TEE_SUCCESS;
+
+	return commit_pending(dirh, fdp);
+}
+
+static void commit_on_close(struct tee_fs_fd *fdp)
+{
+	TEE_Result res;
+	struct tee_fs_dirfile_dirh *dirh = NULL;
+
+	if (!fdp->pending_updates)
+		return;
+
+	res = get_dirh(&dirh);
+	if (!res) {
+		res = commit_pending(dirh, fdp);
+		put_dirh(dirh, res);
+	}
+	pending_remove(fdp);
+
+	if (res)
+		EMSG("Failed to commit file: 0x%x", res);
+}
+#else /*!CFG_REE_FS_ASYNC_COMMIT*/
+static TEE_Result commit_pending(struct tee_fs_dirfile_dirh *dirh __unused,
+				 struct tee_fs_fd *fdp __unused)
+{
+	return TEE_SUCCESS;
+}
+
+static TEE_Result commit_pending_dfh(
+			struct tee_fs_dirfile_dirh *dirh __unused,
+			struct tee_fs_dirfile_fileh *dfh __unused)
+{
+	return TEE_SUCCESS;
+}
+
+static void drop_pending_dfh(const struct tee_fs_dirfile_fileh *dfh __unused)
+{
+}
+
+static TEE_Result commit_update(struct tee_fs_dirfile_dirh *dirh,
+				struct tee_fs_fd *fdp)
+{
+	return commit_fd(dirh, fdp);
+}
+
+static void commit_on_close(struct tee_fs_fd *fdp __unused)
+{
+}
+#endif /*!CFG_REE_FS_ASYNC_COMMIT*/
+
 static TEE_Result ree_fs_open(struct tee_pobj *po, size_t *size,
 			      struct tee_file_handle **fh)
 {
@@ -622,6 +1844,10 @@ static TEE_Result ree_fs_open(struct tee_pobj *po, size_t *size,
 	if (res != TEE_SUCCESS)
 		goto out;
 
+	res = commit_pending_dfh(dirh, &dfh);
+	if (res != TEE_SUCCESS)
+		goto out;
+
 	res = ree_fs_open_primitive(false, dfh.hash, &po->uuid, &dfh, fh);
 	if (res == TEE_ERROR_ITEM_NOT_FOUND) {
 		/*
@@ -656,8 +1882,10 @@ static TEE_Result set_name(struct tee_fs_dirfile_dirh *dirh,
 	if (!overwrite && !res)
 		return TEE_ERROR_ACCESS_CONFLICT;
 
-	if (!res)
+	if (!res) {
 		have_old_dfh = true;
+		drop_pending_dfh(&old_dfh);
+	}
 
 	/*
 	 * If old_dfh wasn't found, the idx will be -1 and
@@ -684,6 +1912,7 @@ static void ree_fs_close(struct tee_file_handle **fh)
 {
 	if (*fh) {
 		mutex_lock(&ree_fs_mutex);
+		commit_on_close((struct tee_fs_fd *)*fh);
 		put_dirh_primitive(false);
 		ree_fs_close_primitive(*fh);
 		*fh = NULL;
@@ -740,7 +1969,7 @@ static TEE_Result ree_fs_create(struct tee_pobj *po, bool overwrite,
 	}
 
 	fdp = (struct tee_fs_fd *)*fh;
-	res = tee_fs_htree_sync_to_storage(&fdp->ht, fdp->dfh.hash);
+	res = sync_to_storage(fdp, fdp->dfh.hash);
 	if (res)
 		goto out;
 
@@ -776,14 +2005,7 @@ static TEE_Result ree_fs_write(struct tee_file_handle *fh, size_t pos,
 	if (res)
 		goto out;
 
-	res = tee_fs_htree_sync_to_storage(&fdp->ht, fdp->dfh.hash);
-	if (res)
-		goto out;
-
-	res = tee_fs_dirfile_update_hash(dirh, &fdp->dfh);
-	if (res)
-		goto out;
-	res = commit_dirh_writes(dirh);
+	res = commit_update(dirh, fdp);
 out:
 	put_dirh(dirh, res);
 	mutex_unlock(&ree_fs_mutex);
@@ -825,6 +2047,7 @@ static TEE_Result ree_fs_rename(struct tee_pobj *old, struct tee_pobj *new,
 		goto out;
 
 	if (remove_dfh.idx != -1) {
+		drop_pending_dfh(&remove_dfh);
 		res = tee_fs_dirfile_remove(dirh, &remove_dfh);
 		if (res)
 			goto out;
@@ -845,6 +2068,24 @@ out:
 
 }
 
+static TEE_Result remove_file(struct tee_fs_dirfile_dirh *dirh,
+			      struct tee_fs_dirfile_fileh *dfh)
+{
+	TEE_Result res;
+
+	drop_pending_dfh(dfh);
+	res = tee_fs_dirfile_remove(dirh, dfh);
+	if (res)
+		return res;
+
+	res = commit_dirh_writes(dirh);
+	if (res)
+		return res;
+
+	tee_fs_rpc_remove_dfh(OPTEE_MSG_RPC_CMD_FS, dfh);
+	return TEE_SUCCESS;
+}
+
 static TEE_Result ree_fs_remove(struct tee_pobj *po)
 {
 	TEE_Result res;
@@ -861,16 +2102,10 @@ static TEE_Result ree_fs_remove(struct tee_pobj *po)
 	if (res)
 		goto out;
 
-	res = tee_fs_dirfile_remove(dirh, &dfh);
-	if (res)
-		goto out;
-
-	res = commit_dirh_writes(dirh);
+	res = remove_file(dirh, &dfh);
 	if (res)
 		goto out;
 
-	tee_fs_rpc_remove_dfh(OPTEE_MSG_RPC_CMD_FS, &dfh);
-
 	assert(tee_fs_dirfile_find(dirh, &po->uuid, po->obj_id, po->obj_id_len,
 				   &dfh));
 out:
@@ -896,14 +2131,26 @@ static TEE_Result ree_fs_truncate(struct tee_file_handle *fh, size_t len)
 	if (res)
 		goto out;
 
-	res = tee_fs_htree_sync_to_storage(&fdp->ht, fdp->dfh.hash);
-	if (res)
-		goto out;
+	res = commit_update(dirh, fdp);
+out:
+	put_dirh(dirh, res);
+	mutex_unlock(&ree_fs_mutex);
 
-	res = tee_fs_dirfile_update_hash(dirh, &fdp->dfh);
+	return res;
+}
+
+static TEE_Result ree_fs_sync(struct tee_file_handle *fh)
+{
+	TEE_Result res;
+	struct tee_fs_dirfile_dirh *dirh = NULL;
+
+	mutex_lock(&ree_fs_mutex);
+
+	res = get_dirh(&dirh);
 	if (res)
 		goto out;
-	res = commit_dirh_writes(dirh);
+
+	res = commit_pending(dirh, (struct tee_fs_fd *)fh);
 out:
 	put_dirh(dirh, res);
 	mutex_unlock(&ree_fs_mutex);
@@ -979,6 +2226,137 @@ static TEE_Result ree_fs_readdir_rpc(struct tee_fs_dir *d,
 	return res;
 }
 
+static TEE_Result verify_blocks(struct tee_fs_fd *fdp, size_t *block,
+				size_t max_blocks, size_t *bytes)
+{
+	struct tee_fs_htree_meta *meta = tee_fs_htree_get_meta(fdp->ht);
+	size_t num_blocks = ROUNDUP(meta->length, BLOCK_SIZE) / BLOCK_SIZE;
+	void *blocks[TEE_FS_HTREE_RPC_MAX_ELEMS];
+	TEE_Result res = TEE_SUCCESS;
+	uint8_t *tmp_block;
+	size_t end;
+	size_t n;
+
+	tmp_block = get_tmp_block();
+	if (!tmp_block)
+		return TEE_ERROR_OUT_OF_MEMORY;
+
+	/* Only the authentication matters, decrypt all into one block */
+	for (n = 0; n < ARRAY_SIZE(blocks); n++)
+		blocks[n] = tmp_block;
+
+	end = MIN(num_blocks, *block + max_blocks);
+	while (*block < end) {
+		n = MIN(end - *block, ARRAY_SIZE(blocks));
+		res = tee_fs_htree_read_blocks(&fdp->ht, *block, n, blocks);
+		if (res != TEE_SUCCESS)
+			break;
+		*block += n;
+		*bytes += n * BLOCK_SIZE;
+	}
+	if (res == TEE_SUCCESS && *block >= num_blocks)
+		*block = 0;
+
+	put_tmp_block(tmp_block);
+	return res;
+}
+
+TEE_Result tee_ree_fs_verify_next(struct tee_ree_fs_scrub *s,
+				  size_t max_blocks, bool remove_corrupt,
+				  size_t *bytes)
+{
+	TEE_Result res;
+	TEE_Result rm_res = TEE_SUCCESS;
+	struct tee_fs_dirfile_dirh *dirh = NULL;
+	struct tee_fs_dirfile_fileh dfh;
+	struct tee_file_handle *fh = NULL;
+	struct tee_pobj *po = NULL;
+	int idx;
+
+	mutex_lock(&ree_fs_mutex);
+
+	res = get_dirh(&dirh);
+	if (res != TEE_SUCCESS) {
+		/* Not to be mistaken for a corrupt file */
+		if (res == TEE_ERROR_CORRUPT_OBJECT)
+			res = TEE_ERROR_SECURITY;
+		goto out;
+	}
+
+	/* A file in progress is looked up again, it may have changed */
+	idx = s->block ? s->idx - 1 : s->idx;
+	s->oidlen = sizeof(s->oid);
+	res = tee_fs_dirfile_get_next_entry(dirh, &idx, &s->uuid, s->oid,
+					    &s->oidlen, &dfh);
+	if (res != TEE_SUCCESS)
+		goto out;
+
+	if (idx != s->idx || memcmp(dfh.hash, s->hash, sizeof(s->hash)))
+		s->block = 0;
+	s->idx = idx;
+	memcpy(s->hash, dfh.hash, sizeof(s->hash));
+	s->removed = false;
+
+	res = ree_fs_open_primitive(false, dfh.hash, &s->uuid, &dfh, &fh);
+	if (res == TEE_SUCCESS) {
+		res = verify_blocks((struct tee_fs_fd *)fh, &s->block,
+				    max_blocks, bytes);
+		ree_fs_close_primitive(fh);
+	}
+	/* A file listed in the directory file but missing is corrupt too */
+	if (res == TEE_ERROR_SECURITY || res == TEE_ERROR_ITEM_NOT_FOUND)
+		res = TEE_ERROR_CORRUPT_OBJECT;
+	if (res != TEE_ERROR_CORRUPT_OBJECT) {
+		/* Retry a file which failed before any block was verified */
+		if (res != TEE_SUCCESS && !s->block)
+			s->idx = idx - 1;
+		goto out;
+	}
+
+	s->block = 0;
+	/*
+	 * The file is removed while the REE FS is still locked so it
+	 * can't be replaced by a healthy file in between. Exclusive access
+	 * fails if a TA has the file open.
+	 */
+	if (remove_corrupt &&
+	    !tee_pobj_get(&s->uuid, s->oid, s->oidlen,
+			  TEE_DATA_FLAG_ACCESS_WRITE_META, false, &ree_fs_ops,
+			  &po)) {
+		rm_res = remove_file(dirh, &dfh);
+		tee_pobj_release(po);
+		s->removed = !rm_res;
+	}
+out:
+	put_dirh(dirh, rm_res);
+	mutex_unlock(&ree_fs_mutex);
+
+	return res;
+}
+
+#ifdef CFG_WITH_STATS
+void tee_ree_fs_get_stats(struct tee_ree_fs_stats *stats)
+{
+	mutex_lock(&ree_fs_mutex);
+
+	*stats = ree_fs_stats;
+	block_cache_get_stats(stats);
+
+	ree_fs_stats.cache_hits = 0;
+	ree_fs_stats.cache_misses = 0;
+	ree_fs_stats.cache_evictions = 0;
+	ree_fs_stats.cache_writebacks = 0;
+	ree_fs_stats.readahead_blocks = 0;
+
+	mutex_unlock(&ree_fs_mutex);
+}
+#else
+void tee_ree_fs_get_stats(struct tee_ree_fs_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+}
+#endif
+
 const struct tee_file_operations ree_fs_ops = {
 	.open = ree_fs_open,
 	.create = ree_fs_create,
@@ -986,6 +2364,7 @@ const struct tee_file_operations ree_fs_ops = {
 	.read = ree_fs_read,
 	.write = ree_fs_write,
 	.truncate = ree_fs_truncate,
+	.sync = ree_fs_sync,
 	.rename = ree_fs_rename,
 	.remove = ree_fs_remove,
 	.opendir = ree_fs_opendir_rpc,
@@ -75,6 +75,16 @@ struct rpmb_file_handle {
 	char filename[TEE_RPMB_FS_FILENAME_LENGTH];
 	/* Address for current entry in RPMB */
 	uint32_t rpmb_fat_address;
+	/* Generation of the FAT cache entry @fat_entry was read from */
+	uint32_t fat_gen;
+#ifdef CFG_RPMB_FS_WB_CACHE
+	/* Dirty extent, see write-back cache below */
+	bool write_back;
+	uint8_t *wb_data;
+	size_t wb_pos;
+	size_t wb_len;
+	TAILQ_ENTRY(rpmb_file_handle) wb_link;
+#endif
 };
 
 /**
@@ -1134,8 +1144,9 @@ static TEE_Result tee_rpmb_init(uint16_t dev_id)
 
 		memcpy(rpmb_ctx->cid, dev_info.cid, RPMB_EMMC_CID_SIZE);
 
-#ifdef RPMB_DRIVER_MULTIPLE_WRITE_FIXED
-		rpmb_ctx->rel_wr_blkcnt = dev_info.rel_wr_sec_c * 2;
+#ifdef CFG_RPMB_MULTI_BLOCK_WRITE
+		/* REL_WR_SEC_C is in units of 512 bytes, that is two blocks */
+		rpmb_ctx->rel_wr_blkcnt = MAX(dev_info.rel_wr_sec_c * 2, 1);
 #else
 		rpmb_ctx->rel_wr_blkcnt = 1;
 #endif
@@ -1508,6 +1519,7 @@ func_exit:
 
 static TEE_Result get_fat_start_address(uint32_t *addr);
 
+#if (TRACE_LEVEL >= TRACE_FLOW)
 static void dump_fat(void)
 {
 	TEE_Result res = TEE_ERROR_GENERIC;
@@ -1555,6 +1567,11 @@ static void dump_fat(void)
 out:
 	free(fat_entries);
 }
+#else
+static void dump_fat(void)
+{
+}
+#endif
 
 #if (TRACE_LEVEL >= TRACE_DEBUG)
 static void dump_fh(struct rpmb_file_handle *fh)
@@ -1587,6 +1604,381 @@ static struct rpmb_file_handle *alloc_file_handle(struct tee_pobj *po,
 	return fh;
 }
 
+/*
+ * FAT cache
+ *
+ * The layout of the FAT is cached in secure memory to avoid reading the
+ * entire FAT from RPMB for each file operation. Only the fields needed to
+ * manage the layout are cached, not the file names and keys, a FAT entry
+ * takes 256 bytes and caching them all would use too much of the core heap.
+ * Instead the active entries are indexed by a hash of the file name and a
+ * lookup reads only the entries with a matching hash to compare the name.
+ *
+ * The areas of RPMB used by the FAT and the files are kept allocated in
+ * a persistent pool, the free extent map, used to find room for a file
+ * which must be moved.
+ *
+ * The cache is valid as long as the RPMB write counter matches the value
+ * it had when the cache was last updated, any write not done by
+ * write_rpmb() or failing invalidates the cache which is then reloaded
+ * from RPMB on next use.
+ *
+ * All access is serialized by rpmb_mutex.
+ */
+#define FAT_CACHE_FREE		-2
+#define FAT_CACHE_END		-1
+#define FAT_CACHE_MIN_BUCKETS	16
+
+/*
+ * struct fat_cache_entry - cached part of a FAT entry
+ * @start_address:	as in struct rpmb_fat_entry
+ * @data_size:		as in struct rpmb_fat_entry
+ * @flags:		as in struct rpmb_fat_entry
+ * @hash:		hash of the file name if FILE_IS_ACTIVE
+ * @next:		next entry in the same bucket, FAT_CACHE_END if last or
+ *			FAT_CACHE_FREE if the entry isn't indexed
+ * @gen:		updated each time the entry changes
+ * @mm:			area of the file in the free extent map
+ */
+struct fat_cache_entry {
+	uint32_t start_address;
+	uint32_t data_size;
+	uint32_t flags;
+	uint32_t hash;
+	int next;
+	uint32_t gen;
+	tee_mm_entry_t *mm;
+};
+
+/*
+ * @ents:	one entry for each FAT entry up to and including the last
+ * @fat_mm:	area of the FAT in @pool
+ * @wr_cnt:	RPMB write counter when the cache was last updated
+ * @gen:	last generation assigned to an entry
+ */
+struct fat_cache {
+	bool valid;
+	uint32_t wr_cnt;
+	uint32_t gen;
+	struct fat_cache_entry *ents;
+	size_t num_ents;
+	int *buckets;
+	size_t nbuckets;
+	tee_mm_pool_t pool;
+	tee_mm_entry_t *fat_mm;
+};
+
+static struct fat_cache fat_cache;
+
+static bool fat_cache_is_valid(void)
+{
+	return fat_cache.valid && rpmb_ctx && rpmb_ctx->wr_cnt_synced &&
+	       fat_cache.wr_cnt == rpmb_ctx->wr_cnt;
+}
+
+static void fat_cache_invalidate(void)
+{
+	/*
+	 * The pool is kept until the cache is reloaded since callers may
+	 * still hold areas allocated from it.
+	 */
+	fat_cache.valid = false;
+}
+
+static uint32_t fat_cache_hash(const char *filename)
+{
+	uint32_t h = 2166136261;	/* FNV-1a */
+	const char *p;
+
+	for (p = filename; *p; p++)
+		h = (h ^ (uint8_t)*p) * 16777619;
+
+	return h;
+}
+
+static int *fat_cache_bucket(uint32_t hash)
+{
+	return fat_cache.buckets + (hash & (fat_cache.nbuckets - 1));
+}
+
+/* Buckets are kept sorted by entry index to find the first match first */
+static void fat_cache_link(size_t idx)
+{
+	struct fat_cache_entry *e = fat_cache.ents + idx;
+	int *p = fat_cache_bucket(e->hash);
+
+	while (*p != FAT_CACHE_END && *p < (int)idx)
+		p = &fat_cache.ents[*p].next;
+	e->next = *p;
+	*p = idx;
+}
+
+static void fat_cache_unlink(size_t idx)
+{
+	struct fat_cache_entry *e = fat_cache.ents + idx;
+	int *p;
+
+	if (e->next == FAT_CACHE_FREE)
+		return;
+
+	p = fat_cache_bucket(e->hash);
+	while (*p != (int)idx)
+		p = &fat_cache.ents[*p].next;
+	*p = e->next;
+	e->next = FAT_CACHE_FREE;
+}
+
+static TEE_Result fat_cache_rehash(void)
+{
+	size_t nbuckets = MAX(fat_cache.nbuckets,
+			      (size_t)FAT_CACHE_MIN_BUCKETS);
+	size_t n;
+	int *b;
+
+	while (nbuckets < fat_cache.num_ents)
+		nbuckets *= 2;
+	if (nbuckets == fat_cache.nbuckets)
+		return TEE_SUCCESS;
+
+	b = malloc(nbuckets * sizeof(*b));
+	if (!b)
+		return TEE_ERROR_OUT_OF_MEMORY;
+
+	free(fat_cache.buckets);
+	fat_cache.buckets = b;
+	fat_cache.nbuckets = nbuckets;
+	for (n = 0; n < nbuckets; n++)
+		b[n] = FAT_CACHE_END;
+
+	for (n = 0; n < fat_cache.num_ents; n++) {
+		fat_cache.ents[n].next = FAT_CACHE_FREE;
+		if (fat_cache.ents[n].flags & FILE_IS_ACTIVE)
+			fat_cache_link(n);
+	}
+
+	return TEE_SUCCESS;
+}
+
+static TEE_Result fat_cache_add_entry(void)
+{
+	struct fat_cache_entry *e;
+
+	e = realloc(fat_cache.ents, (fat_cache.num_ents + 1) * sizeof(*e));
+	if (!e)
+		return TEE_ERROR_OUT_OF_MEMORY;
+	fat_cache.ents = e;
+
+	e += fat_cache.num_ents;
+	memset(e, 0, sizeof(*e));
+	e->next = FAT_CACHE_FREE;
+	e->gen = ++fat_cache.gen;
+	fat_cache.num_ents++;
+
+	return fat_cache_rehash();
+}
+
+/* Adds the area of the file to the free extent map */
+static TEE_Result fat_cache_alloc_area(struct fat_cache_entry *e)
+{
+	tee_mm_entry_t *mm;
+
+	if (!(e->flags & FILE_IS_ACTIVE) || !e->data_size)
+		return TEE_SUCCESS;
+
+	/* Already allocated if the file was moved by the caller */
+	mm = tee_mm_find(&fat_cache.pool, e->start_address);
+	if (!mm || tee_mm_get_smem(mm) != e->start_address)
+		mm = tee_mm_alloc2(&fat_cache.pool, e->start_address,
+				   e->data_size);
+	if (!mm)
+		return TEE_ERROR_OUT_OF_MEMORY;
+
+	e->mm = mm;
+	return TEE_SUCCESS;
+}
+
+static void fat_cache_free(void)
+{
+	tee_mm_final(&fat_cache.pool);
+	free(fat_cache.ents);
+	free(fat_cache.buckets);
+	memset(&fat_cache, 0, sizeof(fat_cache));
+}
+
+static TEE_Result fat_cache_load(void)
+{
+	TEE_Result res;
+	struct rpmb_fat_entry *fat_entries = NULL;
+	struct fat_cache_entry *e;
+	uint32_t fat_address;
+	uint32_t gen = fat_cache.gen;
+	size_t size;
+	size_t i;
+
+	fat_cache_free();
+	fat_cache.gen = gen;
+
+	res = get_fat_start_address(&fat_address);
+	if (res != TEE_SUCCESS)
+		return res;
+
+	/* Upper memory allocation must be used for RPMB_FS. */
+	if (!tee_mm_init(&fat_cache.pool, RPMB_STORAGE_START_ADDRESS,
+			 fs_par->max_rpmb_address, RPMB_BLOCK_SIZE_SHIFT,
+			 TEE_MM_POOL_HI_ALLOC))
+		return TEE_ERROR_OUT_OF_MEMORY;
+
+	size = N_ENTRIES * sizeof(struct rpmb_fat_entry);
+	fat_entries = malloc(size);
+	if (!fat_entries) {
+		res = TEE_ERROR_OUT_OF_MEMORY;
+		goto out;
+	}
+
+	while (true) {
+		res = tee_rpmb_read(CFG_RPMB_FS_DEV_ID, fat_address,
+				    (uint8_t *)fat_entries, size, NULL, NULL);
+		if (res != TEE_SUCCESS)
+			goto out;
+
+		for (i = 0; i < N_ENTRIES; i++) {
+			res = fat_cache_add_entry();
+			if (res != TEE_SUCCESS)
+				goto out;
+
+			e = fat_cache.ents + fat_cache.num_ents - 1;
+			e->start_address = fat_entries[i].start_address;
+			e->data_size = fat_entries[i].data_size;
+			e->flags = fat_entries[i].flags;
+			if (e->flags & FILE_IS_ACTIVE) {
+				e->hash = fat_cache_hash(
+						fat_entries[i].filename);
+				fat_cache_link(fat_cache.num_ents - 1);
+			}
+
+			res = fat_cache_alloc_area(e);
+			if (res != TEE_SUCCESS)
+				goto out;
+
+			fat_address += sizeof(struct rpmb_fat_entry);
+			if (e->flags & FILE_IS_LAST_ENTRY)
+				goto last_entry_found;
+		}
+	}
+
+last_entry_found:
+	/* fat_address is just past the last entry */
+	fat_cache.fat_mm = tee_mm_alloc2(&fat_cache.pool,
+					 RPMB_STORAGE_START_ADDRESS,
+					 fat_address);
+	if (!fat_cache.fat_mm) {
+		res = TEE_ERROR_OUT_OF_MEMORY;
+		goto out;
+	}
+
+	fat_cache.wr_cnt = rpmb_ctx->wr_cnt;
+	fat_cache.valid = true;
+out:
+	free(fat_entries);
+	return res;
+}
+
+static size_t fat_cache_idx(uint32_t fat_address)
+{
+	return (fat_address - fs_par->fat_start_address) /
+	       sizeof(struct rpmb_fat_entry);
+}
+
+static uint32_t fat_cache_address(size_t idx)
+{
+	return fs_par->fat_start_address + idx * sizeof(struct rpmb_fat_entry);
+}
+
+/* Updates the cache after @fe has been written at @fat_address */
+static void fat_cache_update(uint32_t fat_address,
+			     const struct rpmb_fat_entry *fe, uint32_t *gen)
+{
+	size_t idx = fat_cache_idx(fat_address);
+	struct fat_cache_entry *e;
+
+	if (idx > fat_cache.num_ents ||
+	    (idx == fat_cache.num_ents && fat_cache_add_entry()))
+		goto err;
+
+	e = fat_cache.ents + idx;
+	fat_cache_unlink(idx);
+
+	if (e->flags != fe->flags || e->start_address != fe->start_address ||
+	    e->data_size != fe->data_size) {
+		if (e->mm) {
+			tee_mm_free(e->mm);
+			e->mm = NULL;
+		}
+		e->start_address = fe->start_address;
+		e->data_size = fe->data_size;
+		e->flags = fe->flags;
+		if (fat_cache_alloc_area(e))
+			goto err;
+	}
+
+	if (e->flags & FILE_IS_ACTIVE) {
+		e->hash = fat_cache_hash(fe->filename);
+		fat_cache_link(idx);
+	}
+
+	e->gen = ++fat_cache.gen;
+	*gen = e->gen;
+	return;
+err:
+	fat_cache_invalidate();
+}
+
+/*
+ * Extends the area of the FAT in the free extent map to make room for
+ * another entry.
+ */
+static TEE_Result fat_cache_grow_fat(void)
+{
+	uint32_t end = fat_cache_address(fat_cache.num_ents + 1);
+	tee_mm_entry_t *mm;
+
+	tee_mm_free(fat_cache.fat_mm);
+	mm = tee_mm_alloc2(&fat_cache.pool, RPMB_STORAGE_START_ADDRESS, end);
+	if (!mm) {
+		/* Some file is in the way, restore the old area */
+		end = fat_cache_address(fat_cache.num_ents);
+		mm = tee_mm_alloc2(&fat_cache.pool, RPMB_STORAGE_START_ADDRESS,
+				   end);
+		if (!mm)
+			fat_cache_invalidate();
+		fat_cache.fat_mm = mm;
+		return TEE_ERROR_OUT_OF_MEMORY;
+	}
+
+	fat_cache.fat_mm = mm;
+	return TEE_SUCCESS;
+}
+
+/*
+ * Write RPMB data on behalf of the file system, keeping the FAT cache
+ * valid.
+ */
+static TEE_Result write_rpmb(uint32_t addr, const uint8_t *data,
+			     uint32_t len, const uint8_t *fek,
+			     const TEE_UUID *uuid)
+{
+	bool cache_valid = fat_cache_is_valid();
+	TEE_Result res;
+
+	res = tee_rpmb_write(CFG_RPMB_FS_DEV_ID, addr, data, len, fek, uuid);
+	if (res == TEE_SUCCESS && cache_valid && rpmb_ctx->wr_cnt_synced)
+		fat_cache.wr_cnt = rpmb_ctx->wr_cnt;
+	else
+		fat_cache_invalidate();
+
+	return res;
+}
+
 /**
  * write_fat_entry: Store info in a fat_entry to RPMB.
  */
@@ -1613,9 +2005,11 @@ static TEE_Result write_fat_entry(struct rpmb_file_handle *fh,
 			goto out;
 	}
 
-	res = tee_rpmb_write(CFG_RPMB_FS_DEV_ID, fh->rpmb_fat_address,
-			     (uint8_t *)&fh->fat_entry,
-			     sizeof(struct rpmb_fat_entry), NULL, NULL);
+	res = write_rpmb(fh->rpmb_fat_address, (uint8_t *)&fh->fat_entry,
+			 sizeof(struct rpmb_fat_entry), NULL, NULL);
+	if (res == TEE_SUCCESS && fat_cache_is_valid())
+		fat_cache_update(fh->rpmb_fat_address, &fh->fat_entry,
+				 &fh->fat_gen);
 
 	dump_fat();
 
@@ -1695,9 +2089,8 @@ static TEE_Result rpmb_fs_setup(void)
 				       &partition_data->write_counter);
 	if (res != TEE_SUCCESS)
 		goto out;
-	res = tee_rpmb_write(CFG_RPMB_FS_DEV_ID, RPMB_STORAGE_START_ADDRESS,
-			     (uint8_t *)partition_data,
-			     sizeof(struct rpmb_fs_partition), NULL, NULL);
+	res = write_rpmb(RPMB_STORAGE_START_ADDRESS, (uint8_t *)partition_data,
+			 sizeof(struct rpmb_fs_partition), NULL, NULL);
 
 #ifndef CFG_RPMB_RESET_FAT
 store_fs_par:
@@ -1735,159 +2128,137 @@ static TEE_Result get_fat_start_address(uint32_t *addr)
 	return TEE_SUCCESS;
 }
 
-/**
- * read_fat: Read FAT entries
- * Return matching FAT entry for read, rm rename and stat.
- * Build up memory pool and return matching entry for write operation.
- * "Last FAT entry" can be returned during write.
- */
-static TEE_Result read_fat(struct rpmb_file_handle *fh, tee_mm_pool_t *p)
+static TEE_Result fat_cache_get(void)
 {
-	TEE_Result res = TEE_ERROR_GENERIC;
-	tee_mm_entry_t *mm = NULL;
-	struct rpmb_fat_entry *fat_entries = NULL;
-	uint32_t fat_address;
-	size_t size;
-	int i;
-	bool entry_found = false;
-	bool last_entry_found = false;
-	bool expand_fat = false;
-	struct rpmb_file_handle last_fh;
-
-	DMSG("fat_address %d", fh->rpmb_fat_address);
+	TEE_Result res;
 
 	res = rpmb_fs_setup();
 	if (res != TEE_SUCCESS)
-		goto out;
+		return res;
 
-	res = get_fat_start_address(&fat_address);
-	if (res != TEE_SUCCESS)
-		goto out;
+	if (fat_cache_is_valid())
+		return TEE_SUCCESS;
 
-	size = N_ENTRIES * sizeof(struct rpmb_fat_entry);
-	fat_entries = malloc(size);
-	if (!fat_entries) {
-		res = TEE_ERROR_OUT_OF_MEMORY;
-		goto out;
-	}
+	DMSG("Loading FAT cache");
+	return fat_cache_load();
+}
 
-	/*
-	 * The pool is used to represent the current RPMB layout. To find
-	 * a slot for the file tee_mm_alloc is called on the pool. Thus
-	 * if it is not NULL the entire FAT must be traversed to fill in
-	 * the pool.
-	 */
-	while (!last_entry_found && (!entry_found || p)) {
-		res = tee_rpmb_read(CFG_RPMB_FS_DEV_ID, fat_address,
-				    (uint8_t *)fat_entries, size, NULL, NULL);
+/*
+ * Returns true if the FAT cache entry of @fh is unchanged since
+ * @fh->fat_entry was read or written.
+ */
+static bool fat_cache_is_current(struct rpmb_file_handle *fh)
+{
+	size_t idx;
+
+	if (!fh->rpmb_fat_address)
+		return false;
+
+	idx = fat_cache_idx(fh->rpmb_fat_address);
+	return idx < fat_cache.num_ents &&
+	       fh->fat_gen == fat_cache.ents[idx].gen;
+}
+
+/*
+ * Picks the first unused FAT entry for a new file, expanding the FAT if
+ * it's the last entry.
+ */
+static TEE_Result alloc_fat_entry(struct rpmb_file_handle *fh)
+{
+	TEE_Result res;
+	struct rpmb_file_handle last_fh;
+	size_t idx;
+
+	for (idx = 0; idx < fat_cache.num_ents; idx++)
+		if (!(fat_cache.ents[idx].flags & FILE_IS_ACTIVE))
+			break;
+	if (idx == fat_cache.num_ents)
+		return TEE_ERROR_GENERIC;
+
+	if (fat_cache.ents[idx].flags & FILE_IS_LAST_ENTRY) {
+		res = fat_cache_grow_fat();
 		if (res != TEE_SUCCESS)
-			goto out;
+			return res;
 
-		for (i = 0; i < N_ENTRIES; i++) {
-			/*
-			 * Look for an entry, matching filenames. (read, rm,
-			 * rename and stat.). Only store first filename match.
-			 */
-			if (fh->filename &&
-			    (strcmp(fh->filename,
-				    fat_entries[i].filename) == 0) &&
-			    (fat_entries[i].flags & FILE_IS_ACTIVE) &&
-			    (!entry_found)) {
-				entry_found = true;
-				fh->rpmb_fat_address = fat_address;
-				memcpy(&fh->fat_entry, &fat_entries[i],
-				       sizeof(struct rpmb_fat_entry));
-				if (!p)
-					break;
-			}
+		memset(&last_fh, 0, sizeof(last_fh));
+		last_fh.fat_entry.flags = FILE_IS_LAST_ENTRY;
+		last_fh.rpmb_fat_address = fat_cache_address(idx + 1);
+		res = write_fat_entry(&last_fh, true);
+		if (res != TEE_SUCCESS)
+			return res;
+	}
 
-			/* Add existing files to memory pool. (write) */
-			if (p) {
-				if ((fat_entries[i].flags & FILE_IS_ACTIVE) &&
-				    (fat_entries[i].data_size > 0)) {
+	fh->rpmb_fat_address = fat_cache_address(idx);
+	memset(&fh->fat_entry, 0, sizeof(fh->fat_entry));
+	fh->fat_gen = fat_cache.ents[idx].gen;
 
-					mm = tee_mm_alloc2
-						(p,
-						 fat_entries[i].start_address,
-						 fat_entries[i].data_size);
-					if (!mm) {
-						res = TEE_ERROR_OUT_OF_MEMORY;
-						goto out;
-					}
-				}
+	return TEE_SUCCESS;
+}
 
-				/* Unused FAT entries can be reused (write) */
-				if (((fat_entries[i].flags & FILE_IS_ACTIVE) ==
-				     0) && (fh->rpmb_fat_address == 0)) {
-					fh->rpmb_fat_address = fat_address;
-					memcpy(&fh->fat_entry, &fat_entries[i],
-					       sizeof(struct rpmb_fat_entry));
-				}
-			}
+/**
+ * read_fat: Read FAT entry
+ * Return matching FAT entry for read, rm rename and stat.
+ * With @alloc (write) an unused FAT entry is returned if there's no match,
+ * the FAT is expanded if needed.
+ */
+static TEE_Result read_fat(struct rpmb_file_handle *fh, bool alloc)
+{
+	TEE_Result res = TEE_ERROR_GENERIC;
+	struct rpmb_fat_entry fe;
+	struct fat_cache_entry *e;
+	bool reloaded = false;
+	uint32_t hash;
+	int idx;
 
-			if ((fat_entries[i].flags & FILE_IS_LAST_ENTRY) != 0) {
-				last_entry_found = true;
+	DMSG("fat_address %d", fh->rpmb_fat_address);
 
-				/*
-				 * If the last entry was reached and was chosen
-				 * by the previous check, then the FAT needs to
-				 * be expanded.
-				 * fh->rpmb_fat_address is the address chosen
-				 * to store the files FAT entry and fat_address
-				 * is the current FAT entry address being
-				 * compared.
-				 */
-				if (p && fh->rpmb_fat_address == fat_address)
-					expand_fat = true;
-				break;
-			}
+again:
+	res = fat_cache_get();
+	if (res != TEE_SUCCESS)
+		return res;
 
-			/* Move to next fat_entry. */
-			fat_address += sizeof(struct rpmb_fat_entry);
-		}
-	}
+	if (fat_cache_is_current(fh))
+		return TEE_SUCCESS;
 
-	/*
-	 * Represent the FAT table in the pool.
-	 */
-	if (p) {
-		/*
-		 * Since fat_address is the start of the last entry it needs to
-		 * be moved up by an entry.
-		 */
-		fat_address += sizeof(struct rpmb_fat_entry);
+	hash = fat_cache_hash(fh->filename);
+	for (idx = *fat_cache_bucket(hash); idx != FAT_CACHE_END;
+	     idx = e->next) {
+		e = fat_cache.ents + idx;
+		if (e->hash != hash)
+			continue;
 
-		/* Make room for yet a FAT entry and add to memory pool. */
-		if (expand_fat)
-			fat_address += sizeof(struct rpmb_fat_entry);
+		res = tee_rpmb_read(CFG_RPMB_FS_DEV_ID, fat_cache_address(idx),
+				    (uint8_t *)&fe, sizeof(fe), NULL, NULL);
+		if (res != TEE_SUCCESS)
+			return res;
 
-		mm = tee_mm_alloc2(p, RPMB_STORAGE_START_ADDRESS, fat_address);
-		if (!mm) {
-			res = TEE_ERROR_OUT_OF_MEMORY;
-			goto out;
+		if (fe.flags != e->flags ||
+		    fe.start_address != e->start_address ||
+		    fe.data_size != e->data_size) {
+			/* Only a stale cache can get here */
+			if (reloaded)
+				return TEE_ERROR_GENERIC;
+			fat_cache_invalidate();
+			reloaded = true;
+			goto again;
 		}
 
-		if (expand_fat) {
-			/*
-			 * Point fat_address to the beginning of the new
-			 * entry.
-			 */
-			fat_address -= sizeof(struct rpmb_fat_entry);
-			memset(&last_fh, 0, sizeof(last_fh));
-			last_fh.fat_entry.flags = FILE_IS_LAST_ENTRY;
-			last_fh.rpmb_fat_address = fat_address;
-			res = write_fat_entry(&last_fh, true);
-			if (res != TEE_SUCCESS)
-				goto out;
+		if (!strcmp(fh->filename, fe.filename)) {
+			fh->rpmb_fat_address = fat_cache_address(idx);
+			fh->fat_entry = fe;
+			fh->fat_gen = e->gen;
+			return TEE_SUCCESS;
 		}
 	}
 
-	if (fh->filename && !fh->rpmb_fat_address)
-		res = TEE_ERROR_ITEM_NOT_FOUND;
+	/* Unused FAT entries can be reused (write) */
+	if (alloc && !fh->rpmb_fat_address)
+		return alloc_fat_entry(fh);
 
-out:
-	free(fat_entries);
-	return res;
+	if (!fh->rpmb_fat_address)
+		return TEE_ERROR_ITEM_NOT_FOUND;
+
+	return TEE_SUCCESS;
 }
 
 static TEE_Result generate_fek(struct rpmb_fat_entry *fe, const TEE_UUID *uuid)
@@ -1905,11 +2276,226 @@ again:
 	return res;
 }
 
+static TEE_Result rpmb_fs_write_primitive(struct rpmb_file_handle *fh,
+					  size_t pos, const void *buf,
+					  size_t size);
+
+#ifdef CFG_RPMB_FS_WB_CACHE
+/*
+ * Write-back cache
+ *
+ * Each authenticated write to RPMB is slow and, unless it can be done
+ * in-place, also moves the file and updates its FAT entry. A TA updating
+ * a small counter many times would pay that for each update, so writes
+ * through handles of TA objects are kept in secure memory as one dirty
+ * extent per handle which is written with rpmb_fs_write_primitive()
+ * later. Each flush is as atomic as a direct write would be, but data
+ * not yet flushed is lost if the device is reset.
+ *
+ * The extent of a handle is flushed when the handle is closed or
+ * truncated, when a write doesn't overlap or extend it, when the total
+ * amount of dirty data would exceed CFG_RPMB_FS_WB_CACHE_SIZE and before
+ * another handle accesses or renames the same file. Dirty data of a
+ * removed file is dropped. Raw files (tee_rpmb_fs_raw_open()) are always
+ * written through since they protect other storage against rollback.
+ */
+static TAILQ_HEAD(, rpmb_file_handle) wb_dirty_fhs =
+	TAILQ_HEAD_INITIALIZER(wb_dirty_fhs);
+static size_t wb_dirty_bytes;
+
+static void wb_discard(struct rpmb_file_handle *fh)
+{
+	if (!fh->wb_len)
+		return;
+
+	TAILQ_REMOVE(&wb_dirty_fhs, fh, wb_link);
+	wb_dirty_bytes -= fh->wb_len;
+	free(fh->wb_data);
+	fh->wb_data = NULL;
+	fh->wb_pos = 0;
+	fh->wb_len = 0;
+}
+
+static TEE_Result wb_flush(struct rpmb_file_handle *fh)
+{
+	TEE_Result res;
+
+	if (!fh->wb_len)
+		return TEE_SUCCESS;
+
+	res = rpmb_fs_write_primitive(fh, fh->wb_pos, fh->wb_data,
+				      fh->wb_len);
+	/* Like a failed direct write the data is lost on error */
+	wb_discard(fh);
+	return res;
+}
+
+/* Flushes the dirty data of all handles of @filename except @skip */
+static TEE_Result wb_flush_file(const char *filename,
+				struct rpmb_file_handle *skip)
+{
+	TEE_Result res;
+	struct rpmb_file_handle *fh;
+	struct rpmb_file_handle *next;
+
+	TAILQ_FOREACH_SAFE(fh, &wb_dirty_fhs, wb_link, next) {
+		if (fh == skip || strcmp(fh->filename, filename))
+			continue;
+		res = wb_flush(fh);
+		if (res)
+			return res;
+	}
+
+	return TEE_SUCCESS;
+}
+
+static void wb_discard_file(const char *filename)
+{
+	struct rpmb_file_handle *fh;
+	struct rpmb_file_handle *next;
+
+	TAILQ_FOREACH_SAFE(fh, &wb_dirty_fhs, wb_link, next)
+		if (!strcmp(fh->filename, filename))
+			wb_discard(fh);
+}
+
+static TEE_Result wb_write(struct rpmb_file_handle *fh, size_t pos,
+			   const void *buf, size_t size)
+{
+	TEE_Result res;
+	size_t start = pos;
+	size_t end = pos + size;
+	uint8_t *data = NULL;
+
+	if (!fh->write_back || !size)
+		return rpmb_fs_write_primitive(fh, pos, buf, size);
+
+	if (fh->wb_len) {
+		if (end < fh->wb_pos || start > fh->wb_pos + fh->wb_len) {
+			/* Not contiguous with the dirty extent */
+			res = wb_flush(fh);
+			if (res)
+				return res;
+		} else {
+			start = MIN(start, fh->wb_pos);
+			end = MAX(end, fh->wb_pos + fh->wb_len);
+		}
+	}
+
+	if (wb_dirty_bytes - fh->wb_len + end - start >
+	    CFG_RPMB_FS_WB_CACHE_SIZE) {
+		res = wb_flush(fh);
+		if (res)
+			return res;
+		if (wb_dirty_bytes + size > CFG_RPMB_FS_WB_CACHE_SIZE)
+			return rpmb_fs_write_primitive(fh, pos, buf, size);
+		start = pos;
+		end = pos + size;
+	}
+
+	if (end - start == fh->wb_len) {
+		/* Inside the dirty extent */
+		memcpy(fh->wb_data + pos - start, buf, size);
+		return TEE_SUCCESS;
+	}
+
+	data = malloc(end - start);
+	if (!data) {
+		res = wb_flush(fh);
+		if (res)
+			return res;
+		return rpmb_fs_write_primitive(fh, pos, buf, size);
+	}
+
+	if (fh->wb_len) {
+		memcpy(data + fh->wb_pos - start, fh->wb_data, fh->wb_len);
+		free(fh->wb_data);
+		wb_dirty_bytes -= fh->wb_len;
+	} else {
+		TAILQ_INSERT_TAIL(&wb_dirty_fhs, fh, wb_link);
+	}
+	memcpy(data + pos - start, buf, size);
+
+	fh->wb_data = data;
+	fh->wb_pos = start;
+	fh->wb_len = end - start;
+	wb_dirty_bytes += fh->wb_len;
+
+	return TEE_SUCCESS;
+}
+
+/* Copies the part of the dirty extent in [@pos, @pos + @size) to @buf */
+static void wb_read(struct rpmb_file_handle *fh, size_t pos, void *buf,
+		    size_t size)
+{
+	size_t start = MAX(pos, fh->wb_pos);
+	size_t end = MIN(pos + size, fh->wb_pos + fh->wb_len);
+
+	if (!fh->wb_len || start >= end)
+		return;
+
+	memcpy((uint8_t *)buf + start - pos, fh->wb_data + start - fh->wb_pos,
+	       end - start);
+}
+
+static size_t wb_file_size(struct rpmb_file_handle *fh)
+{
+	if (!fh->wb_len)
+		return fh->fat_entry.data_size;
+
+	return MAX(fh->fat_entry.data_size, fh->wb_pos + fh->wb_len);
+}
+
+static void wb_close(struct rpmb_file_handle *fh)
+{
+	TEE_Result res;
+
+	/* The close of a file which was never created passes NULL */
+	if (!fh)
+		return;
+
+	mutex_lock(&rpmb_mutex);
+	res = wb_flush(fh);
+	mutex_unlock(&rpmb_mutex);
+
+	if (res)
+		EMSG("Failed to write back %s: 0x%x", fh->filename, res);
+}
+#else
+static TEE_Result wb_flush_file(const char *filename __unused,
+				struct rpmb_file_handle *skip __unused)
+{
+	return TEE_SUCCESS;
+}
+
+static void wb_discard_file(const char *filename __unused)
+{
+}
+
+static TEE_Result wb_write(struct rpmb_file_handle *fh, size_t pos,
+			   const void *buf, size_t size)
+{
+	return rpmb_fs_write_primitive(fh, pos, buf, size);
+}
+
+static void wb_read(struct rpmb_file_handle *fh __unused, size_t pos __unused,
+		    void *buf __unused, size_t size __unused)
+{
+}
+
+static size_t wb_file_size(struct rpmb_file_handle *fh)
+{
+	return fh->fat_entry.data_size;
+}
+
+static void wb_close(struct rpmb_file_handle *fh __unused)
+{
+}
+#endif /*CFG_RPMB_FS_WB_CACHE*/
+
 static TEE_Result rpmb_fs_open_internal(struct rpmb_file_handle *fh,
 					const TEE_UUID *uuid, bool create)
 {
-	tee_mm_pool_t p;
-	bool pool_result;
 	TEE_Result res = TEE_ERROR_GENERIC;
 
 	/* We need to do setup in order to make sure fs_par is filled in */
@@ -1918,28 +2504,9 @@ static TEE_Result rpmb_fs_open_internal(struct rpmb_file_handle *fh,
 		goto out;
 
 	fh->uuid = uuid;
-	if (create) {
-		/* Upper memory allocation must be used for RPMB_FS. */
-		pool_result = tee_mm_init(&p,
-					  RPMB_STORAGE_START_ADDRESS,
-					  fs_par->max_rpmb_address,
-					  RPMB_BLOCK_SIZE_SHIFT,
-					  TEE_MM_POOL_HI_ALLOC);
-
-		if (!pool_result) {
-			res = TEE_ERROR_OUT_OF_MEMORY;
-			goto out;
-		}
-
-		res = read_fat(fh, &p);
-		tee_mm_final(&p);
-		if (res != TEE_SUCCESS)
-			goto out;
-	} else {
-		res = read_fat(fh, NULL);
-		if (res != TEE_SUCCESS)
-			goto out;
-	}
+	res = read_fat(fh, create);
+	if (res != TEE_SUCCESS)
+		goto out;
 
 	/*
 	 * If this is opened with create and the entry found was not active
@@ -1977,6 +2544,7 @@ static void rpmb_fs_close(struct tee_file_handle **tfh)
 {
 	struct rpmb_file_handle *fh = (struct rpmb_file_handle *)*tfh;
 
+	wb_close(fh);
 	free(fh);
 	*tfh = NULL;
 }
@@ -1987,6 +2555,8 @@ static TEE_Result rpmb_fs_read(struct tee_file_handle *tfh, size_t pos,
 	TEE_Result res;
 	struct rpmb_file_handle *fh = (struct rpmb_file_handle *)tfh;
 	size_t size = *len;
+	size_t file_size;
+	size_t rpmb_size = 0;
 
 	if (!size)
 		return TEE_SUCCESS;
@@ -1995,23 +2565,33 @@ static TEE_Result rpmb_fs_read(struct tee_file_handle *tfh, size_t pos,
 
 	dump_fh(fh);
 
-	res = read_fat(fh, NULL);
+	res = wb_flush_file(fh->filename, fh);
+	if (res != TEE_SUCCESS)
+		goto out;
+
+	res = read_fat(fh, false);
 	if (res != TEE_SUCCESS)
 		goto out;
 
-	if (pos >= fh->fat_entry.data_size) {
+	file_size = wb_file_size(fh);
+	if (pos >= file_size) {
 		*len = 0;
 		goto out;
 	}
 
-	size = MIN(size, fh->fat_entry.data_size - pos);
-	if (size) {
+	size = MIN(size, file_size - pos);
+	if (pos < fh->fat_entry.data_size)
+		rpmb_size = MIN(size, fh->fat_entry.data_size - pos);
+	if (rpmb_size) {
 		res = tee_rpmb_read(CFG_RPMB_FS_DEV_ID,
 				    fh->fat_entry.start_address + pos, buf,
-				    size, fh->fat_entry.fek, fh->uuid);
+				    rpmb_size, fh->fat_entry.fek, fh->uuid);
 		if (res != TEE_SUCCESS)
 			goto out;
 	}
+	/* A gap before data not yet written back reads as zeroes */
+	memset((uint8_t *)buf + rpmb_size, 0, size - rpmb_size);
+	wb_read(fh, pos, buf, size);
 	*len = size;
 
 out:
@@ -2024,9 +2604,7 @@ static TEE_Result rpmb_fs_write_primitive(struct rpmb_file_handle *fh,
 					  size_t size)
 {
 	TEE_Result res;
-	tee_mm_pool_t p;
-	bool pool_result = false;
-	tee_mm_entry_t *mm;
+	tee_mm_entry_t *mm = NULL;
 	size_t end;
 	size_t newsize;
 	uint8_t *newbuf = NULL;
@@ -2043,18 +2621,7 @@ static TEE_Result rpmb_fs_write_primitive(struct rpmb_file_handle *fh,
 
 	dump_fh(fh);
 
-	/* Upper memory allocation must be used for RPMB_FS. */
-	pool_result = tee_mm_init(&p,
-				  RPMB_STORAGE_START_ADDRESS,
-				  fs_par->max_rpmb_address,
-				  RPMB_BLOCK_SIZE_SHIFT,
-				  TEE_MM_POOL_HI_ALLOC);
-	if (!pool_result) {
-		res = TEE_ERROR_OUT_OF_MEMORY;
-		goto out;
-	}
-
-	res = read_fat(fh, &p);
+	res = read_fat(fh, false);
 	if (res != TEE_SUCCESS)
 		goto out;
 
@@ -2068,8 +2635,8 @@ static TEE_Result rpmb_fs_write_primitive(struct rpmb_file_handle *fh,
 	    tee_rpmb_write_is_atomic(CFG_RPMB_FS_DEV_ID, start_addr, size)) {
 
 		DMSG("Updating data in-place");
-		res = tee_rpmb_write(CFG_RPMB_FS_DEV_ID, start_addr, buf,
-				     size, fh->fat_entry.fek, fh->uuid);
+		res = write_rpmb(start_addr, buf, size, fh->fat_entry.fek,
+				 fh->uuid);
 		if (res != TEE_SUCCESS)
 			goto out;
 	} else {
@@ -2080,40 +2647,55 @@ static TEE_Result rpmb_fs_write_primitive(struct rpmb_file_handle *fh,
 
 		DMSG("Need to re-allocate");
 		newsize = MAX(end, fh->fat_entry.data_size);
-		mm = tee_mm_alloc(&p, newsize);
-		newbuf = calloc(1, newsize);
-		if (!mm || !newbuf) {
+		mm = tee_mm_alloc(&fat_cache.pool, newsize);
+		if (!mm) {
 			res = TEE_ERROR_OUT_OF_MEMORY;
 			goto out;
 		}
+		newaddr = tee_mm_get_smem(mm);
 
-		if (fh->fat_entry.data_size) {
-			res = tee_rpmb_read(CFG_RPMB_FS_DEV_ID,
-					    fh->fat_entry.start_address,
-					    newbuf, fh->fat_entry.data_size,
-					    fh->fat_entry.fek, fh->uuid);
+		if (!pos && newsize == size) {
+			/* All of the file is replaced, nothing to merge */
+			res = write_rpmb(newaddr, buf, size, fh->fat_entry.fek,
+					 fh->uuid);
 			if (res != TEE_SUCCESS)
 				goto out;
-		}
+		} else {
+			newbuf = calloc(1, newsize);
+			if (!newbuf) {
+				res = TEE_ERROR_OUT_OF_MEMORY;
+				goto out;
+			}
 
-		memcpy(newbuf + pos, buf, size);
+			if (fh->fat_entry.data_size) {
+				res = tee_rpmb_read(CFG_RPMB_FS_DEV_ID,
+						fh->fat_entry.start_address,
+						newbuf, fh->fat_entry.data_size,
+						fh->fat_entry.fek, fh->uuid);
+				if (res != TEE_SUCCESS)
+					goto out;
+			}
 
-		newaddr = tee_mm_get_smem(mm);
-		res = tee_rpmb_write(CFG_RPMB_FS_DEV_ID, newaddr, newbuf,
-				     newsize, fh->fat_entry.fek, fh->uuid);
-		if (res != TEE_SUCCESS)
-			goto out;
+			memcpy(newbuf + pos, buf, size);
+
+			res = write_rpmb(newaddr, newbuf, newsize,
+					 fh->fat_entry.fek, fh->uuid);
+			if (res != TEE_SUCCESS)
+				goto out;
+		}
 
 		fh->fat_entry.data_size = newsize;
 		fh->fat_entry.start_address = newaddr;
 		res = write_fat_entry(fh, true);
 		if (res != TEE_SUCCESS)
 			goto out;
+		/* The area is now tracked by the FAT cache */
+		mm = NULL;
 	}
 
 out:
-	if (pool_result)
-		tee_mm_final(&p);
+	if (mm)
+		tee_mm_free(mm);
 	if (newbuf)
 		free(newbuf);
 
@@ -2124,10 +2706,12 @@ static TEE_Result rpmb_fs_write(struct tee_file_handle *tfh, size_t pos,
 				const void *buf, size_t size)
 {
 	TEE_Result res;
+	struct rpmb_file_handle *fh = (struct rpmb_file_handle *)tfh;
 
 	mutex_lock(&rpmb_mutex);
-	res = rpmb_fs_write_primitive((struct rpmb_file_handle *)tfh, pos,
-				      buf, size);
+	res = wb_flush_file(fh->filename, fh);
+	if (!res)
+		res = wb_write(fh, pos, buf, size);
 	mutex_unlock(&rpmb_mutex);
 
 	return res;
@@ -2137,7 +2721,7 @@ static TEE_Result rpmb_fs_remove_internal(struct rpmb_file_handle *fh)
 {
 	TEE_Result res;
 
-	res = read_fat(fh, NULL);
+	res = read_fat(fh, false);
 	if (res)
 		return res;
 
@@ -2156,6 +2740,7 @@ static TEE_Result rpmb_fs_remove(struct tee_pobj *po)
 
 	mutex_lock(&rpmb_mutex);
 
+	wb_discard_file(fh->filename);
 	res = rpmb_fs_remove_internal(fh);
 
 	mutex_unlock(&rpmb_mutex);
@@ -2195,11 +2780,15 @@ static  TEE_Result rpmb_fs_rename_internal(struct tee_pobj *old,
 		goto out;
 	}
 
-	res = read_fat(fh_old, NULL);
+	res = wb_flush_file(fh_old->filename, NULL);
+	if (res != TEE_SUCCESS)
+		goto out;
+
+	res = read_fat(fh_old, false);
 	if (res != TEE_SUCCESS)
 		goto out;
 
-	res = read_fat(fh_new, NULL);
+	res = read_fat(fh_new, false);
 	if (res == TEE_SUCCESS) {
 		if (!overwrite) {
 			res = TEE_ERROR_ACCESS_CONFLICT;
@@ -2207,6 +2796,7 @@ static  TEE_Result rpmb_fs_rename_internal(struct tee_pobj *old,
 		}
 
 		/* Clear this file entry. */
+		wb_discard_file(fh_new->filename);
 		memset(&fh_new->fat_entry, 0, sizeof(struct rpmb_fat_entry));
 		res = write_fat_entry(fh_new, false);
 		if (res != TEE_SUCCESS)
@@ -2238,12 +2828,22 @@ static  TEE_Result rpmb_fs_rename(struct tee_pobj *old, struct tee_pobj *new,
 	return res;
 }
 
+static TEE_Result rpmb_fs_sync(struct tee_file_handle *tfh)
+{
+	struct rpmb_file_handle *fh = (struct rpmb_file_handle *)tfh;
+	TEE_Result res;
+
+	mutex_lock(&rpmb_mutex);
+	res = wb_flush_file(fh->filename, NULL);
+	mutex_unlock(&rpmb_mutex);
+
+	return res;
+}
+
 static TEE_Result rpmb_fs_truncate(struct tee_file_handle *tfh, size_t length)
 {
 	struct rpmb_file_handle *fh = (struct rpmb_file_handle *)tfh;
-	tee_mm_pool_t p;
-	bool pool_result = false;
-	tee_mm_entry_t *mm;
+	tee_mm_entry_t *mm = NULL;
 	uint32_t newsize;
 	uint8_t *newbuf = NULL;
 	uintptr_t newaddr;
@@ -2257,27 +2857,18 @@ static TEE_Result rpmb_fs_truncate(struct tee_file_handle *tfh, size_t length)
 	}
 	newsize = length;
 
-	res = read_fat(fh, NULL);
+	res = wb_flush_file(fh->filename, NULL);
+	if (res != TEE_SUCCESS)
+		goto out;
+
+	res = read_fat(fh, false);
 	if (res != TEE_SUCCESS)
 		goto out;
 
 	if (newsize > fh->fat_entry.data_size) {
 		/* Extend file */
 
-		pool_result = tee_mm_init(&p,
-					  RPMB_STORAGE_START_ADDRESS,
-					  fs_par->max_rpmb_address,
-					  RPMB_BLOCK_SIZE_SHIFT,
-					  TEE_MM_POOL_HI_ALLOC);
-		if (!pool_result) {
-			res = TEE_ERROR_OUT_OF_MEMORY;
-			goto out;
-		}
-		res = read_fat(fh, &p);
-		if (res != TEE_SUCCESS)
-			goto out;
-
-		mm = tee_mm_alloc(&p, newsize);
+		mm = tee_mm_alloc(&fat_cache.pool, newsize);
 		newbuf = calloc(1, newsize);
 		if (!mm || !newbuf) {
 			res = TEE_ERROR_OUT_OF_MEMORY;
@@ -2294,8 +2885,8 @@ static TEE_Result rpmb_fs_truncate(struct tee_file_handle *tfh, size_t length)
 		}
 
 		newaddr = tee_mm_get_smem(mm);
-		res = tee_rpmb_write(CFG_RPMB_FS_DEV_ID, newaddr, newbuf,
-				     newsize, fh->fat_entry.fek, fh->uuid);
+		res = write_rpmb(newaddr, newbuf, newsize, fh->fat_entry.fek,
+				 fh->uuid);
 		if (res != TEE_SUCCESS)
 			goto out;
 
@@ -2308,11 +2899,13 @@ static TEE_Result rpmb_fs_truncate(struct tee_file_handle *tfh, size_t length)
 	fh->fat_entry.data_size = newsize;
 	fh->fat_entry.start_address = newaddr;
 	res = write_fat_entry(fh, true);
+	if (res == TEE_SUCCESS)
+		mm = NULL;
 
 out:
+	if (mm)
+		tee_mm_free(mm);
 	mutex_unlock(&rpmb_mutex);
-	if (pool_result)
-		tee_mm_final(&p);
 	if (newbuf)
 		free(newbuf);
 
@@ -2519,9 +3112,14 @@ static TEE_Result rpmb_fs_open(struct tee_pobj *po, size_t *size,
 
 	mutex_lock(&rpmb_mutex);
 
-	res = rpmb_fs_open_internal(fh, &po->uuid, false);
+	res = wb_flush_file(fh->filename, NULL);
+	if (!res)
+		res = rpmb_fs_open_internal(fh, &po->uuid, false);
 	if (!res && size)
 		*size = fh->fat_entry.data_size;
+#ifdef CFG_RPMB_FS_WB_CACHE
+	fh->write_back = true;
+#endif
 
 	mutex_unlock(&rpmb_mutex);
 
@@ -2541,36 +3139,52 @@ static TEE_Result rpmb_fs_create(struct tee_pobj *po, bool overwrite,
 {
 	TEE_Result res;
 	size_t pos = 0;
+	uint8_t *buf = NULL;
 	struct rpmb_file_handle *fh = alloc_file_handle(po, po->temporary);
 
 	if (!fh)
 		return TEE_ERROR_OUT_OF_MEMORY;
 
-	mutex_lock(&rpmb_mutex);
-	res = rpmb_fs_open_internal(fh, &po->uuid, true);
-	if (res)
-		goto out;
+	if (!head)
+		head_size = 0;
+	if (!attr)
+		attr_size = 0;
+	if (!data)
+		data_size = 0;
 
-	if (head && head_size) {
-		res = rpmb_fs_write_primitive(fh, pos, head, head_size);
-		if (res)
-			goto out;
+	/*
+	 * Each write to the new file moves it to a larger area, so write
+	 * all parts at once.
+	 */
+	if (head_size + attr_size + data_size) {
+		buf = malloc(head_size + attr_size + data_size);
+		if (!buf) {
+			free(fh);
+			return TEE_ERROR_OUT_OF_MEMORY;
+		}
+	}
+	if (head_size) {
+		memcpy(buf, head, head_size);
 		pos += head_size;
 	}
-
-	if (attr && attr_size) {
-		res = rpmb_fs_write_primitive(fh, pos, attr, attr_size);
-		if (res)
-			goto out;
+	if (attr_size) {
+		memcpy(buf + pos, attr, attr_size);
 		pos += attr_size;
 	}
-
-	if (data && data_size) {
-		res = rpmb_fs_write_primitive(fh, pos, data, data_size);
-		if (res)
-			goto out;
+	if (data_size) {
+		memcpy(buf + pos, data, data_size);
+		pos += data_size;
 	}
 
+	mutex_lock(&rpmb_mutex);
+	res = rpmb_fs_open_internal(fh, &po->uuid, true);
+	if (res)
+		goto out;
+
+	res = rpmb_fs_write_primitive(fh, 0, buf, pos);
+	if (res)
+		goto out;
+
 	if (po->temporary) {
 		/*
 		 * If it's a temporary filename (which it normally is)
@@ -2594,9 +3208,13 @@ out:
 		rpmb_fs_remove_internal(fh);
 		free(fh);
 	} else {
+#ifdef CFG_RPMB_FS_WB_CACHE
+		fh->write_back = true;
+#endif
 		*ret_fh = (struct tee_file_handle *)fh;
 	}
 	mutex_unlock(&rpmb_mutex);
+	free(buf);
 
 	return res;
 }
@@ -2608,6 +3226,7 @@ const struct tee_file_operations rpmb_fs_ops = {
 	.read = rpmb_fs_read,
 	.write = rpmb_fs_write,
 	.truncate = rpmb_fs_truncate,
+	.sync = rpmb_fs_sync,
 	.rename = rpmb_fs_rename,
 	.remove = rpmb_fs_remove,
 	.opendir = rpmb_fs_opendir,
@@ -2643,3 +3262,24 @@ TEE_Result tee_rpmb_fs_raw_open(const char *fname, bool create,
 
 	return res;
 }
+
+TEE_Result tee_rpmb_fs_raw_remove(const char *fname)
+{
+	TEE_Result res;
+	struct rpmb_file_handle *fh = calloc(1, sizeof(*fh));
+
+	if (!fh)
+		return TEE_ERROR_OUT_OF_MEMORY;
+
+	snprintf(fh->filename, sizeof(fh->filename), "/%s", fname);
+
+	mutex_lock(&rpmb_mutex);
+
+	wb_discard_file(fh->filename);
+	res = rpmb_fs_remove_internal(fh);
+
+	mutex_unlock(&rpmb_mutex);
+
+	free(fh);
+	return res;
+}
@@ -35,10 +35,11 @@
 typedef void (*tee_cryp_ctx_finalize_func_t) (void *ctx, uint32_t algo);
 struct tee_cryp_state {
 	TAILQ_ENTRY(tee_cryp_state) link;
+	uint32_t id;
 	uint32_t algo;
 	uint32_t mode;
-	vaddr_t key1;
-	vaddr_t key2;
+	uint32_t key1;
+	uint32_t key2;
 	void *ctx;
 	tee_cryp_ctx_finalize_func_t ctx_finalize;
 };
@@ -836,8 +837,7 @@ TEE_Result syscall_cryp_obj_get_info(unsigned long obj, TEE_ObjectInfo *info)
 	if (res != TEE_SUCCESS)
 		goto exit;
 
-	res = tee_obj_get(to_user_ta_ctx(sess->ctx),
-			  tee_svc_uref_to_vaddr(obj), &o);
+	res = tee_obj_get(to_user_ta_ctx(sess->ctx), obj, &o);
 	if (res != TEE_SUCCESS)
 		goto exit;
 
@@ -858,8 +858,7 @@ TEE_Result syscall_cryp_obj_restrict_usage(unsigned long obj,
 	if (res != TEE_SUCCESS)
 		goto exit;
 
-	res = tee_obj_get(to_user_ta_ctx(sess->ctx),
-			  tee_svc_uref_to_vaddr(obj), &o);
+	res = tee_obj_get(to_user_ta_ctx(sess->ctx), obj, &o);
 	if (res != TEE_SUCCESS)
 		goto exit;
 
@@ -934,8 +933,7 @@ TEE_Result syscall_cryp_obj_get_attr(unsigned long obj, unsigned long attr_id,
 	if (res != TEE_SUCCESS)
 		return res;
 
-	res = tee_obj_get(to_user_ta_ctx(sess->ctx),
-			  tee_svc_uref_to_vaddr(obj), &o);
+	res = tee_obj_get(to_user_ta_ctx(sess->ctx), obj, &o);
 	if (res != TEE_SUCCESS)
 		return TEE_ERROR_ITEM_NOT_FOUND;
 
@@ -1243,9 +1241,13 @@ TEE_Result syscall_cryp_obj_alloc(unsigned long obj_type,
 		return res;
 	}
 
-	tee_obj_add(to_user_ta_ctx(sess->ctx), o);
+	res = tee_obj_add(to_user_ta_ctx(sess->ctx), o);
+	if (res != TEE_SUCCESS) {
+		tee_obj_free(o);
+		return res;
+	}
 
-	res = tee_svc_copy_kaddr_to_uref(obj, o);
+	res = tee_svc_copy_to_user(obj, &o->id, sizeof(o->id));
 	if (res != TEE_SUCCESS)
 		tee_obj_close(to_user_ta_ctx(sess->ctx), o);
 	return res;
@@ -1261,8 +1263,7 @@ TEE_Result syscall_cryp_obj_close(unsigned long obj)
 	if (res != TEE_SUCCESS)
 		return res;
 
-	res = tee_obj_get(to_user_ta_ctx(sess->ctx),
-			  tee_svc_uref_to_vaddr(obj), &o);
+	res = tee_obj_get(to_user_ta_ctx(sess->ctx), obj, &o);
 	if (res != TEE_SUCCESS)
 		return res;
 
@@ -1287,8 +1288,7 @@ TEE_Result syscall_cryp_obj_reset(unsigned long obj)
 	if (res != TEE_SUCCESS)
 		return res;
 
-	res = tee_obj_get(to_user_ta_ctx(sess->ctx),
-			  tee_svc_uref_to_vaddr(obj), &o);
+	res = tee_obj_get(to_user_ta_ctx(sess->ctx), obj, &o);
 	if (res != TEE_SUCCESS)
 		return res;
 
@@ -1533,8 +1533,7 @@ TEE_Result syscall_cryp_obj_populate(unsigned long obj,
 	if (res != TEE_SUCCESS)
 		return res;
 
-	res = tee_obj_get(to_user_ta_ctx(sess->ctx),
-			  tee_svc_uref_to_vaddr(obj), &o);
+	res = tee_obj_get(to_user_ta_ctx(sess->ctx), obj, &o);
 	if (res != TEE_SUCCESS)
 		return res;
 
@@ -1583,13 +1582,11 @@ TEE_Result syscall_cryp_obj_copy(unsigned long dst, unsigned long src)
 	if (res != TEE_SUCCESS)
 		return res;
 
-	res = tee_obj_get(to_user_ta_ctx(sess->ctx),
-			  tee_svc_uref_to_vaddr(dst), &dst_o);
+	res = tee_obj_get(to_user_ta_ctx(sess->ctx), dst, &dst_o);
 	if (res != TEE_SUCCESS)
 		return res;
 
-	res = tee_obj_get(to_user_ta_ctx(sess->ctx),
-			  tee_svc_uref_to_vaddr(src), &src_o);
+	res = tee_obj_get(to_user_ta_ctx(sess->ctx), src, &src_o);
 	if (res != TEE_SUCCESS)
 		return res;
 
@@ -1729,8 +1726,7 @@ TEE_Result syscall_obj_generate_key(unsigned long obj, unsigned long key_size,
 	if (res != TEE_SUCCESS)
 		return res;
 
-	res = tee_obj_get(to_user_ta_ctx(sess->ctx),
-			  tee_svc_uref_to_vaddr(obj), &o);
+	res = tee_obj_get(to_user_ta_ctx(sess->ctx), obj, &o);
 	if (res != TEE_SUCCESS)
 		return res;
 
@@ -1848,20 +1844,31 @@ out:
 	return res;
 }
 
+/*
+ * Like objects, see tee_obj_add(), the id of a state is its handle in
+ * utc->cryp_state_handles plus one.
+ */
+TEE_Result tee_cryp_state_get(struct user_ta_ctx *utc, uint32_t state_id,
+			      struct tee_cryp_state **state)
+{
+	struct tee_cryp_state *s;
+
+	if (!state_id)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	s = handle_lookup(&utc->cryp_state_handles, state_id - 1);
+	if (!s)
+		return TEE_ERROR_BAD_PARAMETERS;
+
+	*state = s;
+	return TEE_SUCCESS;
+}
+
 static TEE_Result tee_svc_cryp_get_state(struct tee_ta_session *sess,
 					 uint32_t state_id,
 					 struct tee_cryp_state **state)
 {
-	struct tee_cryp_state *s;
-	struct user_ta_ctx *utc = to_user_ta_ctx(sess->ctx);
-
-	TAILQ_FOREACH(s, &utc->cryp_states, link) {
-		if (state_id == (vaddr_t)s) {
-			*state = s;
-			return TEE_SUCCESS;
-		}
-	}
-	return TEE_ERROR_BAD_PARAMETERS;
+	return tee_cryp_state_get(to_user_ta_ctx(sess->ctx), state_id, state);
 }
 
 static void cryp_state_free(struct user_ta_ctx *utc, struct tee_cryp_state *cs)
@@ -1874,6 +1881,7 @@ static void cryp_state_free(struct user_ta_ctx *utc, struct tee_cryp_state *cs)
 		tee_obj_close(utc, o);
 
 	TAILQ_REMOVE(&utc->cryp_states, cs, link);
+	handle_put(&utc->cryp_state_handles, cs->id - 1);
 	if (cs->ctx_finalize != NULL)
 		cs->ctx_finalize(cs->ctx, cs->algo);
 
@@ -1988,6 +1996,7 @@ TEE_Result syscall_cryp_state_alloc(unsigned long algo, unsigned long mode,
 	struct tee_obj *o1 = NULL;
 	struct tee_obj *o2 = NULL;
 	struct user_ta_ctx *utc;
+	int h;
 
 	res = tee_ta_get_current_session(&sess);
 	if (res != TEE_SUCCESS)
@@ -1995,7 +2004,7 @@ TEE_Result syscall_cryp_state_alloc(unsigned long algo, unsigned long mode,
 	utc = to_user_ta_ctx(sess->ctx);
 
 	if (key1 != 0) {
-		res = tee_obj_get(utc, tee_svc_uref_to_vaddr(key1), &o1);
+		res = tee_obj_get(utc, key1, &o1);
 		if (res != TEE_SUCCESS)
 			return res;
 		if (o1->busy)
@@ -2005,7 +2014,7 @@ TEE_Result syscall_cryp_state_alloc(unsigned long algo, unsigned long mode,
 			return res;
 	}
 	if (key2 != 0) {
-		res = tee_obj_get(utc, tee_svc_uref_to_vaddr(key2), &o2);
+		res = tee_obj_get(utc, key2, &o2);
 		if (res != TEE_SUCCESS)
 			return res;
 		if (o2->busy)
@@ -2018,6 +2027,12 @@ TEE_Result syscall_cryp_state_alloc(unsigned long algo, unsigned long mode,
 	cs = calloc(1, sizeof(struct tee_cryp_state));
 	if (!cs)
 		return TEE_ERROR_OUT_OF_MEMORY;
+	h = handle_get(&utc->cryp_state_handles, cs);
+	if (h < 0) {
+		free(cs);
+		return TEE_ERROR_OUT_OF_MEMORY;
+	}
+	cs->id = h + 1;
 	TAILQ_INSERT_TAIL(&utc->cryp_states, cs, link);
 	cs->algo = algo;
 	cs->mode = mode;
@@ -2076,18 +2091,18 @@ TEE_Result syscall_cryp_state_alloc(unsigned long algo, unsigned long mode,
 	if (res != TEE_SUCCESS)
 		goto out;
 
-	res = tee_svc_copy_kaddr_to_uref(state, cs);
+	res = tee_svc_copy_to_user(state, &cs->id, sizeof(cs->id));
 	if (res != TEE_SUCCESS)
 		goto out;
 
 	/* Register keys */
 	if (o1 != NULL) {
 		o1->busy = true;
-		cs->key1 = (vaddr_t)o1;
+		cs->key1 = o1->id;
 	}
 	if (o2 != NULL) {
 		o2->busy = true;
-		cs->key2 = (vaddr_t)o2;
+		cs->key2 = o2->id;
 	}
 
 out:
@@ -2107,11 +2122,11 @@ TEE_Result syscall_cryp_state_copy(unsigned long dst, unsigned long src)
 	if (res != TEE_SUCCESS)
 		return res;
 
-	res = tee_svc_cryp_get_state(sess, tee_svc_uref_to_vaddr(dst), &cs_dst);
+	res = tee_svc_cryp_get_state(sess, dst, &cs_dst);
 	if (res != TEE_SUCCESS)
 		return res;
 
-	res = tee_svc_cryp_get_state(sess, tee_svc_uref_to_vaddr(src), &cs_src);
+	res = tee_svc_cryp_get_state(sess, src, &cs_src);
 	if (res != TEE_SUCCESS)
 		return res;
 	if (cs_dst->algo != cs_src->algo || cs_dst->mode != cs_src->mode)
@@ -2157,7 +2172,7 @@ TEE_Result syscall_cryp_state_free(unsigned long state)
 	if (res != TEE_SUCCESS)
 		return res;
 
-	res = tee_svc_cryp_get_state(sess, tee_svc_uref_to_vaddr(state), &cs);
+	res = tee_svc_cryp_get_state(sess, state, &cs);
 	if (res != TEE_SUCCESS)
 		return res;
 	cryp_state_free(to_user_ta_ctx(sess->ctx), cs);
@@ -2176,7 +2191,7 @@ TEE_Result syscall_hash_init(unsigned long state,
 	if (res != TEE_SUCCESS)
 		return res;
 
-	res = tee_svc_cryp_get_state(sess, tee_svc_uref_to_vaddr(state), &cs);
+	res = tee_svc_cryp_get_state(sess, state, &cs);
 	if (res != TEE_SUCCESS)
 		return res;
 
@@ -2239,7 +2254,7 @@ TEE_Result syscall_hash_update(unsigned long state, const void *chunk,
 	if (res != TEE_SUCCESS)
 		return res;
 
-	res = tee_svc_cryp_get_state(sess, tee_svc_uref_to_vaddr(state), &cs);
+	res = tee_svc_cryp_get_state(sess, state, &cs);
 	if (res != TEE_SUCCESS)
 		return res;
 
@@ -2297,7 +2312,7 @@ TEE_Result syscall_hash_final(unsigned long state, const void *chunk,
 	if (res != TEE_SUCCESS)
 		return res;
 
-	res = tee_svc_cryp_get_state(sess, tee_svc_uref_to_vaddr(state), &cs);
+	res = tee_svc_cryp_get_state(sess, state, &cs);
 	if (res != TEE_SUCCESS)
 		return res;
 
@@ -2370,7 +2385,7 @@ TEE_Result syscall_cipher_init(unsigned long state, const void *iv,
 		return res;
 	utc = to_user_ta_ctx(sess->ctx);
 
-	res = tee_svc_cryp_get_state(sess, tee_svc_uref_to_vaddr(state), &cs);
+	res = tee_svc_cryp_get_state(sess, state, &cs);
 	if (res != TEE_SUCCESS)
 		return res;
 
@@ -2424,7 +2439,7 @@ static TEE_Result tee_svc_cipher_update_helper(unsigned long state,
 	if (res != TEE_SUCCESS)
 		return res;
 
-	res = tee_svc_cryp_get_state(sess, tee_svc_uref_to_vaddr(state), &cs);
+	res = tee_svc_cryp_get_state(sess, state, &cs);
 	if (res != TEE_SUCCESS)
 		return res;
 
@@ -2652,7 +2667,7 @@ TEE_Result syscall_cryp_derive_key(unsigned long state,
 		return res;
 	utc = to_user_ta_ctx(sess->ctx);
 
-	res = tee_svc_cryp_get_state(sess, tee_svc_uref_to_vaddr(state), &cs);
+	res = tee_svc_cryp_get_state(sess, state, &cs);
 	if (res != TEE_SUCCESS)
 		return res;
 
@@ -2668,7 +2683,7 @@ TEE_Result syscall_cryp_derive_key(unsigned long state,
 	if (res != TEE_SUCCESS)
 		goto out;
 
-	res = tee_obj_get(utc, tee_svc_uref_to_vaddr(derived_key), &so);
+	res = tee_obj_get(utc, derived_key, &so);
 	if (res != TEE_SUCCESS)
 		goto out;
 
@@ -2908,7 +2923,7 @@ TEE_Result syscall_authenc_init(unsigned long state, const void *nonce,
 	if (res != TEE_SUCCESS)
 		return res;
 
-	res = tee_svc_cryp_get_state(sess, tee_svc_uref_to_vaddr(state), &cs);
+	res = tee_svc_cryp_get_state(sess, state, &cs);
 	if (res != TEE_SUCCESS)
 		return res;
 
@@ -2949,7 +2964,7 @@ TEE_Result syscall_authenc_update_aad(unsigned long state,
 	if (res != TEE_SUCCESS)
 		return res;
 
-	res = tee_svc_cryp_get_state(sess, tee_svc_uref_to_vaddr(state), &cs);
+	res = tee_svc_cryp_get_state(sess, state, &cs);
 	if (res != TEE_SUCCESS)
 		return res;
 
@@ -2975,7 +2990,7 @@ TEE_Result syscall_authenc_update_payload(unsigned long state,
 	if (res != TEE_SUCCESS)
 		return res;
 
-	res = tee_svc_cryp_get_state(sess, tee_svc_uref_to_vaddr(state), &cs);
+	res = tee_svc_cryp_get_state(sess, state, &cs);
 	if (res != TEE_SUCCESS)
 		return res;
 
@@ -3036,7 +3051,7 @@ TEE_Result syscall_authenc_enc_final(unsigned long state,
 	if (res != TEE_SUCCESS)
 		return res;
 
-	res = tee_svc_cryp_get_state(sess, tee_svc_uref_to_vaddr(state), &cs);
+	res = tee_svc_cryp_get_state(sess, state, &cs);
 	if (res != TEE_SUCCESS)
 		return res;
 
@@ -3124,7 +3139,7 @@ TEE_Result syscall_authenc_dec_final(unsigned long state,
 	if (res != TEE_SUCCESS)
 		return res;
 
-	res = tee_svc_cryp_get_state(sess, tee_svc_uref_to_vaddr(state), &cs);
+	res = tee_svc_cryp_get_state(sess, state, &cs);
 	if (res != TEE_SUCCESS)
 		return res;
 
@@ -3228,7 +3243,7 @@ TEE_Result syscall_asymm_operate(unsigned long state,
 		return res;
 	utc = to_user_ta_ctx(sess->ctx);
 
-	res = tee_svc_cryp_get_state(sess, tee_svc_uref_to_vaddr(state), &cs);
+	res = tee_svc_cryp_get_state(sess, state, &cs);
 	if (res != TEE_SUCCESS)
 		return res;
 
@@ -3390,7 +3405,7 @@ TEE_Result syscall_asymm_verify(unsigned long state,
 		return res;
 	utc = to_user_ta_ctx(sess->ctx);
 
-	res = tee_svc_cryp_get_state(sess, tee_svc_uref_to_vaddr(state), &cs);
+	res = tee_svc_cryp_get_state(sess, state, &cs);
 	if (res != TEE_SUCCESS)
 		return res;
 
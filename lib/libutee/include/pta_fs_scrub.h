@@ -0,0 +1,62 @@
+/* SPDX-License-Identifier: BSD-2-Clause */
+/*
+ * Copyright (c) 2018, Linaro Limited
+ */
+
+#ifndef __PTA_FS_SCRUB_H
+#define __PTA_FS_SCRUB_H
+
+#include <stdint.h>
+
+/*
+ * Verifies the hash trees and data of all objects in the REE FS secure
+ * storage. The normal world invokes PTA_FS_SCRUB_CMD_RUN repeatedly, for
+ * instance from an idle task, and each invocation verifies objects for
+ * at most one time slice. The position, down to the data block within an
+ * object, is kept between invocations.
+ */
+#define PTA_FS_SCRUB_UUID { 0x40405aa3, 0xe9f4, 0x4e19, { \
+			    0xa1, 0xc5, 0xa4, 0xa7, 0x9b, 0x5f, 0x6b, 0x9d } }
+
+/* Start over from the first object */
+#define PTA_FS_SCRUB_FLAG_RESTART	(1 << 0)
+/* Remove objects which fail verification unless they are open */
+#define PTA_FS_SCRUB_FLAG_REMOVE	(1 << 1)
+
+/* An object which failed verification */
+struct pta_fs_scrub_corrupt {
+	uint8_t uuid[16];	/* UUID of the owning TA as an octet string */
+	uint32_t oid_len;
+	uint8_t oid[64];
+	uint32_t removed;	/* 1 if the object was removed */
+};
+
+/*
+ * Verify objects for one time slice
+ *
+ * [in]		value[0].a: PTA_FS_SCRUB_FLAG_* flags
+ * [in]		value[0].b: length of the time slice in milliseconds, 0
+ *			    for the default
+ * [out]	value[1].a: 1 if the last object was verified, else 0
+ * [out]	value[1].b: milliseconds to wait before the next invocation
+ *			    to stay below the configured data rate
+ * [out]	memref[2]:  optional array of struct pta_fs_scrub_corrupt,
+ *			    the size is updated with the objects failing
+ *			    verification in this slice. The slice ends early
+ *			    when the array is full.
+ */
+#define PTA_FS_SCRUB_CMD_RUN		0
+
+/*
+ * Get the counters accumulated since boot
+ *
+ * [out]	value[0].a: objects verified
+ * [out]	value[0].b: objects failing verification
+ * [out]	value[1].a: KiB of data verified
+ * [out]	value[1].b: objects removed
+ * [out]	value[2].a: completed passes over all objects
+ * [out]	value[2].b: milliseconds spent verifying
+ */
+#define PTA_FS_SCRUB_CMD_GET_STATS	1
+
+#endif /*__PTA_FS_SCRUB_H*/
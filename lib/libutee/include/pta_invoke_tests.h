@@ -68,5 +68,83 @@
 #define PTA_MUTEX_TEST_READER			1
 #define PTA_INVOKE_TESTS_CMD_MUTEX		7
 
+/*
+ * Benchmarks looking up objects in the REE FS dirfile
+ *
+ * [in]  value[0].a	number of objects, 0 to log results for a range of
+ *			object counts instead
+ * [out] value[1].a	time to open the dirfile and look up every object
+ *			in us
+ * [out] value[1].b	average time to look up an object, the open
+ *			included, in ns
+ * [out] value[2].a	average number of dirfile reads per lookup, the
+ *			open included
+ */
+#define PTA_INVOKE_TESTS_CMD_FS_DIRFILE_BENCH	8
+
+/*
+ * Benchmarks authenticated writes to the RPMB FS
+ *
+ * [in]  value[0].a	number of bytes per write, 0 for 4 KiB
+ * [in]  value[0].b	total number of bytes to write, 0 for 64 KiB
+ * [out] value[1].a	write throughput in bytes/s
+ * [out] value[1].b	total number of bytes written
+ */
+#define PTA_INVOKE_TESTS_CMD_RPMB_WRITE_BENCH	9
+
+/*
+ * Benchmarks looking up open sessions by id
+ *
+ * [in]  value[0].a	number of sessions to open, 0 for 128. Each session
+ *			takes about 170 bytes of core heap.
+ * [in]  value[0].b	number of lookups of each session, 0 for 16
+ * [out] value[1].a	average time to get and put a session in ns
+ * [out] value[1].b	number of sessions opened
+ */
+#define PTA_INVOKE_TESTS_CMD_SESSION_LOOKUP_BENCH	10
+
+/*
+ * Stresses opening and closing sessions, meant to be invoked from several
+ * normal world threads at once so it runs on several cores concurrently
+ *
+ * [in]  value[0].a	number of rounds, 0 for 256
+ * [in]  memref[1]	optional array of TEE_UUID of the TAs to open a
+ *			session to each round, the invoke tests pseudo TA
+ *			if not supplied
+ * [out] value[2].a	opened sessions per second
+ * [out] value[2].b	number of sessions which failed to open
+ */
+#define PTA_INVOKE_TESTS_CMD_TA_OPEN_STRESS	11
+
+/*
+ * Benchmarks looking up the objects and crypto states of a TA by the
+ * handles the TA uses
+ *
+ * [in]  value[0].a	number of live objects and of live crypto states,
+ *			0 to log results for 1, 100 and 1000 of each
+ *			instead. Each object takes about 100 bytes of core
+ *			heap, a count too large for the heap fails with
+ *			TEE_ERROR_OUT_OF_MEMORY while the logged counts are
+ *			reduced to what fits.
+ * [in]  value[0].b	number of lookups of each handle, 0 for 64
+ * [out] value[1].a	average time to look up an object in ns
+ * [out] value[1].b	number of live objects
+ * [out] value[2].a	average time to look up a crypto state in ns
+ * [out] value[2].b	number of live crypto states
+ */
+#define PTA_INVOKE_TESTS_CMD_OBJ_LOOKUP_BENCH	12
+
+/*
+ * Stresses getting and releasing open persistent objects, meant to be
+ * invoked from several normal world threads at once so it runs on several
+ * cores concurrently. Each invocation uses objects of a UUID of its own.
+ *
+ * [in]  value[0].a	number of objects, 0 for 16
+ * [in]  value[0].b	number of rounds, 0 for 1024
+ * [out] value[1].a	get and release pairs per second
+ * [out] value[1].b	number of objects
+ */
+#define PTA_INVOKE_TESTS_CMD_POBJ_STRESS	13
+
 #endif /*__PTA_INVOKE_TESTS_H*/
 
@@ -34,4 +34,12 @@ TEE_Result TEE_CacheClean(char *buf, size_t len);
 TEE_Result TEE_CacheFlush(char *buf, size_t len);
 TEE_Result TEE_CacheInvalidate(char *buf, size_t len);
 
+/*
+ * TEE_SyncPersistentObject() - Waits until all earlier updates of the
+ * persistent object are committed to storage. Storage may complete
+ * writes before they are committed, data not yet committed is lost if
+ * the device is reset.
+ */
+TEE_Result TEE_SyncPersistentObject(TEE_ObjectHandle object);
+
 #endif
@@ -6,6 +6,7 @@
 #include <string.h>
 
 #include <tee_api.h>
+#include <tee_internal_api_extensions.h>
 #include <utee_syscalls.h>
 #include "tee_api_private.h"
 
@@ -773,3 +774,24 @@ out:
 
 	return res;
 }
+
+TEE_Result TEE_SyncPersistentObject(TEE_ObjectHandle object)
+{
+	TEE_Result res;
+
+	if (object == TEE_HANDLE_NULL) {
+		res = TEE_ERROR_BAD_PARAMETERS;
+		goto out;
+	}
+
+	res = utee_storage_obj_sync((unsigned long)object);
+
+out:
+	if (res != TEE_SUCCESS &&
+	    res != TEE_ERROR_STORAGE_NO_SPACE &&
+	    res != TEE_ERROR_CORRUPT_OBJECT &&
+	    res != TEE_ERROR_STORAGE_NOT_AVAILABLE)
+		TEE_Panic(res);
+
+	return res;
+}
@@ -23,6 +23,16 @@ static inline bool atomic_cas_u32(uint32_t *p, uint32_t *oval, uint32_t nval)
 	return __compiler_compare_and_swap(p, oval, nval);
 }
 
+/*
+ * Same as atomic_cas_u32() except that it orders earlier memory accesses
+ * before the swap instead of later ones after it.
+ */
+static inline bool atomic_cas_u32_release(uint32_t *p, uint32_t *oval,
+					  uint32_t nval)
+{
+	return __compiler_compare_and_swap_release(p, oval, nval);
+}
+
 static inline unsigned int atomic_load_uint(unsigned int *p)
 {
 	return __compiler_atomic_load(p);
@@ -222,6 +222,10 @@
 	__atomic_compare_exchange_n((p), (oval), (nval), true, \
 				    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED) \
 
+#define __compiler_compare_and_swap_release(p, oval, nval) \
+	__atomic_compare_exchange_n((p), (oval), (nval), true, \
+				    __ATOMIC_RELEASE, __ATOMIC_RELAXED) \
+
 #define __compiler_atomic_load(p) __atomic_load_n((p), __ATOMIC_RELAXED)
 #define __compiler_atomic_store(p, val) \
 	__atomic_store_n((p), (val), __ATOMIC_RELAXED)
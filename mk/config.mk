@@ -85,6 +85,31 @@ CFG_WITH_SOFTWARE_PRNG ?= y
 # Number of threads
 CFG_NUM_THREADS ?= 2
 
+# Number of threads with a statically allocated stack, at least 1. Without
+# CFG_WITH_PAGER the remaining threads up to CFG_NUM_THREADS only get a
+# stack from the core heap once all these threads are busy, and give it
+# back when they return. This lets the thread pool grow under load without
+# reserving memory for the peak. With CFG_WITH_PAGER all thread stacks are
+# paged in on demand and released when the thread returns.
+CFG_NUM_THREADS_STATIC ?= $(CFG_NUM_THREADS)
+
+# A thread trying to take a mutex which is write locked by a thread running
+# on another core spins for up to this many iterations before it waits in
+# normal world, which costs an RPC both to sleep and to be woken up.
+# 0 disables spinning.
+CFG_MUTEX_SPIN_COUNT ?= 1000
+
+# Number of buckets, a power of two, of the hash table indexing open TA
+# sessions by id. Each bucket has its own mutex so looking up different
+# sessions rarely contends.
+CFG_TA_SESSION_HASH_SIZE ?= 64
+
+# Open persistent objects are hashed on (TA UUID, object id) into this
+# many lists, a power of two, each with a mutex protecting the objects in
+# it and their reference counts. A rename locks both the list of the old
+# and of the new object id. Increase it if many objects are kept open.
+CFG_TEE_POBJ_HASH_SIZE ?= 64
+
 # API implementation version
 CFG_TEE_API_VERSION ?= GPD-1.1-dev
 
@@ -124,6 +149,23 @@ CFG_TEE_FW_MANUFACTURER ?= FW_MAN_UNDEF
 # TEE_STORAGE_PRIVATE is passed to the trusted storage API)
 CFG_REE_FS ?= y
 
+# Cache of decrypted and authenticated REE FS data blocks, shared by all
+# open files. Blocks modified by a write are kept in the cache until the
+# file is synchronized to storage. CFG_REE_FS_BLOCK_CACHE_SIZE is the
+# maximum number of cached blocks, each block is 4 KiB of heap.
+CFG_REE_FS_BLOCK_CACHE ?= y
+CFG_REE_FS_BLOCK_CACHE_SIZE ?= 4
+
+# Read ahead into the REE FS block cache when a file is read sequentially.
+# The read-ahead window grows with each sequential read up to
+# CFG_REE_FS_BLOCK_CACHE_SIZE blocks.
+CFG_REE_FS_READ_AHEAD ?= $(CFG_REE_FS_BLOCK_CACHE)
+$(eval $(call cfg-depends-all,CFG_REE_FS_READ_AHEAD,CFG_REE_FS_BLOCK_CACHE))
+
+# Only authenticate the root of the hash tree of a REE FS file when it's
+# opened, the other nodes are verified when first used.
+CFG_FS_HTREE_LAZY_VERIFY ?= y
+
 # RPMB file system support
 CFG_RPMB_FS ?= n
 
@@ -142,6 +184,45 @@ CFG_RPMB_FS_DEV_ID ?= 0
 # - RPMB key provisioning in a controlled environment (factory setup)
 CFG_RPMB_WRITE_KEY ?= n
 
+# Pack as many blocks in each authenticated RPMB write request as the
+# device supports for a reliable write (EXT_CSD REL_WR_SEC_C) instead of
+# one block per request. Requires a normal world RPMB driver which handles
+# multi-block reliable writes.
+CFG_RPMB_MULTI_BLOCK_WRITE ?= n
+
+# Keep writes to RPMB FS files of TAs in secure memory and write them to
+# RPMB when the object is closed or before the file is accessed through
+# another handle, truncated or renamed. At most CFG_RPMB_FS_WB_CACHE_SIZE
+# bytes are kept before they are written. Each write to RPMB is still
+# atomic, but data not yet written is lost if the device is reset.
+CFG_RPMB_FS_WB_CACHE ?= n
+CFG_RPMB_FS_WB_CACHE_SIZE ?= 4096
+
+# Journal updates of the REE FS directory file (dirf.db) in an append-only
+# file instead of committing its hash tree for each created, renamed or
+# removed object. The journal is compacted into dirf.db after
+# CFG_REE_FS_DIRF_JOURNAL_RECORDS records. Not supported with CFG_RPMB_FS
+# since the journal isn't protected against rollback.
+# Note that this changes the storage format: a build without it ignores
+# the journal, so once enabled it must stay enabled on that device.
+CFG_REE_FS_DIRF_JOURNAL ?= n
+CFG_REE_FS_DIRF_JOURNAL_RECORDS ?= 64
+
+# Defer committing REE FS writes and truncations to storage. An updated
+# object is committed when it's closed or synced with
+# TEE_SyncPersistentObject(), before it's opened again or at the latest
+# after CFG_REE_FS_ASYNC_COMMIT_WRITES updates. Updates not yet committed
+# are lost on reset, the object is then found in its last committed state.
+CFG_REE_FS_ASYNC_COMMIT ?= n
+CFG_REE_FS_ASYNC_COMMIT_WRITES ?= 16
+
+# Keep the normal world shared memory used for file system RPCs in a pool
+# shared by all threads instead of freeing it when a thread returns to
+# normal world, as long as normal world allows shared memory to be cached.
+# CFG_FS_RPC_POOL_SIZE is the maximum size of the pool in bytes, 0 disables
+# it.
+CFG_FS_RPC_POOL_SIZE ?= 262144
+
 # Embed public part of this key in OP-TEE OS
 TA_SIGN_KEY ?= keys/default_ta.pem
 
@@ -292,6 +373,15 @@ $(eval $(call cfg-depends-all,CFG_SECSTOR_TA,CFG_REE_FS CFG_WITH_USER_TA))
 CFG_SECSTOR_TA_MGMT_PTA ?= $(call cfg-all-enabled,CFG_SECSTOR_TA)
 $(eval $(call cfg-depends-all,CFG_SECSTOR_TA_MGMT_PTA,CFG_SECSTOR_TA))
 
+# Enable the pseudo TA that verifies all objects in the REE FS secure
+# storage in time slices and reports or removes corrupt objects.
+# CFG_FS_SCRUB_SLICE_MS is the default length of a time slice and
+# CFG_FS_SCRUB_RATE_KIB the maximum rate of verified data in KiB/s.
+CFG_FS_SCRUB_PTA ?= n
+$(eval $(call cfg-depends-all,CFG_FS_SCRUB_PTA,CFG_REE_FS CFG_WITH_USER_TA))
+CFG_FS_SCRUB_SLICE_MS ?= 10
+CFG_FS_SCRUB_RATE_KIB ?= 512
+
 # Enable the pseudo TA for misc. auxilary services, extending existing
 # GlobalPlatform Core API (for example, re-seeding RNG entropy pool etc.)
 CFG_SYSTEM_PTA ?= y
@@ -309,6 +399,16 @@ CFG_CORE_CLUSTER_SHIFT ?= 2
 # will accept dynamic SHM buffers.
 CFG_DYN_SHM_CAP ?= y
 
+# Let normal world register a command ring per session, see struct
+# optee_msg_cmd_ring. Invoke commands placed in the ring are processed on
+# a doorbell SMC without mapping a struct optee_msg_arg for each command.
+CFG_CORE_CMD_RING ?= n
+
+# Let normal world register call queues, see struct optee_msg_call_queue.
+# Open session, invoke command and close session requests submitted to a
+# queue are processed in a batch on one doorbell SMC.
+CFG_CORE_CALL_QUEUE ?= n
+
 # Enables support for larger physical addresses, that is, it will define
 # paddr_t as a 64-bit type.
 CFG_CORE_LARGE_PHYS_ADDR ?= n